@@ -0,0 +1,531 @@
+/*********************************
+**   Microbenchmarks of the     **
+**   router hot paths           **
+*********************************/
+
+/* Each benchmark is calibrated to run ~BENCH_TARGET_NS per sample, then
+ * BENCH_SAMPLES samples are taken and the median is reported, with the
+ * number of heap allocations per operation (malloc is interposed below)
+ * and, when the PMU is readable (perf_event_open), the L1D read misses.
+ *
+ * Usage: bench [filter]    only run benchmarks whose name contains 'filter'
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+
+#include "../src/router.h"
+#include "../src/capture.h"
+#include "../src/latency.h"
+#include "../src/dvsimd.h"
+
+#define BENCH_SAMPLES 7
+#define BENCH_TARGET_NS 20000000L   // 20 ms per sample
+#define BENCH_ID 200                // router id used by the benchmarks (log/R200.txt)
+#define BENCH_MISS_ID 0             // never in the tables of make_rt (ids from 1)
+#define COLD_TABLES 256             // routing tables of the cold lookups (larger than L2)
+
+typedef void (*bench_fn)(long n, void *arg);
+
+static const char *filter = NULL;
+static volatile unsigned long sink;
+static int perf_fd = -1;            // L1D read miss counter (-1: none)
+
+/* ==================================================================== */
+/* ======================= ALLOCATION COUNTER ========================= */
+/* ==================================================================== */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long nb_allocs = 0;
+
+void *malloc(size_t size) {
+    nb_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    nb_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    nb_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+/* ==================================================================== */
+/* ============================= RUNNER =============================== */
+/* ==================================================================== */
+
+static long now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+// Count the L1D read misses of this thread in user space (perf_event_paranoid <= 2)
+static void perf_open() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd < 0)
+        fprintf(stderr, "bench: no cache miss counter (perf_event_open: %s)\n", strerror(errno));
+}
+
+static unsigned long perf_read() {
+    unsigned long v = 0;
+    if (perf_fd >= 0 && read(perf_fd, &v, sizeof(v)) != sizeof(v))
+        v = 0;
+    return v;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, bench_fn fn, void *arg) {
+
+    double samples[BENCH_SAMPLES];
+    unsigned long allocs = 0, misses = 0;
+    long n = 1, t;
+
+    if (filter != NULL && strstr(name, filter) == NULL)
+        return;
+    // calibrate the number of operations per sample
+    while (1) {
+        t = now_ns();
+        fn(n, arg);
+        t = now_ns() - t;
+        if (t >= BENCH_TARGET_NS / 4 || n >= (1L << 30))
+            break;
+        n *= 2;
+    }
+    n = n * (BENCH_TARGET_NS / (t > 0 ? t : 1)) + 1;
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        unsigned long a = nb_allocs, m = perf_read();
+        t = now_ns();
+        fn(n, arg);
+        t = now_ns() - t;
+        misses += perf_read() - m;
+        allocs += nb_allocs - a;
+        samples[i] = (double) t / n;
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(double), cmp_double);
+    printf("%-40s %12.1f ns/op %10.2f allocs/op", name,
+           samples[BENCH_SAMPLES / 2], (double) allocs / (n * BENCH_SAMPLES));
+    if (perf_fd >= 0)
+        printf(" %8.2f L1D misses/op", (double) misses / (n * BENCH_SAMPLES));
+    printf("  (min %.1f, max %.1f)\n", samples[0], samples[BENCH_SAMPLES - 1]);
+    fflush(stdout);
+}
+
+/* ==================================================================== */
+/* ============================ FIXTURES ============================== */
+/* ==================================================================== */
+
+// Routing table with 'size' entries: dest i+1 (i > 0) via neighbors 2..6
+static void make_rt(routing_table_t *rt, int size) {
+
+    overlay_addr_t next;
+    rt -> size = 0;
+    init_routing_table(rt);
+    for (int d = 1; rt -> size < size; d++) {
+        if (d == BENCH_ID)
+            continue;
+        init_node(&next, 2 + d % 5, LOCALHOST);
+        add_route(rt, d, &next, 1 + d % 4);
+    }
+}
+
+// Same as make_rt, plus a summary of each area of 'bits' bits (ids above
+// 'size') and a default route
+static void make_rt_areas(routing_table_t *rt, int size, int bits) {
+
+    overlay_addr_t next;
+    make_rt(rt, size);
+    for (int a = 1 << (ID_BITS - bits); a < MAX_ROUTES && rt -> size < MAX_ROUTES - 1;
+         a += 1 << (ID_BITS - bits)) {
+        if (a <= size)
+            continue;
+        init_node(&next, 2 + a % 5, LOCALHOST);
+        add_prefix_route(rt, a, bits, &next, 3);
+    }
+    init_node(&next, 2, LOCALHOST);
+    add_prefix_route(rt, 0, 0, &next, 1);
+}
+
+// DV refreshing the first 'size' routes of rt, as sent by neighbor 'src'
+static void make_dv(packet_ctrl_t *p, const routing_table_t *rt, int size, node_id_t src) {
+    p -> type = CTRL;
+    p -> src_id = src;
+    p -> dv_size = 0;
+    for (int i = 1; i < rt -> size && p -> dv_size < size; i++) {
+        p -> dv[p -> dv_size].dest = rt -> tab[i].dest;
+        p -> dv[p -> dv_size].metric = rt -> tab[i].metric - 1;
+        p -> dv_size++;
+    }
+}
+
+/* ==================================================================== */
+/* =========================== BENCHMARKS ============================= */
+/* ==================================================================== */
+
+static void bench_lookup(long n, void *arg) {
+    routing_table_t *rt = arg;
+    for (long i = 0; i < n; i++)
+        sink += (unsigned long) find_route(rt, rt -> tab[i % rt -> size].dest);
+}
+
+static void bench_lookup_miss(long n, void *arg) {
+    routing_table_t *rt = arg;
+    for (long i = 0; i < n; i++)
+        sink += (unsigned long) find_route(rt, BENCH_MISS_ID);
+}
+
+// Destinations outside the table: longest prefix match on the summaries
+// and the default route added by make_rt_areas
+static void bench_lookup_prefix(long n, void *arg) {
+    routing_table_t *rt = arg;
+    for (long i = 0; i < n; i++)
+        sink += (unsigned long) find_route(rt, 64 + i % 192);
+}
+
+struct lookup_args {
+    routing_table_t *rt;
+    int count;                      // tables
+};
+
+// Next hop address of a random dest in one of the tables, as forward_packet
+// did before the FIB: longest prefix match in the RIB, address parsed
+static void bench_rib_lookup(long n, void *arg) {
+    struct lookup_args *l = arg;
+    unsigned x = 1;
+    for (long i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        routing_table_entry_t *r = find_route(&l -> rt[(x >> 8) % l -> count], x >> 24);
+        if (r != NULL)
+            sink += inet_addr(r -> nexthop.ip) + htons(r -> nexthop.port);
+    }
+}
+
+// Same through the FIB (next hop id, then its parsed address)
+static void bench_fib_lookup(long n, void *arg) {
+    struct lookup_args *l = arg;
+    unsigned x = 1;
+    for (long i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        routing_table_t *rt = &l -> rt[(x >> 8) % l -> count];
+        int nh = rt -> fib[x >> 24];
+        if (nh != FIB_NONE)
+            sink += rt -> fib_adr[nh].in.sin_addr.s_addr + rt -> fib_adr[nh].in.sin_port;
+    }
+}
+
+static void bench_forward(long n, void *arg) {
+    routing_table_t *rt = arg;
+    packet_data_t p;
+    memset(&p, 0, sizeof(p));
+    p.type = DATA;
+    p.subtype = ECHO_REQUEST;
+    p.ttl = DEFAULT_TTL;
+    for (long i = 0; i < n; i++) {
+        p.dst_id = rt -> tab[1 + i % (rt -> size - 1)].dest;
+        sink += forward_packet(&p, sizeof(p), rt);
+    }
+}
+
+struct merge_args {
+    routing_table_t rt;
+    packet_ctrl_t dv;
+    overlay_addr_t src;
+};
+
+static void bench_update_rt(long n, void *arg) {
+    struct merge_args *m = arg;
+    for (long i = 0; i < n; i++)
+        sink += update_rt(&m -> rt, &m -> src, m -> dv.dv, m -> dv.dv_size, BROADCAST_PERIOD, NULL);
+}
+
+static void bench_update_rt_dirty(long n, void *arg) {
+    struct merge_args *m = arg;
+    rt_dirty_t dirty;
+    for (long i = 0; i < n; i++) {
+        memset(&dirty, 0, sizeof(dirty));
+        sink += update_rt(&m -> rt, &m -> src, m -> dv.dv, m -> dv.dv_size, BROADCAST_PERIOD, &dirty);
+    }
+}
+
+// Previous merge, for comparison: linear search of each DV entry in the
+// table, clock read for each updated route (host routes only)
+static int update_rt_linear(routing_table_t *rt, overlay_addr_t *src, dv_entry_t *dv, int dv_size) {
+    for (int i = 0; i < dv_size; i++) {
+        dv_entry_t dve = dv[i];
+        dve.metric = DV_METRIC(dve.metric);
+        for (int j = 0; j < rt -> size; j++) {
+            if (dve.dest == rt -> tab[j].dest && rt -> tab[j].plen == ID_BITS) {
+                if (rt -> tab[j].metric > dve.metric + 1
+                        || rt -> tab[j].nexthop.id == src -> id) {
+                    rt -> tab[j].metric     = dve.metric + 1;
+                    rt -> tab[j].nexthop    = *src;
+                    rt -> tab[j].time       = time(NULL);
+                }
+                goto dst_found;
+            }
+        }
+        if (dve.metric < MAX_METRIC && rt -> size < MAX_ROUTES)
+            add_route(rt, dve.dest, src, dve.metric + 1);
+        dst_found:;
+    }
+    return 1;
+}
+
+static void bench_update_rt_linear(long n, void *arg) {
+    struct merge_args *m = arg;
+    for (long i = 0; i < n; i++)
+        sink += update_rt_linear(&m -> rt, &m -> src, m -> dv.dv, m -> dv.dv_size);
+}
+
+static void bench_build_dv(long n, void *arg) {
+    routing_table_t *rt = arg;
+    packet_ctrl_t p;
+    for (long i = 0; i < n; i++) {
+        build_dv_specific(&p, rt, 2 + i % 5, 0);
+        sink += p.dv_size;
+    }
+}
+
+struct obsolete_args {
+    routing_table_t ref;
+    routing_table_t rt;
+};
+
+static void bench_rt_copy(long n, void *arg) {
+    struct obsolete_args *o = arg;
+    for (long i = 0; i < n; i++) {
+        memcpy(&o -> rt, &o -> ref, sizeof(routing_table_t));
+        sink += o -> rt.size;
+    }
+}
+
+static void bench_remove_obsolete(long n, void *arg) {
+    struct obsolete_args *o = arg;
+    for (long i = 0; i < n; i++) {
+        memcpy(&o -> rt, &o -> ref, sizeof(routing_table_t));
+        remove_obsolete_entries(&o -> rt);
+        sink += o -> rt.size;
+    }
+}
+
+static void bench_encode_data(long n, void *arg) {
+    packet_data_t p;
+    struct timespec t = {0, 0};
+    for (long i = 0; i < n; i++) {
+        p.type = DATA;
+        p.subtype = ECHO_REQUEST;
+        p.src_id = BENCH_ID;
+        p.dst_id = i;
+        p.ttl = DEFAULT_TTL;
+        p.msg_seq = i;
+        p.len = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        p.time_sec = t.tv_sec;
+        p.time_nsec = t.tv_nsec;
+        sink += p.time_nsec + p.dst_id;
+    }
+}
+
+struct parse_args {
+    const char *buf;
+    int size;
+};
+
+static void bench_parse(long n, void *arg) {
+    struct parse_args *pa = arg;
+    for (long i = 0; i < n; i++)
+        sink += parse_packet(pa -> buf, pa -> size);
+}
+
+static void bench_capture(long n, void *arg) {
+    struct parse_args *pa = arg;
+    for (long i = 0; i < n; i++) {
+        CAP_PACKET(CAP_RX, 2, pa -> buf, pa -> size);
+        sink += i;
+    }
+}
+
+static void bench_lat_record(long n, void *arg) {
+    for (long i = 0; i < n; i++)
+        lat_record(LAT_LOOKUP, i & 0xffff);
+}
+
+static void bench_logger(long n, void *arg) {
+    for (long i = 0; i < n; i++)
+        logger("BENCH", "DATA packet received");
+}
+
+static void bench_log_dv(long n, void *arg) {
+    for (long i = 0; i < n; i++)
+        log_dv(arg, 2, 0);
+}
+
+/* ==================================================================== */
+/* ============================== MAIN ================================ */
+/* ==================================================================== */
+
+int main(int argc, char **argv) {
+
+    char name[64];
+    cpu_set_t cpus;
+
+    if (argc > 1)
+        filter = argv[1];
+    CPU_ZERO(&cpus);                    // stay on one CPU for stable results
+    CPU_SET(0, &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+    MY_ID = BENCH_ID;
+    log_enabled = 0;
+    perf_open();
+
+    // sink for forwarded packets, so that no ICMP error is generated
+    int sinks[5];
+    for (int i = 0; i < 5; i++) {
+        struct sockaddr_in adr;
+        memset(&adr, 0, sizeof(adr));
+        adr.sin_family = AF_INET;
+        adr.sin_port = htons(5555 + 2 + i);
+        adr.sin_addr.s_addr = inet_addr(LOCALHOST);
+        sinks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (bind(sinks[i], (struct sockaddr *) &adr, sizeof(adr)) < 0)
+            perror("bench: bind sink (ports in use by a router?)");
+    }
+
+    static routing_table_t rt;
+    int best = dv_kernel;               // selected at startup
+    int rt_sizes[] = {2, 20, 255};
+    for (int i = 0; i < 3; i++) {
+        make_rt(&rt, rt_sizes[i]);
+        sprintf(name, "find_route/rt=%d", rt_sizes[i]);
+        run(name, bench_lookup, &rt);
+        sprintf(name, "find_route_miss/rt=%d", rt_sizes[i]);
+        if (find_route(&rt, BENCH_MISS_ID) != NULL) {
+            fprintf(stderr, "bench: %s finds a route\n", name);
+            exit(EXIT_FAILURE);
+        }
+        run(name, bench_lookup_miss, &rt);
+        for (int k = DV_KERNEL_SCALAR; k <= DV_KERNEL_AVX2; k++) {
+            if (!dv_kernel_set(k))
+                continue;
+            sprintf(name, "build_dv_specific/rt=%d,%s", rt_sizes[i], dv_kernel_name(k));
+            run(name, bench_build_dv, &rt);
+        }
+        dv_kernel_set(best);
+    }
+    make_rt_areas(&rt, 20, 4);
+    sprintf(name, "find_route_prefix/rt=%d", rt.size);
+    run(name, bench_lookup_prefix, &rt);
+
+    static routing_table_t cold[COLD_TABLES];
+    for (int i = 0; i < COLD_TABLES; i++)
+        make_rt_areas(&cold[i], 200, 4);
+    struct lookup_args one = {cold, 1}, many = {cold, COLD_TABLES};
+    sprintf(name, "rib_lookup/rt=%d", cold[0].size);
+    run(name, bench_rib_lookup, &one);
+    sprintf(name, "fib_lookup/rt=%d", cold[0].size);
+    run(name, bench_fib_lookup, &one);
+    sprintf(name, "rib_lookup/cold,%d tables", COLD_TABLES);
+    run(name, bench_rib_lookup, &many);
+    sprintf(name, "fib_lookup/cold,%d tables", COLD_TABLES);
+    run(name, bench_fib_lookup, &many);
+
+    make_rt(&rt, 20);
+    sprintf(name, "forward_packet/rt=%d", rt.size);
+    run(name, bench_forward, &rt);
+
+    static struct merge_args m;
+    int merge_sizes[][2] = {        // {table size, DV size}
+        {2, 1}, {20, 1}, {20, 19}, {255, 1}, {255, 128}, {255, 254}
+    };
+    for (int i = 0; i < 6; i++) {
+        make_rt(&m.rt, merge_sizes[i][0]);
+        make_dv(&m.dv, &m.rt, merge_sizes[i][1], 2);
+        init_node(&m.src, 2, LOCALHOST);
+        sprintf(name, "update_rt/rt=%d,dv=%d", m.rt.size, m.dv.dv_size);
+        run(name, bench_update_rt, &m);
+        sprintf(name, "update_rt_dirty/rt=%d,dv=%d", m.rt.size, m.dv.dv_size);
+        run(name, bench_update_rt_dirty, &m);
+        sprintf(name, "update_rt_linear/rt=%d,dv=%d", m.rt.size, m.dv.dv_size);
+        run(name, bench_update_rt_linear, &m);
+    }
+
+    static struct obsolete_args o;
+    make_rt(&o.ref, 255);
+    for (int i = 1; i < o.ref.size; i += 4)    // 1 route out of 4 expired
+        o.ref.tab[i].time -= 3600;
+    run("rt_copy (baseline)", bench_rt_copy, &o);
+    sprintf(name, "remove_obsolete_entries/rt=%d", o.ref.size);
+    run(name, bench_remove_obsolete, &o);
+
+    packet_data_t pdata;
+    memset(&pdata, 0, sizeof(pdata));
+    pdata.type = DATA;
+    struct parse_args pa_data = {(char *) &pdata, sizeof(pdata)};
+    static packet_ctrl_t pctrl;
+    make_rt(&rt, 255);
+    make_dv(&pctrl, &rt, MAX_DV_SIZE, 2);
+    struct parse_args pa_ctrl = {(char *) &pctrl, CTRL_SIZE(pctrl.dv_size)};
+    run("encode/data", bench_encode_data, NULL);
+    run("parse_packet/data", bench_parse, &pa_data);
+    sprintf(name, "parse_packet/ctrl,dv=%d", pctrl.dv_size);
+    run(name, bench_parse, &pa_ctrl);
+
+    cap_filter_t all = {1, -1, -1, -1};
+    run("capture/off", bench_capture, &pa_data);
+    capture_start(&all);
+    run("capture/on,data", bench_capture, &pa_data);
+    sprintf(name, "capture/on,dv=%d", pctrl.dv_size);
+    run(name, bench_capture, &pa_ctrl);
+    capture_stop();
+
+    run("lat_record", bench_lat_record, NULL);
+    latency_on = 1;
+    make_rt(&rt, 20);
+    sprintf(name, "forward_packet/rt=%d,latency", rt.size);
+    run(name, bench_forward, &rt);
+    latency_on = 0;
+    lat_reset();
+
+    mkdir("log", 0755);
+    run("logger/disabled", bench_logger, NULL);
+    log_enabled = 1;
+    run("logger/enabled", bench_logger, NULL);
+    sprintf(name, "log_dv/enabled,dv=%d", pctrl.dv_size);
+    run(name, bench_log_dv, &pctrl);
+    log_enabled = 0;
+    sprintf(name, "log/R%d.txt", BENCH_ID);
+    unlink(name);
+
+    for (int i = 0; i < 5; i++)
+        close(sinks[i]);
+    return EXIT_SUCCESS;
+}
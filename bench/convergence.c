@@ -0,0 +1,470 @@
+/*********************************
+**   Convergence and churn      **
+**   benchmark (headless)       **
+*********************************/
+
+/* For each topology: start one headless router per node, wait for the
+ * routing tables to converge, fail one router (SIGSTOP, or SIGKILL with
+ * --mode kill), wait for convergence, recover it (SIGCONT or restart) and
+ * wait again. The routing tables are polled through the control sockets
+ * and compared with the shortest paths of the topology.
+ *
+ * For each phase the harness reports the convergence time, the number of
+ * count-to-infinity episodes (a route whose metric increased at least
+ * CTI_MIN_STEPS times during the phase) and the control traffic sent by
+ * the routers. With --steady, the control traffic of the converged
+ * network is also sampled every STEADY_WINDOW s for the given time before
+ * the failure (see the adaptive DV interval, src/adaptive.h).
+ * Results are written in JSON on stdout.
+ * Topologies with areas are not supported: the tables hold area summaries.
+ *
+ * Usage: convergence [--mode pause|kill] [--timeout <s>] [--poll <ms>]
+ *                    [--victim <id>] [--steady <s>] <topo_file> ...
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../src/packet.h"
+#include "../src/control.h"
+
+#define ROUTER_EXE "./router"
+#define MAX_NODES 256
+#define INF 255
+#define CTI_MIN_STEPS 2
+#define RESP_MAX 65536
+#define STEADY_WINDOW 10        // s
+#define STEADY_MAX 360          // windows
+
+static int adj[MAX_NODES][MAX_NODES];
+static int present[MAX_NODES];
+static int dist[MAX_NODES][MAX_NODES];
+static int down[MAX_NODES];
+static pid_t pids[MAX_NODES];
+
+static int last_metric[MAX_NODES][MAX_NODES];   // last polled metric (-1: no route)
+static int increases[MAX_NODES][MAX_NODES];     // metric increases during the phase
+static int max_metric[MAX_NODES][MAX_NODES];
+
+static char *topo_file;
+static int kill_mode = 0;
+static double timeout_s = 300;
+static int poll_ms = 250;
+static int steady_s = 0;
+
+/* ==================================================================== */
+/* ============================ TOPOLOGY ============================== */
+/* ==================================================================== */
+
+static void read_topo(const char *file) {
+
+    char line[1024];
+    FILE *f = fopen(file, "rt");
+    if (f == NULL) {
+        perror(file);
+        exit(EXIT_FAILURE);
+    }
+    memset(adj, 0, sizeof(adj));
+    memset(present, 0, sizeof(present));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (!isdigit((unsigned char) line[0]))    // comment, areabits or stub line
+            continue;
+        char *token = strtok(line, " \t\n");
+        if (token == NULL)
+            continue;
+        int id = atoi(token);
+        present[id] = 1;
+        while ((token = strtok(NULL, " \t\n")) != NULL)
+            adj[id][atoi(token)] = 1;
+    }
+    fclose(f);
+}
+
+// Hop count between the routers that are up (BFS)
+static void compute_dist() {
+
+    int queue[MAX_NODES];
+    for (int s = 0; s < MAX_NODES; s++) {
+        for (int d = 0; d < MAX_NODES; d++)
+            dist[s][d] = INF;
+        if (!present[s] || down[s])
+            continue;
+        int head = 0, tail = 0;
+        dist[s][s] = 0;
+        queue[tail++] = s;
+        while (head < tail) {
+            int u = queue[head++];
+            for (int v = 0; v < MAX_NODES; v++) {
+                if (adj[u][v] && !down[v] && dist[s][v] == INF) {
+                    dist[s][v] = dist[s][u] + 1;
+                    queue[tail++] = v;
+                }
+            }
+        }
+    }
+}
+
+/* ==================================================================== */
+/* ========================= ROUTER PROCESSES ========================= */
+/* ==================================================================== */
+
+static double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+static void start_router(int id) {
+
+    char sid[8];
+    sprintf(sid, "%d", id);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        execl(ROUTER_EXE, ROUTER_EXE, sid, topo_file, "--headless", (char *) NULL);
+        _exit(127);
+    }
+    pids[id] = pid;
+}
+
+static void stop_router(int id) {
+    char path[108];
+    if (pids[id] > 0) {
+        kill(pids[id], SIGKILL);
+        waitpid(pids[id], NULL, 0);
+        pids[id] = 0;
+    }
+    snprintf(path, sizeof(path), CTL_PATH, id);
+    unlink(path);
+}
+
+// Send a command to router 'id', return the response length (-1 on error)
+static int ctl_query(int id, const char *cmd, char *resp, int size) {
+
+    struct sockaddr_un adr;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0), len = 0;
+
+    memset(&adr, 0, sizeof(adr));
+    adr.sun_family = AF_UNIX;
+    snprintf(adr.sun_path, sizeof(adr.sun_path), CTL_PATH, id);
+    if (connect(sock, (struct sockaddr *) &adr, sizeof(adr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    if (write(sock, cmd, strlen(cmd)) < 0 || write(sock, "\n", 1) < 0) {
+        close(sock);
+        return -1;
+    }
+    while (len < size - 1) {
+        int n = read(sock, resp + len, size - 1 - len);
+        if (n <= 0)
+            break;
+        len += n;
+        resp[len] = '\0';
+        if (len >= 4 && strstr(resp, "\n" CTL_END "\n") != NULL)
+            break;
+    }
+    close(sock);
+    resp[len] = '\0';
+    return len;
+}
+
+static int wait_ctl(int id, double timeout) {
+    char resp[RESP_MAX];
+    double t0 = now_s();
+    while (now_s() - t0 < timeout) {
+        if (ctl_query(id, "show stats", resp, sizeof(resp)) > 0)
+            return 1;
+        usleep(20000);
+    }
+    return 0;
+}
+
+// Routes of router 'id': metric[dest] (-1: no route), return 0 on error
+static int get_routes(int id, int *metric) {
+
+    static char resp[RESP_MAX];
+    if (ctl_query(id, "show ip route", resp, sizeof(resp)) < 0)
+        return 0;
+    for (int d = 0; d < MAX_NODES; d++)
+        metric[d] = -1;
+    for (char *line = strtok(resp, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        int dest, next, m;
+        if (sscanf(line, "%d | %d | %d", &dest, &next, &m) == 3
+                && dest >= 0 && dest < MAX_NODES)
+            metric[dest] = m <= MAX_METRIC ? m : -1;
+    }
+    return 1;
+}
+
+// Control traffic sent by router 'id'
+static int get_ctrl_sent(int id, unsigned long *pkts, unsigned long *bytes) {
+
+    static char resp[RESP_MAX];
+    if (ctl_query(id, "show stats", resp, sizeof(resp)) < 0)
+        return 0;
+    char *line = strstr(resp, "CTRL sent");
+    return line != NULL && sscanf(line, "CTRL sent %lu (%lu bytes)", pkts, bytes) == 2;
+}
+
+/* ==================================================================== */
+/* ============================= PHASES =============================== */
+/* ==================================================================== */
+
+typedef struct {
+    const char *name;
+    int converged;
+    double time;
+    int cti_episodes;
+    int cti_max_metric;
+    unsigned long ctrl_pkts, ctrl_bytes;
+} phase_t;
+
+// Check all the routing tables against the shortest paths
+static int check_tables() {
+
+    int metric[MAX_NODES], ok = 1;
+    for (int r = 0; r < MAX_NODES; r++) {
+        if (!present[r] || down[r])
+            continue;
+        if (!get_routes(r, metric)) {
+            ok = 0;
+            continue;
+        }
+        for (int d = 0; d < MAX_NODES; d++) {
+            int m = metric[d];
+            if (m > last_metric[r][d] && last_metric[r][d] >= 0)
+                increases[r][d]++;
+            if (m > max_metric[r][d])
+                max_metric[r][d] = m;
+            last_metric[r][d] = m;
+            if ((dist[r][d] == INF && m >= 0) || (dist[r][d] != INF && m != dist[r][d]))
+                ok = 0;
+        }
+    }
+    return ok;
+}
+
+static void ctrl_sent(unsigned long *pkts, unsigned long *bytes) {
+    for (int r = 0; r < MAX_NODES; r++) {
+        unsigned long p = 0, b = 0;
+        pkts[r] = bytes[r] = 0;
+        if (present[r] && !down[r] && get_ctrl_sent(r, &p, &b)) {
+            pkts[r] = p;
+            bytes[r] = b;
+        }
+    }
+}
+
+static void run_phase(phase_t *ph, const char *name) {
+
+    static unsigned long p0[MAX_NODES], b0[MAX_NODES], p1[MAX_NODES], b1[MAX_NODES];
+
+    fprintf(stderr, "  %s...", name);
+    ph -> name = name;
+    compute_dist();
+    memset(increases, 0, sizeof(increases));
+    memset(max_metric, -1, sizeof(max_metric));
+    ctrl_sent(p0, b0);
+    double t0 = now_s();
+    ph -> converged = 0;
+    while (now_s() - t0 < timeout_s) {
+        if (check_tables()) {
+            ph -> converged = 1;
+            break;
+        }
+        usleep(poll_ms * 1000);
+    }
+    ph -> time = now_s() - t0;
+    ctrl_sent(p1, b1);
+
+    ph -> cti_episodes = 0;
+    ph -> cti_max_metric = 0;
+    ph -> ctrl_pkts = ph -> ctrl_bytes = 0;
+    for (int r = 0; r < MAX_NODES; r++) {
+        if (p1[r] >= p0[r]) {   // counters are reset when a router restarts
+            ph -> ctrl_pkts += p1[r] - p0[r];
+            ph -> ctrl_bytes += b1[r] - b0[r];
+        }
+        for (int d = 0; d < MAX_NODES; d++) {
+            if (increases[r][d] >= CTI_MIN_STEPS) {
+                ph -> cti_episodes++;
+                if (max_metric[r][d] > ph -> cti_max_metric)
+                    ph -> cti_max_metric = max_metric[r][d];
+            }
+        }
+    }
+    fprintf(stderr, " %s in %.1fs\n", ph -> converged ? "converged" : "TIMEOUT", ph -> time);
+}
+
+static void print_phase(const phase_t *ph, int last) {
+    printf("        {\"name\": \"%s\", \"converged\": %s, \"time_s\": %.3f, "
+           "\"cti_episodes\": %d, \"cti_max_metric\": %d, "
+           "\"ctrl_packets\": %lu, \"ctrl_bytes\": %lu}%s\n",
+           ph -> name, ph -> converged ? "true" : "false", ph -> time,
+           ph -> cti_episodes, ph -> cti_max_metric,
+           ph -> ctrl_pkts, ph -> ctrl_bytes, last ? "" : ",");
+}
+
+// Control traffic of the converged network: packets sent by all the
+// routers in each STEADY_WINDOW s window, return the number of windows
+static int run_steady(unsigned long *series, unsigned long *bytes) {
+
+    static unsigned long p0[MAX_NODES], b0[MAX_NODES], p1[MAX_NODES], b1[MAX_NODES];
+    int n = steady_s / STEADY_WINDOW;
+
+    if (n > STEADY_MAX)
+        n = STEADY_MAX;
+    fprintf(stderr, "  steady (%d s)...", n * STEADY_WINDOW);
+    *bytes = 0;
+    ctrl_sent(p0, b0);
+    for (int w = 0; w < n; w++) {
+        sleep(STEADY_WINDOW);
+        ctrl_sent(p1, b1);
+        series[w] = 0;
+        for (int r = 0; r < MAX_NODES; r++) {
+            if (p1[r] >= p0[r]) {
+                series[w] += p1[r] - p0[r];
+                *bytes += b1[r] - b0[r];
+            }
+            p0[r] = p1[r];
+            b0[r] = b1[r];
+        }
+        fprintf(stderr, " %lu", series[w]);
+    }
+    fprintf(stderr, "\n");
+    return n;
+}
+
+/* ==================================================================== */
+/* ============================== MAIN ================================ */
+/* ==================================================================== */
+
+static void run_scenario(int victim, int last) {
+
+    phase_t phases[3];
+    unsigned long series[STEADY_MAX], steady_bytes = 0;
+    int nb_nodes = 0, windows = 0;
+
+    read_topo(topo_file);
+    memset(down, 0, sizeof(down));
+    memset(last_metric, -1, sizeof(last_metric));
+    if (victim <= 0) {      // default: the router with the most neighbors
+        int best = -1;
+        for (int r = 0; r < MAX_NODES; r++) {
+            int deg = 0;
+            for (int n = 0; n < MAX_NODES; n++)
+                deg += adj[r][n];
+            if (present[r] && deg > best) {
+                best = deg;
+                victim = r;
+            }
+        }
+    }
+    fprintf(stderr, "%s (victim R%d)\n", topo_file, victim);
+
+    for (int r = 0; r < MAX_NODES; r++) {
+        if (present[r]) {
+            start_router(r);
+            nb_nodes++;
+        }
+    }
+    for (int r = 0; r < MAX_NODES; r++) {
+        if (present[r] && !wait_ctl(r, 5)) {
+            fprintf(stderr, "R%d: control socket not available\n", r);
+            down[r] = 1;
+        }
+    }
+
+    run_phase(&phases[0], "initial");
+    if (steady_s > 0)
+        windows = run_steady(series, &steady_bytes);
+
+    if (kill_mode)
+        stop_router(victim);
+    else
+        kill(pids[victim], SIGSTOP);
+    down[victim] = 1;
+    run_phase(&phases[1], "failure");
+
+    if (kill_mode) {
+        start_router(victim);
+        wait_ctl(victim, 5);
+    } else {
+        kill(pids[victim], SIGCONT);
+    }
+    down[victim] = 0;
+    run_phase(&phases[2], "recovery");
+
+    for (int r = 0; r < MAX_NODES; r++) {
+        if (present[r])
+            stop_router(r);
+    }
+
+    printf("    {\"topology\": \"%s\", \"routers\": %d, \"victim\": %d, \"mode\": \"%s\",\n",
+           topo_file, nb_nodes, victim, kill_mode ? "kill" : "pause");
+    printf("      \"phases\": [\n");
+    for (int i = 0; i < 3; i++)
+        print_phase(&phases[i], i == 2);
+    printf("      ]");
+    if (windows > 0) {
+        printf(",\n      \"steady\": {\"window_s\": %d, \"ctrl_bytes\": %lu, \"ctrl_packets\": [",
+               STEADY_WINDOW, steady_bytes);
+        for (int w = 0; w < windows; w++)
+            printf("%lu%s", series[w], w < windows - 1 ? ", " : "");
+        printf("]}");
+    }
+    printf("}%s\n", last ? "" : ",");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+
+    int victim = 0, first = 1;
+
+    while (first < argc && !strncmp(argv[first], "--", 2) && first + 1 < argc) {
+        if (!strcmp(argv[first], "--mode"))
+            kill_mode = !strcmp(argv[first + 1], "kill");
+        else if (!strcmp(argv[first], "--timeout"))
+            timeout_s = atof(argv[first + 1]);
+        else if (!strcmp(argv[first], "--poll"))
+            poll_ms = atoi(argv[first + 1]);
+        else if (!strcmp(argv[first], "--victim"))
+            victim = atoi(argv[first + 1]);
+        else if (!strcmp(argv[first], "--steady"))
+            steady_s = atoi(argv[first + 1]);
+        first += 2;
+    }
+    if (first >= argc) {
+        printf("Usage: %s [--mode pause|kill] [--timeout <s>] [--poll <ms>] [--victim <id>] [--steady <s>] <topo_file> ...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("{\"scenarios\": [\n");
+    for (int i = first; i < argc; i++) {
+        topo_file = argv[i];
+        run_scenario(victim, i == argc - 1);
+    }
+    printf("]}\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,406 @@
+/*********************************
+**   I/O backends throughput    **
+**   on a loopback chain        **
+*********************************/
+
+/* For each I/O backend (see src/sockio.h), optionally with the shared
+ * memory links between the routers (<backend>+shm, see src/shm.h): start a
+ * chain of headless routers R1 - R2 - ... - R<hops+1> on loopback, with
+ * the harness as a neighbor H of R1, and install the routes to the last
+ * router and back to H through the control sockets (route add). Then:
+ *  - ping: --pings ECHO requests from H to the last router, one at a time,
+ *    the round trip time crosses 2 x hops router links and 2 UDP links
+ *    between H and R1;
+ *  - traffic: send DATA packets to R1 for --time seconds, as fast as
+ *    possible or at --rate packets/s. The packets are forwarded along the
+ *    chain and consumed by the last router.
+ *
+ * For each backend the harness reports in JSON the median and 99th
+ * percentile round trip times, the packets delivered per second, the CPU
+ * time of all the routers per delivered packet (user + system, from
+ * /proc/<pid>/stat), and the datagrams per receive and per send syscall
+ * of R2 (show io).
+ *
+ * Usage: iochain [--hops <n>] [--time <s>] [--rate <pps>] [--size <bytes>]
+ *                [--pings <n>] [<backend>[+shm] ...]
+ *                (default: plain mmsg uring plain+shm)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../src/packet.h"
+#include "../src/control.h"
+
+#define ROUTER_EXE "./router"
+#define TOPO_FILE "log/iochain.txt"
+#define MAX_HOPS 32
+#define RESP_MAX 65536
+#define SEND_BATCH 32               // datagrams per sendmmsg
+#define BASE_PORT 5555              // RTR_BASE_PORT
+
+static pid_t pids[MAX_HOPS + 2];
+static int hops = 3;
+static double duration = 2;
+static long rate = 0;               // packets/s (0: as fast as possible)
+static int size = sizeof(packet_data_t);
+static int pings = 1000;
+
+/* ==================================================================== */
+/* ========================= ROUTER PROCESSES ========================= */
+/* ==================================================================== */
+
+static double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+// Chain of routers 1..hops+1, the harness is node hops+2, neighbor of R1
+static void write_topo(int shm) {
+    mkdir("log", 0755);
+    FILE *f = fopen(TOPO_FILE, "wt");
+    if (f == NULL) {
+        perror(TOPO_FILE);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "# Chain of %d routers (bench/iochain.c)\n", hops + 1);
+    if (shm)
+        fprintf(f, "shm\n");
+    for (int id = 1; id <= hops + 1; id++) {
+        fprintf(f, "%d", id);
+        if (id > 1)
+            fprintf(f, " %d", id - 1);
+        else
+            fprintf(f, " %d", hops + 2);
+        if (id <= hops)
+            fprintf(f, " %d", id + 1);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+static void start_router(int id, const char *io) {
+
+    char sid[8], backend[16];
+    snprintf(backend, sizeof(backend), "%.*s", (int) strcspn(io, "+"), io);
+    sprintf(sid, "%d", id);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        execl(ROUTER_EXE, ROUTER_EXE, sid, TOPO_FILE, "--headless", "--quiet", "--io", backend,
+              (char *) NULL);
+        _exit(127);
+    }
+    pids[id] = pid;
+}
+
+static void stop_router(int id) {
+    char path[108];
+    if (pids[id] > 0) {
+        kill(pids[id], SIGKILL);
+        waitpid(pids[id], NULL, 0);
+        pids[id] = 0;
+    }
+    snprintf(path, sizeof(path), CTL_PATH, id);
+    unlink(path);
+    snprintf(path, sizeof(path), "/tmp/router_R%d.shm", id);    // SHM_PATH
+    unlink(path);
+}
+
+// Send a command to router 'id', return the response length (-1 on error)
+static int ctl_query(int id, const char *cmd, char *resp, int size) {
+
+    struct sockaddr_un adr;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0), len = 0;
+
+    memset(&adr, 0, sizeof(adr));
+    adr.sun_family = AF_UNIX;
+    snprintf(adr.sun_path, sizeof(adr.sun_path), CTL_PATH, id);
+    if (connect(sock, (struct sockaddr *) &adr, sizeof(adr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    if (write(sock, cmd, strlen(cmd)) < 0 || write(sock, "\n", 1) < 0) {
+        close(sock);
+        return -1;
+    }
+    while (len < size - 1) {
+        int n = read(sock, resp + len, size - 1 - len);
+        if (n <= 0)
+            break;
+        len += n;
+        resp[len] = '\0';
+        if (strstr(resp, CTL_END "\n") != NULL || strstr(resp, CTL_ERR) != NULL)
+            break;
+    }
+    close(sock);
+    resp[len] = '\0';
+    return len;
+}
+
+static int wait_ctl(int id, double timeout) {
+    char resp[RESP_MAX];
+    double t0 = now_s();
+    while (now_s() - t0 < timeout) {
+        if (ctl_query(id, "show stats", resp, sizeof(resp)) > 0)
+            return 1;
+        usleep(20000);
+    }
+    return 0;
+}
+
+// Value of the 'label' line of a command output (0 if not found)
+static unsigned long ctl_value(int id, const char *cmd, const char *label, unsigned long *second) {
+    static char resp[RESP_MAX];
+    unsigned long v = 0, w = 0;
+    if (ctl_query(id, cmd, resp, sizeof(resp)) < 0)
+        return 0;
+    char *line = strstr(resp, label);
+    if (line != NULL)
+        sscanf(line + strlen(label), " %lu %*[^,], %lu", &v, &w);
+    if (second != NULL)
+        *second = w;
+    return v;
+}
+
+// CPU time (s) of a router process
+static double cpu_time(int id) {
+    char path[64], buf[1024];
+    unsigned long utime = 0, stime = 0;
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pids[id]);
+    FILE *f = fopen(path, "rt");
+    if (f == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        char *p = strrchr(buf, ')');    // after the command name
+        if (p != NULL)
+            sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    }
+    fclose(f);
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* ==================================================================== */
+/* ============================== TRAFFIC ============================= */
+/* ==================================================================== */
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Ping the last router from H, one request at a time: median and 99th
+// percentile of the round trip times (us) in rtt[0] and rtt[1]
+static void ping_chain(double *rtt) {
+
+    char buf[BUF_SIZE] __attribute__((aligned(8)));
+    packet_data_t req;
+    struct sockaddr_in adr, r1;
+    double *samples = malloc(pings * sizeof(double));
+    int n = 0;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&adr, 0, sizeof(adr));
+    adr.sin_family = AF_INET;
+    adr.sin_port = htons(BASE_PORT + hops + 2);
+    adr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    r1 = adr;
+    r1.sin_port = htons(BASE_PORT + 1);
+    if (samples == NULL || bind(sock, (struct sockaddr *) &adr, sizeof(adr)) < 0) {
+        perror("iochain: harness socket");
+        exit(EXIT_FAILURE);
+    }
+    memset(&req, 0, sizeof(req));
+    req.type = DATA;
+    req.subtype = ECHO_REQUEST;
+    req.src_id = hops + 2;
+    req.dst_id = hops + 1;
+    for (int k = 0; k < pings; k++) {
+        req.ttl = DEFAULT_TTL;
+        req.msg_seq = k;
+        double t0 = now_s();
+        sendto(sock, &req, sizeof(req), 0, (struct sockaddr *) &r1, sizeof(r1));
+        while (1) {             // skip the DVs of R1 and the late replies
+            struct pollfd pfd = {sock, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0)
+                break;
+            int len = recv(sock, buf, sizeof(buf), 0);
+            packet_data_t *p = (packet_data_t *) buf;
+            if (len >= (int) sizeof(packet_data_t) && p -> type == DATA
+                    && p -> subtype == ECHO_REPLY && p -> msg_seq == req.msg_seq) {
+                samples[n++] = 1e6 * (now_s() - t0);
+                break;
+            }
+        }
+    }
+    close(sock);
+    qsort(samples, n, sizeof(double), cmp_double);
+    rtt[0] = n ? samples[n / 2] : -1;
+    rtt[1] = n ? samples[(int) (n * 0.99)] : -1;
+    free(samples);
+}
+
+// Send DATA packets to R1 for 'duration' seconds, return the number sent
+static unsigned long send_traffic() {
+
+    static char pkts[SEND_BATCH][BUF_SIZE] __attribute__((aligned(8)));
+    struct iovec iov[SEND_BATCH];
+    struct mmsghdr msgs[SEND_BATCH];
+    struct sockaddr_in adr;
+    unsigned long sent = 0;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&adr, 0, sizeof(adr));
+    adr.sin_family = AF_INET;
+    adr.sin_port = htons(BASE_PORT + 1);
+    adr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < SEND_BATCH; i++) {
+        packet_data_t *p = (packet_data_t *) pkts[i];
+        memset(pkts[i], 0, sizeof(pkts[i]));
+        p -> type = DATA;
+        p -> subtype = 0;               // consumed without reply by the last router
+        p -> src_id = 1;
+        p -> dst_id = hops + 1;
+        p -> ttl = DEFAULT_TTL;
+        p -> len = size - sizeof(packet_data_t);
+        iov[i].iov_base = pkts[i];
+        iov[i].iov_len = size;
+        msgs[i].msg_hdr.msg_name = &adr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(adr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    double t0 = now_s(), t;
+    while ((t = now_s() - t0) < duration) {
+        if (rate > 0 && sent >= t * rate) {
+            usleep(200);
+            continue;
+        }
+        int n = sendmmsg(sock, msgs, SEND_BATCH, 0);
+        if (n > 0)
+            sent += n;
+    }
+    close(sock);
+    return sent;
+}
+
+static void run_backend(const char *io, int last) {
+
+    char cmd[64], resp[RESP_MAX];
+    int n = hops + 1, h = hops + 2;
+    double rtt[2];
+
+    write_topo(strstr(io, "+shm") != NULL);
+    for (int id = 1; id <= n; id++)
+        start_router(id, io);
+    for (int id = 1; id <= n; id++) {
+        if (!wait_ctl(id, 5)) {
+            fprintf(stderr, "iochain: R%d does not answer\n", id);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int id = 1; id <= n; id++) {   // routes to the end of the chain and back to H
+        if (id < n) {
+            snprintf(cmd, sizeof(cmd), ROUTE_ADD " %d %d %d", n, id + 1, n - id);
+            ctl_query(id, cmd, resp, sizeof(resp));
+        }
+        snprintf(cmd, sizeof(cmd), ROUTE_ADD " %d %d %d", h, id > 1 ? id - 1 : h, id);
+        ctl_query(id, cmd, resp, sizeof(resp));
+    }
+    usleep(100000);                     // shared memory links
+    ping_chain(rtt);
+
+    unsigned long rx0 = ctl_value(n, "show stats", "DATA received", NULL);
+    double cpu0 = 0;
+    for (int id = 1; id <= n; id++)
+        cpu0 += cpu_time(id);
+
+    double t0 = now_s();
+    unsigned long sent = send_traffic();
+    double elapsed = now_s() - t0;
+    usleep(200000);                     // drain the chain
+
+    unsigned long delivered = ctl_value(n, "show stats", "DATA received", NULL) - rx0;
+    double cpu = -cpu0;
+    for (int id = 1; id <= n; id++)
+        cpu += cpu_time(id);
+    unsigned long rx_calls, tx_calls;
+    unsigned long rx = ctl_value(2, "show io", "Received", &rx_calls);
+    unsigned long tx = ctl_value(2, "show io", "Batched sends", &tx_calls);
+    for (int id = 1; id <= n; id++)
+        stop_router(id);
+
+    printf("  {\"io\": \"%s\", \"hops\": %d, \"size\": %d, \"rtt_us_p50\": %.1f, "
+           "\"rtt_us_p99\": %.1f, \"sent\": %lu, \"delivered\": %lu, "
+           "\"pps\": %.0f, \"cpu_us_per_pkt\": %.2f, \"rx_per_syscall\": %.1f, "
+           "\"tx_per_syscall\": %.1f}%s\n",
+           io, hops, size, rtt[0], rtt[1], sent, delivered, delivered / elapsed,
+           delivered ? 1e6 * cpu / delivered : 0, rx_calls ? (double) rx / rx_calls : 1,
+           tx_calls ? (double) tx / tx_calls : 1, last ? "" : ",");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+
+    char *def[] = {"plain", "mmsg", "uring", "plain+shm"};
+    char **backends = def;
+    int nb = 4;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc)
+            break;
+        if (!strcmp(argv[i], "--hops"))
+            hops = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--time"))
+            duration = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--rate"))
+            rate = atol(argv[i + 1]);
+        else if (!strcmp(argv[i], "--size"))
+            size = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--pings"))
+            pings = atoi(argv[i + 1]);
+        else
+            break;
+    }
+    if ((i < argc && argv[i][0] == '-') || hops < 1 || hops > MAX_HOPS
+            || size < (int) sizeof(packet_data_t) || size > BUF_SIZE || pings < 1) {
+        fprintf(stderr, "Usage: %s [--hops <1-%d>] [--time <s>] [--rate <pps>] [--size <bytes>] "
+                "[--pings <n>] [plain|mmsg|uring[+shm] ...]\n", argv[0], MAX_HOPS);
+        exit(EXIT_FAILURE);
+    }
+    if (i < argc) {
+        backends = argv + i;
+        nb = argc - i;
+    }
+    printf("[\n");
+    for (int b = 0; b < nb; b++)
+        run_backend(backends[b], b == nb - 1);
+    printf("]\n");
+    unlink(TOPO_FILE);
+    return EXIT_SUCCESS;
+}
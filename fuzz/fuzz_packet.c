@@ -0,0 +1,163 @@
+/*********************************
+**   Fuzzing harness for the    **
+**   router receive path        **
+*********************************/
+
+/* Covers parse_packet(), the DV merge (update_rt, the id index of the
+ * routing table and the FIB derived from it) and the forward path through
+ * handle_packet(), like the server thread does. The SIMD DV kernels are checked against the scalar
+ * one on the resulting table.
+ *
+ * Input format (see gen_corpus.c):
+ *   byte 0      topology (topos/t<1 + byte % 6>.txt), then byte / 6 enables
+ *               poison reverse (bit 0), hold-down (bit 1) and flap damping
+ *               (bit 2, see stability.h), and the adaptive DV interval (bit 3,
+ *               see adaptive.h)
+ *   byte 1      id of the router receiving the packets
+ *   then        datagrams, each one preceded by its length (2 bytes, little endian)
+ *
+ * Build (see makefile):
+ *   make fuzz          libFuzzer (clang)
+ *   make fuzz_afl      AFL (afl-gcc), input read from the file given as argument
+ *   make fuzz_replay   gcc + ASan/UBSan, replay the corpus once
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../src/router.h"
+#include "../src/dvsimd.h"
+#include "../src/stability.h"
+#include "../src/adaptive.h"
+#include "../src/reliable.h"
+
+#define NB_TOPOS 6
+
+static neighbors_table_t topo_nt[NB_TOPOS][256];
+static int topo_loaded[NB_TOPOS][256];
+
+// Check routing table invariants after each datagram
+static void check_rt(const routing_table_t *rt) {
+    if (rt -> size < 1 || rt -> size > MAX_ROUTES)
+        abort();
+    if (rt -> tab[0].dest != MY_ID || rt -> tab[0].metric != 0)
+        abort();
+    int nb_hosts = 0;
+    for (int i = 0; i < rt -> size; i++) {
+        if (rt -> tab[i].metric > MAX_METRIC + 1)
+            abort();
+        if (rt -> tab[i].plen == ID_BITS && rt -> idx[rt -> tab[i].dest] != i)
+            abort();                // node route not indexed
+        if (rt -> col_dest[i] != rt -> tab[i].dest || rt -> col_nh[i] != rt -> tab[i].nexthop.id
+                || rt -> col_metric[i] != rt -> tab[i].metric)
+            abort();                // DV kernels columns out of sync
+        nb_hosts += rt -> tab[i].plen == ID_BITS;
+    }
+    for (int d = 0; d < MAX_ROUTES; d++)
+        nb_hosts -= rt -> idx[d] >= 0;
+    if (nb_hosts != 0)              // stale index entries
+        abort();
+    for (int d = 0; d < MAX_ROUTES; d++) {
+        routing_table_entry_t *r = find_route((routing_table_t *) rt, d);
+        if (rt -> fib[d] != (r == NULL ? FIB_NONE : r -> nexthop.id))
+            abort();                // FIB out of sync with the RIB
+        if (r != NULL && ntohs(rt -> fib_adr[r -> nexthop.id].in.sin_port) != r -> nexthop.port)
+            abort();
+    }
+}
+
+// Same DV from every kernel, for the neighbor 'neigh' (with and without
+// poison reverse)
+static void check_dv_kernels(const routing_table_t *rt, node_id_t neigh, int poison) {
+    dv_entry_t ref[MAX_DV_SIZE], dv[MAX_DV_SIZE];
+    int best = dv_kernel;
+    dv_kernel_set(DV_KERNEL_SCALAR);
+    int n = dv_filter(rt, neigh, poison, ref);
+    for (int k = DV_KERNEL_SSSE3; k <= DV_KERNEL_AVX2; k++) {
+        if (dv_kernel_set(k) && (dv_filter(rt, neigh, poison, dv) != n
+                                 || memcmp(dv, ref, n * sizeof(dv_entry_t))))
+            abort();
+    }
+    dv_kernel_set(best);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    static char buffer_in[BUF_SIZE] __attribute__((aligned(8)));
+    routing_table_t rt;
+    struct th_args args;
+    char file[32];
+
+    if (size < 2)
+        return 0;
+    int topo = data[0] % NB_TOPOS, opts = data[0] / NB_TOPOS;
+    MY_ID = data[1];
+    log_enabled = 0;
+
+    // neighbors tables are read once per topology and router
+    if (!topo_loaded[topo][MY_ID]) {
+        sprintf(file, "topos/t%d.txt", topo + 1);
+        topo_nt[topo][MY_ID].size = 0;
+        read_neighbors(file, MY_ID, &topo_nt[topo][MY_ID]);
+        topo_loaded[topo][MY_ID] = 1;
+    }
+    rt.size = 0;
+    init_routing_table(&rt);
+    args.rt = &rt;
+    args.nt = &topo_nt[topo][MY_ID];
+    area_bits = args.nt -> area_bits;
+    stab_poison = opts & 1;
+    stab_holddown = opts & 2 ? STAB_HOLDDOWN : 0;
+    stab_half_life = opts & 4 ? STAB_HALF_LIFE : 0;
+    cur_router -> nt.dv_min = opts & 8 ? ADAPT_MIN : 0;
+    cur_router -> nt.dv_max = opts & 8 ? ADAPT_MAX : 0;
+    cur_router -> dv_next = opts & 8 ? rel_now() + ADAPT_MAX : 0;
+
+    size_t pos = 2;
+    while (pos < size) {
+        size_t len = data[pos];
+        if (pos + 1 < size)
+            len |= data[pos + 1] << 8;
+        pos += 2;
+        if (pos > size)
+            break;
+        if (len > size - pos)       // last datagram is truncated
+            len = size - pos;
+        if (len > BUF_SIZE)         // like recvfrom()
+            len = BUF_SIZE;
+        memcpy(buffer_in, data + pos, len);
+        handle_packet(buffer_in, len, &args);
+        check_rt(&rt);
+        pos += len;
+    }
+    remove_obsolete_entries(&rt);
+    check_rt(&rt);
+    for (int i = 0; i < args.nt -> size; i++) {
+        check_dv_kernels(&rt, args.nt -> tab[i].id, 0);
+        check_dv_kernels(&rt, args.nt -> tab[i].id, 1);
+    }
+    return 0;
+}
+
+#ifndef LIBFUZZER
+// Standalone driver (AFL and corpus replay): run each file given as argument
+int main(int argc, char **argv) {
+
+    static uint8_t input[1 << 16];
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        size_t n = fread(input, 1, sizeof(input), f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(input, n);
+    }
+    printf("%d input(s) processed.\n", argc - 1);
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,357 @@
+/*********************************
+**   Seed corpus for the        **
+**   receive path harness       **
+*********************************/
+
+/* For each topology file given as argument and each router of the topology,
+ * write one input (see fuzz_packet.c) holding the converged DVs sent by its
+ * neighbors, followed by DATA packets (ping, traceroute, transit traffic).
+ * A few malformed packets, packets with hop timestamps, DVs with area
+ * summaries and default routes (for topos/t6.txt), reliable DVs with
+ * their ACKs, DATA packets with a payload (bulk transfers) and a route
+ * flapping with poison reverse, hold-down and damping are added as well.
+ *
+ * Usage: gen_corpus <out_dir> topos/t1.txt topos/t2.txt ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../src/packet.h"
+#include "../src/latency.h"
+#include "../src/reliable.h"
+#include "../src/bulk.h"
+
+#define MAX_NODES 256
+#define INF 255
+
+static int adj[MAX_NODES][MAX_NODES];
+static int present[MAX_NODES];
+static int dist[MAX_NODES][MAX_NODES];
+
+static unsigned char input[1 << 16];
+static size_t input_len;
+
+static void read_topo(const char *file) {
+
+    char line[1024];
+    FILE *f = fopen(file, "rt");
+    if (f == NULL) {
+        perror(file);
+        exit(EXIT_FAILURE);
+    }
+    memset(adj, 0, sizeof(adj));
+    memset(present, 0, sizeof(present));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (!isdigit((unsigned char) line[0]))    // comment, areabits or stub line
+            continue;
+        char *token = strtok(line, " \t\n");
+        if (token == NULL)
+            continue;
+        int id = atoi(token);
+        present[id] = 1;
+        while ((token = strtok(NULL, " \t\n")) != NULL)
+            adj[id][atoi(token)] = 1;
+    }
+    fclose(f);
+}
+
+// Hop count between every pair of routers (BFS)
+static void compute_dist() {
+
+    int queue[MAX_NODES];
+    for (int s = 0; s < MAX_NODES; s++) {
+        for (int d = 0; d < MAX_NODES; d++)
+            dist[s][d] = INF;
+        if (!present[s])
+            continue;
+        int head = 0, tail = 0;
+        dist[s][s] = 0;
+        queue[tail++] = s;
+        while (head < tail) {
+            int u = queue[head++];
+            for (int v = 0; v < MAX_NODES; v++) {
+                if (adj[u][v] && dist[s][v] == INF) {
+                    dist[s][v] = dist[s][u] + 1;
+                    queue[tail++] = v;
+                }
+            }
+        }
+    }
+}
+
+static void add_datagram(const void *p, size_t len) {
+    input[input_len++] = len & 0xff;
+    input[input_len++] = len >> 8;
+    memcpy(input + input_len, p, len);
+    input_len += len;
+}
+
+static void add_data(int subtype, int src, int dst, int ttl) {
+    packet_data_t p;
+    memset(&p, 0, sizeof(p));
+    p.type = DATA;
+    p.subtype = subtype;
+    p.src_id = src;
+    p.dst_id = dst;
+    p.ttl = ttl;
+    p.msg_seq = ttl;
+    add_datagram(&p, sizeof(p));
+}
+
+// DATA packet with a trailer of 'count' hop timestamps (see latency.h)
+static void add_data_hopts(int subtype, int src, int dst, int ttl, int count) {
+    char buf[sizeof(packet_data_t) + HOPTS_SIZE(HOPTS_MAX)] __attribute__((aligned(8)));
+    packet_data_t *p = (packet_data_t *) buf;
+    hopts_hdr_t *h = (hopts_hdr_t *) (buf + sizeof(packet_data_t));
+    hopts_entry_t *e = (hopts_entry_t *) (h + 1);
+    memset(buf, 0, sizeof(buf));
+    p -> type = DATA;
+    p -> subtype = subtype;
+    p -> src_id = src;
+    p -> dst_id = dst;
+    p -> ttl = ttl;
+    h -> magic = HOPTS_MAGIC;
+    h -> count = count;
+    for (int i = 0; i < count; i++) {
+        e[i].id = 1 + i % 3;
+        e[i].rx_ns = 1000 * i;
+    }
+    add_datagram(buf, sizeof(packet_data_t) + HOPTS_SIZE(count));
+}
+
+// DATA packet with a payload of 'len' bytes starting with 'hdr' (of
+// 'hdr_len' bytes), the datagram is 'extra' bytes longer (or shorter)
+static void add_data_payload(int subtype, int src, int dst, int len,
+                             const void *hdr, int hdr_len, int extra) {
+    char buf[BUF_SIZE] __attribute__((aligned(8)));
+    packet_data_t *p = (packet_data_t *) buf;
+    memset(buf, 0, sizeof(buf));
+    p -> type = DATA;
+    p -> subtype = subtype;
+    p -> src_id = src;
+    p -> dst_id = dst;
+    p -> ttl = DEFAULT_TTL;
+    p -> len = len;
+    memcpy(buf + sizeof(packet_data_t), hdr, hdr_len);
+    add_datagram(buf, DATA_SIZE(len < MAX_PAYLOAD ? len : MAX_PAYLOAD) + extra);
+}
+
+static void write_input(const char *dir, const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(input, 1, input_len, f);
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+
+    char name[64];
+    int nb_inputs = 0;
+
+    if (argc < 3) {
+        printf("Usage: %s <out_dir> <topo_file> ...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t + 2 < argc; t++) {
+        read_topo(argv[t + 2]);
+        compute_dist();
+        for (int r = 0; r < MAX_NODES; r++) {
+            if (!present[r])
+                continue;
+            input_len = 0;
+            input[input_len++] = t;
+            input[input_len++] = r;
+
+            // converged DV of each neighbor (split horizon)
+            int far = r;
+            for (int n = 0; n < MAX_NODES; n++) {
+                if (!adj[r][n])
+                    continue;
+                packet_ctrl_t p;
+                p.type = CTRL;
+                p.src_id = n;
+                p.dv_size = 0;
+                p.period = 0;           // BROADCAST_PERIOD
+                for (int d = 0; d < MAX_NODES && p.dv_size < MAX_DV_SIZE; d++) {
+                    if (dist[n][d] == INF || dist[n][d] == dist[r][d] + 1)
+                        continue;
+                    p.dv[p.dv_size].dest = d;
+                    p.dv[p.dv_size].metric = dist[n][d];
+                    p.dv_size++;
+                }
+                add_datagram(&p, CTRL_SIZE(p.dv_size));
+            }
+            for (int d = 0; d < MAX_NODES; d++) {
+                if (dist[r][d] != INF && dist[r][d] > dist[r][far])
+                    far = d;
+            }
+
+            // data packets to and through this router
+            add_data(ECHO_REQUEST, far, r, DEFAULT_TTL);
+            add_data(ECHO_REPLY, far, r, DEFAULT_TTL);
+            add_data(TR_REQUEST, far, r, 1);
+            add_data(TR_TIME_EXCEEDED, far, r, DEFAULT_TTL);
+            add_data(TR_ARRIVED, far, r, DEFAULT_TTL);
+            add_data(ECHO_REQUEST, r, far, DEFAULT_TTL);
+            add_data(TR_REQUEST, far, far, 1);
+            add_data(ECHO_REQUEST, far, far, 0);
+
+            sprintf(name, "t%d_r%d", t + 1, r);
+            write_input(argv[1], name);
+            nb_inputs++;
+        }
+    }
+
+    // malformed packets
+    packet_ctrl_t p;
+    memset(&p, 0, sizeof(p));
+    p.type = CTRL;
+    p.src_id = 2;
+    p.dv_size = 255;                        // dv_size too large
+    input_len = 0;
+    input[input_len++] = 0;
+    input[input_len++] = 1;
+    add_datagram(&p, CTRL_SIZE(MAX_DV_SIZE));
+    p.dv_size = MAX_DV_SIZE;                // truncated DV
+    add_datagram(&p, CTRL_SIZE(2));
+    p.dv_size = 1;                          // metric overflow
+    p.dv[0].dest = 9;
+    p.dv[0].metric = 255;
+    add_datagram(&p, CTRL_SIZE(1));
+    p.dv[0].metric = DV_SUMMARY | DV_DEFAULT | 1;   // both flags
+    add_datagram(&p, CTRL_SIZE(1));
+    add_datagram(&p, 1);                    // header only
+    write_input(argv[1], "malformed");
+    nb_inputs++;
+
+    // hop timestamps through R2 of t1 (R1 -- R2 -- R3)
+    input_len = 0;
+    input[input_len++] = 0;
+    input[input_len++] = 2;
+    add_data_hopts(ECHO_REQUEST, 1, 3, DEFAULT_TTL, 1);
+    add_data_hopts(ECHO_REQUEST, 1, 2, DEFAULT_TTL, 1);
+    add_data_hopts(TR_REQUEST, 1, 3, 1, 1);
+    add_data_hopts(TR_ARRIVED, 3, 2, DEFAULT_TTL, 3);
+    add_data_hopts(ECHO_REQUEST, 1, 3, DEFAULT_TTL, HOPTS_MAX);   // full trailer
+    write_input(argv[1], "hopts");
+    nb_inputs++;
+
+    // area summaries and default routes at R2 of the 6th topology
+    // (t6: areabits 4, R3 and R1 border routers, R4 stub)
+    input_len = 0;
+    input[input_len++] = 5;
+    input[input_len++] = 2;
+    int dvs[][5] = {        // {src, dest, metric, dest, metric}
+        {3, 16, DV_SUMMARY | 2, 0, DV_DEFAULT},
+        {1, 16, DV_SUMMARY | 3, 0, DV_SUMMARY | 1},     // summary of our area
+        {3, 17, 1, 16, DV_SUMMARY | MAX_METRIC},        // summary withdrawn
+    };
+    for (int i = 0; i < 3; i++) {
+        p.src_id = dvs[i][0];
+        p.dv_size = 2;
+        p.dv[0].dest = dvs[i][1];
+        p.dv[0].metric = dvs[i][2];
+        p.dv[1].dest = dvs[i][3];
+        p.dv[1].metric = dvs[i][4];
+        add_datagram(&p, CTRL_SIZE(2));
+        add_data(ECHO_REQUEST, 4, 20, DEFAULT_TTL);
+        add_data(ECHO_REQUEST, 4, 17, DEFAULT_TTL);
+        add_data(ECHO_REQUEST, 4, 99, DEFAULT_TTL);
+    }
+    write_input(argv[1], "areas");
+    nb_inputs++;
+
+    // reliable DVs (sequence number trailer) and ACKs at R2 of t1
+    char buf[sizeof(packet_ctrl_t) + sizeof(rel_trailer_t)];
+    rel_trailer_t trailer = {REL_MAGIC, 0, 1};
+    packet_ack_t ack = {ACK, 1, 1};
+    input_len = 0;
+    input[input_len++] = 0;
+    input[input_len++] = 2;
+    p.src_id = 1;
+    p.dv_size = 1;
+    p.dv[0].dest = 1;
+    p.dv[0].metric = 0;
+    memcpy(buf, &p, CTRL_SIZE(1));
+    memcpy(buf + CTRL_SIZE(1), &trailer, sizeof(trailer));
+    add_datagram(buf, CTRL_SIZE(1) + sizeof(trailer));
+    add_datagram(buf, CTRL_SIZE(1) + 1);    // truncated trailer
+    add_datagram(&ack, sizeof(ack));
+    ack.src_id = 9;                         // not a neighbor
+    add_datagram(&ack, sizeof(ack));
+    add_datagram(&ack, 2);                  // short ACK
+    write_input(argv[1], "reliable");
+    nb_inputs++;
+
+    // payloads and bulk transfers at R2 of t1
+    bulk_report_t rep = {{7, 3}, 3 * MAX_PAYLOAD, 1000, 0, 0, 0};
+    bulk_hdr_t hdr = {7, 0};
+    input_len = 0;
+    input[input_len++] = 0;
+    input[input_len++] = 2;
+    add_data_payload(ECHO_REQUEST, 1, 3, 100, &hdr, 0, 0);
+    for (int i = 0; i < 3; i++, hdr.seq++)
+        add_data_payload(BULK_DATA, 1, 2, i < 2 ? MAX_PAYLOAD : 8, &hdr, sizeof(hdr), 0);
+    add_data_payload(BULK_END, 1, 2, sizeof(rep), &rep, sizeof(rep), 0);
+    add_data_payload(BULK_END, 1, 3, sizeof(rep), &rep, sizeof(rep), 0);
+    add_data_payload(BULK_REPORT, 3, 2, sizeof(rep), &rep, sizeof(rep), 0);
+    add_data_payload(BULK_DATA, 1, 2, 4, &hdr, 4, 0);               // short bulk header
+    add_data_payload(BULK_END, 1, 2, 8, &rep, 8, 0);                // short report
+    add_data_payload(BULK_DATA, 1, 2, 100, &hdr, sizeof(hdr), -1);  // truncated payload
+    add_data_payload(BULK_DATA, 1, 2, MAX_PAYLOAD + 1, &hdr, sizeof(hdr), 0);  // too large
+    write_input(argv[1], "bulk");
+    nb_inputs++;
+
+    // route to R3 lost and found again at R2 of t3 (R1 and R2 between R3
+    // and R4), with poison reverse, hold-down and damping (see fuzz_packet.c)
+    input_len = 0;
+    input[input_len++] = 2 + 6 * 7;
+    input[input_len++] = 2;
+    p.dv_size = 1;
+    p.dv[0].dest = 1;
+    for (int i = 0; i < 4; i++) {
+        p.src_id = 3;
+        p.dv[0].metric = 1;                 // R3 -> R1 -> R2
+        add_datagram(&p, CTRL_SIZE(1));
+        p.dv[0].metric = MAX_METRIC;        // lost
+        add_datagram(&p, CTRL_SIZE(1));
+        p.src_id = 4;
+        p.dv[0].metric = 3;                 // stale route (held down)
+        add_datagram(&p, CTRL_SIZE(1));
+        p.dv[0].metric = MAX_METRIC + 1;    // poisoned
+        add_datagram(&p, CTRL_SIZE(1));
+        add_data(ECHO_REQUEST, 3, 1, DEFAULT_TTL);
+    }
+    write_input(argv[1], "stability");
+    nb_inputs++;
+
+    // DV intervals of the neighbors of R2 of t3 (adaptive interval, see
+    // adaptive.h): the routes live for the advertised period
+    input_len = 0;
+    input[input_len++] = 2 + 6 * 8;
+    input[input_len++] = 2;
+    const int periods[] = {5, 80, 255, 0};
+    for (int i = 0; i < 4; i++) {
+        p.src_id = i % 2 ? 1 : 4;
+        p.period = periods[i];
+        p.dv[0].dest = 3;
+        p.dv[0].metric = 1;
+        add_datagram(&p, CTRL_SIZE(1));
+        add_data(ECHO_REQUEST, 3, 1, DEFAULT_TTL);
+    }
+    p.period = 0;
+    write_input(argv[1], "adaptive");
+    nb_inputs++;
+
+    printf("%d input(s) written to %s.\n", nb_inputs, argv[1]);
+    return EXIT_SUCCESS;
+}
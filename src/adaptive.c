@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "adaptive.h"
+#include "reliable.h"
+
+// Intervals are rounded up to multiples of it (s, 0: jittered instead):
+// a turn of the timer wheel with several routers per process
+static int quantum() {
+    return multi_router ? BROADCAST_PERIOD : 0;
+}
+
+static int round_up(int period) {
+    int q = quantum();
+    return q > 0 ? (period + q - 1) / q * q : period;
+}
+
+// Delay until the next DVs for the interval 'period'
+static double jitter(int period) {
+    if (quantum() > 0)
+        return period;
+    return period * (1 - ADAPT_JITTER * rand_r(&cur_router -> dv_seed) / (RAND_MAX + 1.0));
+}
+
+// Adaptive DV interval of the current router ('adaptive' line)?
+int adapt_enabled() {
+    return cur_router -> nt.dv_max > 0;
+}
+
+// Are our periodic DVs due at 'now'? (a timer wheel turn may be a bit
+// shorter than the interval it was rounded to)
+int adapt_due(double now) {
+    return now + quantum() / 2.0 >= cur_router -> dv_next;
+}
+
+// Our periodic DVs are sent at 'now': set the time of the next ones,
+// return the interval to advertise in them (called with the router lock)
+int adapt_schedule(double now) {
+
+    router_t *r = cur_router;
+    int period = r -> dv_period;
+
+    if (!adapt_enabled())
+        period = BROADCAST_PERIOD;
+    else if (r -> dv_changed || period < r -> nt.dv_min)
+        period = round_up(r -> nt.dv_min);
+    else if (period < r -> nt.dv_max)
+        period = round_up(2 * period < r -> nt.dv_max ? 2 * period : r -> nt.dv_max);
+    if (period > ADAPT_LIMIT)
+        period = ADAPT_LIMIT;
+    if (period != r -> dv_period && r -> dv_period > 0)
+        logger("ADAPTIVE", "DV interval %d s", period);
+
+    if (r -> dv_seed == 0)
+        r -> dv_seed = (unsigned int) (now * 1000) ^ (r -> id << 16);
+    r -> dv_period = period;
+    r -> dv_changed = 0;
+    r -> dv_next = now + (adapt_enabled() ? jitter(period) : period);
+    return period;
+}
+
+// The routing table changed: our next DVs within the minimum interval
+// (called with the router lock)
+void adapt_changed() {
+
+    router_t *r = cur_router;
+
+    r -> dv_changed = 1;
+    if (!adapt_enabled() || r -> dv_next == 0)
+        return;
+    // with the timer wheel: due at the turn that ends after the minimum
+    double next = rel_now() + jitter(round_up(r -> nt.dv_min)) - quantum();
+    if (next < r -> dv_next)
+        r -> dv_next = next;
+}
+
+void print_adaptive(FILE *out) {
+    if (adapt_enabled())
+        fprintf(out, "DV interval\t\t %d s (adaptive %d..%d s)\n", cur_router -> dv_period,
+                cur_router -> nt.dv_min, cur_router -> nt.dv_max);
+    else
+        fprintf(out, "DV interval\t\t %d s\n", BROADCAST_PERIOD);
+}
@@ -0,0 +1,36 @@
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#include <stdio.h>
+#include "router.h"
+
+// Adaptive DV interval ('adaptive [<min> [<max>]]' line of the topology
+// file): while the routing table is unchanged, the interval between our
+// periodic DVs doubles after each of them, from min up to max s. A change
+// (a DV that changed routes, an expired route, a reload) brings it back
+// to min, and our next DVs leave within min s.
+// Each interval is drawn in [1 - ADAPT_JITTER, 1] times the current one so
+// that the neighbors do not synchronize. With several routers per process
+// the intervals are rounded up to whole turns of the timer wheel instead
+// (BROADCAST_PERIOD), whose slots already spread the routers.
+// Every DV carries the current interval, an upper bound of the time until
+// our next periodic DVs: a neighbor drops the routes learned from us that
+// no DV refreshed for our last advertised interval + ROUTE_GRACE s, so
+// a route left out of our DVs after a change is forgotten quickly. Between
+// our DVs, the lifetimes are checked every ADAPT_TICK s.
+// Without the line the interval is BROADCAST_PERIOD.
+#define ADAPT_MIN (BROADCAST_PERIOD / 2)    // s, 'adaptive' without values
+#define ADAPT_MAX (8 * BROADCAST_PERIOD)
+#define ADAPT_LIMIT 255                     // s, 'period' of a DV is a byte
+#define ADAPT_JITTER 0.25
+#define ADAPT_TICK 1                        // s
+
+/* ==================================================================== */
+int adapt_enabled();
+int adapt_due(double now);
+int adapt_schedule(double now);
+void adapt_changed();
+
+void print_adaptive(FILE *out);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bulk.h"
+#include "latency.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+static unsigned int next_flow = 0;      // atomic updates
+/* ============================= */
+
+// New transfer id (never 0)
+unsigned int bulk_new_flow() {
+    unsigned int f = __atomic_add_fetch(&next_flow, 1, __ATOMIC_RELAXED);
+    if (f == 1) {               // first transfer of the process
+        f = (unsigned int) lat_now() ^ (MY_ID << 24);
+        __atomic_store_n(&next_flow, f, __ATOMIC_RELAXED);
+    }
+    return f ? f : bulk_new_flow();
+}
+
+static double mbps(unsigned long bytes, long ns) {
+    return ns > 0 ? bytes * 8000.0 / ns : 0;
+}
+
+/* ==================================================================== */
+/* =============================== SENDER ============================= */
+/* ==================================================================== */
+
+// Stream 'bytes' of payload to 'dest' in packets of 'size' payload bytes
+// (BULK_MIN_SIZE .. MAX_PAYLOAD) at 'rate' Mbit/s (0: as fast as possible),
+// then the BULK_END packets, as transfer 'flow' (see bulk_new_flow) with
+// sequence number 'seq' (replies to the control socket, see ctl_reply);
+// fill the sender side of 'res'. Return 0 if there is no route to 'dest'.
+int bulk_send(node_id_t dest, long bytes, int size, double rate, unsigned int flow, int seq,
+              routing_table_t *rt, bulk_report_t *res) {
+
+    char buf[BUF_SIZE] __attribute__((aligned(8)));
+    packet_data_t *p = (packet_data_t *) buf;
+    bulk_hdr_t *h = (bulk_hdr_t *) (buf + sizeof(packet_data_t));
+    long n = (bytes + size - 1) / size;
+    struct timespec t;
+
+    memset(buf, 0, sizeof(buf));        // the payload is sent as is
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    p -> type = DATA;
+    p -> subtype = BULK_DATA;
+    p -> src_id = MY_ID;
+    p -> dst_id = dest;
+    p -> ttl = DEFAULT_TTL;
+    p -> msg_seq = seq;
+    p -> time_sec = t.tv_sec;
+    p -> time_nsec = t.tv_nsec;
+    h -> flow = flow;
+    memset(res, 0, sizeof(*res));
+    res -> hdr.flow = h -> flow;
+
+    long t0 = lat_now(), now = t0;
+    for (long i = 0; i < n; i++) {
+        long len = i < n - 1 ? size : bytes - i * size;
+        p -> len = len < (long) sizeof(bulk_hdr_t) ? (long) sizeof(bulk_hdr_t) : len;
+        h -> seq = i;
+        if (rate > 0) {                 // paced: wait for the time of this packet
+            long due = t0 + (long) (res -> sent_bytes * 8000.0 / rate);
+            if ((now = lat_now()) < due) {
+                struct timespec gap = {(due - now) / 1000000000L, (due - now) % 1000000000L};
+                nanosleep(&gap, NULL);
+            }
+        }
+        pthread_mutex_lock(&cur_router -> lock);
+        int sent = forward_packet(p, DATA_SIZE(p -> len), rt);
+        pthread_mutex_unlock(&cur_router -> lock);
+        if (!sent && i == 0)
+            return 0;
+        if (sent) {
+            res -> hdr.seq++;
+            res -> sent_bytes += p -> len;
+        }
+    }
+    res -> send_ns = lat_now() - t0;
+
+    cur_router -> bulk_last = res -> hdr.flow;  // its report is printed once
+    p -> subtype = BULK_END;
+    p -> len = sizeof(bulk_report_t);
+    memcpy(buf + sizeof(packet_data_t), res, sizeof(*res));
+    for (int i = 0; i < BULK_END_TRIES; i++) {
+        if (i > 0) {
+            struct timespec gap = {0, BULK_END_GAP * 1000000L};
+            nanosleep(&gap, NULL);
+        }
+        pthread_mutex_lock(&cur_router -> lock);
+        forward_packet(p, DATA_SIZE(p -> len), rt);
+        pthread_mutex_unlock(&cur_router -> lock);
+    }
+    return 1;
+}
+
+/* ==================================================================== */
+/* ============================== RECEIVER ============================ */
+/* ==================================================================== */
+
+// Counters of the flow 'flow' of 'src' (reset if it is a new flow),
+// NULL if they cannot be allocated
+static bulk_flow_t *bulk_flow(node_id_t src, unsigned int flow) {
+    if (cur_router -> flows == NULL
+            && (cur_router -> flows = calloc(MAX_ROUTES, sizeof(bulk_flow_t))) == NULL)
+        return NULL;
+    bulk_flow_t *f = &cur_router -> flows[src];
+    if (f -> flow != flow) {
+        memset(f, 0, sizeof(*f));
+        f -> flow = flow;
+    }
+    return f;
+}
+
+// BULK_DATA packet addressed to us (called with the router lock)
+void bulk_receive(const packet_data_t *p) {
+    const bulk_hdr_t *h = (const bulk_hdr_t *) (p + 1);
+    if (p -> len < sizeof(bulk_hdr_t))
+        return;
+    bulk_flow_t *f = bulk_flow(p -> src_id, h -> flow);
+    if (f == NULL)
+        return;
+    long now = lat_rx_ns > 0 ? lat_rx_ns : lat_now();
+    if (f -> packets == 0)
+        f -> first_ns = now;
+    f -> last_ns = now;
+    f -> packets++;
+    f -> bytes += p -> len;
+    if (h -> seq >= f -> next_seq)
+        f -> next_seq = h -> seq + 1;
+}
+
+// BULK_END packet addressed to us: send the report of the flow back
+// (called with the router lock)
+void bulk_end(const packet_data_t *p, routing_table_t *rt) {
+
+    char buf[DATA_SIZE(sizeof(bulk_report_t))] __attribute__((aligned(8)));
+    packet_data_t *reply = (packet_data_t *) buf;
+    bulk_report_t *r = (bulk_report_t *) (reply + 1);
+
+    if (p -> len < sizeof(bulk_report_t))
+        return;
+    memcpy(r, p + 1, sizeof(*r));
+    bulk_flow_t *f = cur_router -> flows ? &cur_router -> flows[p -> src_id] : NULL;
+    if (f != NULL && f -> flow == r -> hdr.flow) {
+        f -> done = 1;
+        if (r -> hdr.seq > f -> next_seq)
+            f -> next_seq = r -> hdr.seq;     // the last ones were lost
+        r -> received = f -> packets;
+        r -> received_bytes = f -> bytes;
+        r -> recv_ns = f -> last_ns - f -> first_ns;
+    }                               // else nothing received (or an older flow)
+    reply -> type = DATA;
+    reply -> subtype = BULK_REPORT;
+    reply -> src_id = MY_ID;
+    reply -> dst_id = p -> src_id;
+    reply -> ttl = DEFAULT_TTL;
+    reply -> msg_seq = p -> msg_seq;
+    reply -> len = sizeof(*r);
+    reply -> time_sec = p -> time_sec;
+    reply -> time_nsec = p -> time_nsec;
+    forward_packet(reply, sizeof(buf), rt);
+}
+
+/* ==================================================================== */
+/* ============================== PRINTING ============================ */
+/* ==================================================================== */
+
+// Sender side of a transfer to 'dest': the rate offered to the network,
+// what got through is in the report of the destination
+void print_bulk(FILE *out, const bulk_report_t *r, node_id_t dest) {
+    fprintf(out, "Bulk to R%d: %u packets, %lu bytes in %.3fs (offered %.1f Mbit/s)\n", dest,
+            r -> hdr.seq, r -> sent_bytes, r -> send_ns / 1e9, mbps(r -> sent_bytes, r -> send_ns));
+}
+
+// Destination side of a transfer, from its report
+void print_bulk_report(FILE *out, const bulk_report_t *r, node_id_t from) {
+    unsigned long lost = r -> hdr.seq > r -> received ? r -> hdr.seq - r -> received : 0;
+    fprintf(out, "--> Report from R%d: %lu packets (%lu lost), %lu bytes in %.3fs (%.1f Mbit/s)\n",
+            from, r -> received, lost, r -> received_bytes, r -> recv_ns / 1e9,
+            mbps(r -> received_bytes, r -> recv_ns));
+}
+
+// BULK_REPORT for the console (the first one of the last transfer)
+void print_bulk_reply(const packet_data_t *p) {
+    const bulk_report_t *r = (const bulk_report_t *) (p + 1);
+    if (p -> len < sizeof(bulk_report_t) || r -> hdr.flow != cur_router -> bulk_last)
+        return;
+    cur_router -> bulk_last = 0;
+    print_bulk_report(stdout, r, p -> src_id);
+}
+
+// Last flow of every source (called with the router lock)
+void print_flows(FILE *out) {
+    fprintf(out, "================ Flows ================\n");
+    fprintf(out, "Src\t Flow\t\t Packets\t Bytes\t\t Lost\t Time\t Mbit/s\n");
+    fprintf(out, "---------------------------------------\n");
+    for (int i = 0; cur_router -> flows != NULL && i < MAX_ROUTES; i++) {
+        const bulk_flow_t *f = &cur_router -> flows[i];
+        if (f -> flow == 0)
+            continue;
+        long ns = f -> last_ns - f -> first_ns;
+        fprintf(out, "R%d\t %08x\t %lu\t\t %lu\t %lu\t %.3fs\t %.1f%s\n", i, f -> flow, f -> packets,
+                f -> bytes, f -> next_seq > f -> packets ? f -> next_seq - f -> packets : 0,
+                ns / 1e9, mbps(f -> bytes, ns), f -> done ? "" : " (running)");
+    }
+    fprintf(out, "=======================================\n");
+}
+
+// Parse "bulk <id> <bytes>[k|m|g] [size <n>] [rate <Mbit/s>]",
+// return 0 on syntax error or out of range value
+int bulk_parse(const char *cmd, int *dest, long *bytes, int *size, double *rate) {
+
+    char temp[16], unit[2] = "", opt[16];
+    int n, pos, shift;
+    double val;
+
+    if (sscanf(cmd, "%15s %d %ld%n", temp, dest, bytes, &pos) != 3)
+        return 0;
+    if (sscanf(cmd + pos, "%1[kKmMgG]%n", unit, &n) == 1)
+        pos += n;
+    shift = unit[0] == 'k' || unit[0] == 'K' ? 10 : unit[0] == 'm' || unit[0] == 'M' ? 20
+            : unit[0] == 'g' || unit[0] == 'G' ? 30 : 0;
+    if (*bytes <= 0 || *bytes > BULK_MAX_BYTES >> shift)
+        return 0;
+    *bytes <<= shift;
+    *size = MAX_PAYLOAD;
+    *rate = BULK_RATE;
+    while (sscanf(cmd + pos, " %15s %lf%n", opt, &val, &n) == 2) {
+        if (!strcmp(opt, "size")) {
+            if (!(val >= BULK_MIN_SIZE && val <= MAX_PAYLOAD))     // NaN too
+                return 0;
+            *size = val;
+        } else if (!strcmp(opt, "rate")) {
+            *rate = val;
+        } else {
+            return 0;
+        }
+        pos += n;
+    }
+    return cmd[pos + strspn(cmd + pos, " ")] == '\0' && *dest >= 0 && *dest < MAX_ROUTES
+           && *bytes > 0 && *size >= BULK_MIN_SIZE && *size <= MAX_PAYLOAD && *rate >= 0;
+}
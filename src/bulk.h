@@ -0,0 +1,62 @@
+#ifndef __BULK_H__
+#define __BULK_H__
+
+#include <stdio.h>
+#include "router.h"
+#include "packet.h"
+
+// Bulk transfers: a stream of DATA packets (BULK_DATA) whose payload
+// starts with a bulk_hdr_t, paced at a given rate (BULK_RATE by default:
+// an unpaced sender only measures how fast it fills its socket buffer, the
+// receiver drops the rest) or sent as fast as possible (rate 0). The routers on the path forward them like any DATA packet,
+// in place in their receive buffer. The last packet (BULK_END, sent
+// BULK_END_TRIES times) carries the sender side of a bulk_report_t: the
+// destination fills in what it received and sends it back (BULK_REPORT).
+// Each router keeps the counters of the last flow of every source it
+// received (see 'show flows').
+#define BULK_END_TRIES 3
+#define BULK_END_GAP 50             // ms between the BULK_END packets
+#define BULK_WAIT 200               // ms the console waits for the report
+#define BULK_RATE 100               // Mbit/s when no rate is given
+#define BULK_MAX_BYTES (64L << 30)  // per transfer (the seq of the packets fits in 32 bits)
+#define BULK_MIN_SIZE ((int) sizeof(bulk_report_t))     // payload bytes per packet
+
+typedef struct {
+    unsigned int flow;              // transfer id (random)
+    unsigned int seq;               // packet number in the flow
+} bulk_hdr_t;
+
+// Payload of BULK_END (sender side) and BULK_REPORT (both sides)
+typedef struct {
+    bulk_hdr_t hdr;                 // seq: packets sent
+    unsigned long sent_bytes;       // payload bytes sent
+    long send_ns;                   // first to last packet sent
+    unsigned long received;         // packets received by the destination
+    unsigned long received_bytes;
+    long recv_ns;                   // first to last packet received
+} bulk_report_t;
+
+// Last flow of a source received by a router
+typedef struct bulk_flow {
+    unsigned int flow;              // 0: none
+    unsigned int next_seq;          // highest seq received + 1
+    unsigned long packets;
+    unsigned long bytes;            // payload bytes
+    long first_ns, last_ns;         // CLOCK_REALTIME (kernel timestamps if any)
+    int done;                       // BULK_END received
+} bulk_flow_t;
+
+/* ==================================================================== */
+int bulk_parse(const char *cmd, int *dest, long *bytes, int *size, double *rate);
+unsigned int bulk_new_flow();
+int bulk_send(node_id_t dest, long bytes, int size, double rate, unsigned int flow, int seq,
+              routing_table_t *rt, bulk_report_t *res);
+void bulk_receive(const packet_data_t *p);
+void bulk_end(const packet_data_t *p, routing_table_t *rt);
+
+void print_bulk(FILE *out, const bulk_report_t *r, node_id_t dest);
+void print_bulk_report(FILE *out, const bulk_report_t *r, node_id_t from);
+void print_bulk_reply(const packet_data_t *p);
+void print_flows(FILE *out);
+
+#endif
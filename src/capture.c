@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "capture.h"
+
+// Captured datagram
+typedef struct {
+    struct timespec ts;         // CLOCK_REALTIME
+    unsigned short len;         // datagram size
+    unsigned short caplen;      // bytes kept
+    unsigned char dir;
+    node_id_t router;           // capturing router (several per process, see vrouter.h)
+    node_id_t peer;
+    char data[CAP_SNAPLEN];
+} cap_record_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+int capture_on = 0;
+static cap_record_t *ring = NULL;       // allocated on first start
+static unsigned long head = 0;          // packets written in the ring
+static unsigned long matched = 0;       // packets matching the filter
+static cap_filter_t filter;
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+/* ============================= */
+
+/* ==================================================================== */
+/* ============================ RECORDING ============================= */
+/* ==================================================================== */
+
+static int cap_match(const unsigned char *p, int len) {
+    if (filter.type >= 0 && p[0] != filter.type)
+        return 0;
+    if (filter.src >= 0) {
+        int src = p[0] == DATA ? (len > 2 ? p[2] : -1) : (len > 1 ? p[1] : -1);
+        if (src != filter.src)
+            return 0;
+    }
+    if (filter.dst >= 0 && (p[0] != DATA || len <= 3 || p[3] != filter.dst))
+        return 0;
+    return 1;
+}
+
+// Called through CAP_PACKET by the input, hello and control threads
+void capture_packet(int dir, node_id_t peer, const void *buf, int len) {
+
+    if (len < 1)
+        return;
+    pthread_mutex_lock(&cap_lock);
+    if (capture_on && cap_match(buf, len) && matched++ % filter.sample == 0) {
+        cap_record_t *r = &ring[head % CAP_RING_SIZE];
+        clock_gettime(CLOCK_REALTIME, &r -> ts);
+        r -> len = len;
+        r -> caplen = len < CAP_SNAPLEN ? len : CAP_SNAPLEN;
+        r -> dir = dir;
+        r -> router = MY_ID;
+        r -> peer = peer;
+        memcpy(r -> data, buf, r -> caplen);
+        head++;
+    }
+    pthread_mutex_unlock(&cap_lock);
+}
+
+// Start a new capture (the ring is emptied), return 0 if out of memory
+int capture_start(const cap_filter_t *f) {
+
+    pthread_mutex_lock(&cap_lock);
+    if (ring == NULL)
+        ring = malloc(CAP_RING_SIZE * sizeof(cap_record_t));
+    if (ring != NULL) {
+        filter = *f;
+        if (filter.sample < 1)
+            filter.sample = 1;
+        head = matched = 0;
+        capture_on = 1;
+    }
+    pthread_mutex_unlock(&cap_lock);
+    return ring != NULL;
+}
+
+// Stop the capture, the packets stay in the ring until the next start
+void capture_stop() {
+    pthread_mutex_lock(&cap_lock);
+    capture_on = 0;
+    pthread_mutex_unlock(&cap_lock);
+}
+
+/* ==================================================================== */
+/* ============================ PCAP FILE ============================= */
+/* ==================================================================== */
+
+// Write the ring (oldest packet first) to a pcap file,
+// return the number of packets written or -1 on error
+int capture_save(const char *file) {
+
+    FILE *f = fopen(file, "wb");
+    if (f == NULL)
+        return -1;
+
+    uint32_t ghdr[6] = {PCAP_MAGIC_NSEC, 2 | (4 << 16), 0, 0,
+                        sizeof(cap_hdr_t) + CAP_SNAPLEN, PCAP_DLT_USER0};
+    int n = 0, err = fwrite(ghdr, sizeof(ghdr), 1, f) != 1;
+
+    pthread_mutex_lock(&cap_lock);
+    unsigned long first = head > CAP_RING_SIZE ? head - CAP_RING_SIZE : 0;
+    for (unsigned long i = first; i < head && !err; i++, n++) {
+        cap_record_t *r = &ring[i % CAP_RING_SIZE];
+        cap_hdr_t h = {CAP_HDR_VERSION, r -> dir, r -> router, r -> peer};
+        uint32_t rhdr[4] = {r -> ts.tv_sec, r -> ts.tv_nsec,
+                            sizeof(h) + r -> caplen, sizeof(h) + r -> len};
+        err = fwrite(rhdr, sizeof(rhdr), 1, f) != 1
+              || fwrite(&h, sizeof(h), 1, f) != 1
+              || fwrite(r -> data, r -> caplen, 1, f) != 1;
+    }
+    pthread_mutex_unlock(&cap_lock);
+    if (fclose(f) != 0 || err)
+        return -1;
+    return n;
+}
+
+/* ==================================================================== */
+/* ============================= COMMAND ============================== */
+/* ==================================================================== */
+
+void print_capture(FILE *out) {
+
+    pthread_mutex_lock(&cap_lock);
+    unsigned long kept = head < CAP_RING_SIZE ? head : CAP_RING_SIZE;
+    fprintf(out, "Capture %s: %lu packets in ring (%lu captured, %lu matched)\n",
+            capture_on ? "on" : "off", kept, head, matched);
+    if (ring != NULL) {
+        fprintf(out, "  filter: 1/%d", filter.sample);
+        if (filter.type >= 0)
+            fprintf(out, " type %s", filter.type == DATA ? "data" : filter.type == CTRL ? "ctrl" : "ack");
+        if (filter.src >= 0)
+            fprintf(out, " src %d", filter.src);
+        if (filter.dst >= 0)
+            fprintf(out, " dst %d", filter.dst);
+        fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(&cap_lock);
+}
+
+// Parse "capture on [sample <n>] [type data|ctrl|ack] [src <id>] [dst <id>]",
+// "capture off", "capture save <file>" or "capture".
+// Return 0 on syntax or execution error.
+int capture_command(const char *cmd, FILE *out) {
+
+    char buf[256], *tok, *arg, *save = NULL;
+    cap_filter_t f = {1, -1, -1, -1};
+
+    snprintf(buf, sizeof(buf), "%s", cmd);
+    strtok_r(buf, " \t", &save);                // "capture"
+    tok = strtok_r(NULL, " \t", &save);
+    if (tok == NULL) {
+        print_capture(out);
+        return 1;
+    }
+    if (!strcmp(tok, "off")) {
+        capture_stop();
+        print_capture(out);
+        return 1;
+    }
+    if (!strcmp(tok, "save")) {
+        arg = strtok_r(NULL, " \t", &save);
+        if (arg == NULL)
+            return 0;
+        int n = capture_save(arg);
+        if (n < 0) {
+            fprintf(out, "--> Cannot write %s.\n", arg);
+            return 0;
+        }
+        fprintf(out, "--> %d packets written to %s.\n", n, arg);
+        return 1;
+    }
+    if (strcmp(tok, "on"))
+        return 0;
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+        if ((arg = strtok_r(NULL, " \t", &save)) == NULL)
+            return 0;
+        if (!strcmp(tok, "sample"))
+            f.sample = atoi(arg);
+        else if (!strcmp(tok, "type") && !strcmp(arg, "data"))
+            f.type = DATA;
+        else if (!strcmp(tok, "type") && !strcmp(arg, "ctrl"))
+            f.type = CTRL;
+        else if (!strcmp(tok, "type") && !strcmp(arg, "ack"))
+            f.type = ACK;
+        else if (!strcmp(tok, "src"))
+            f.src = atoi(arg);
+        else if (!strcmp(tok, "dst"))
+            f.dst = atoi(arg);
+        else
+            return 0;
+    }
+    if (!capture_start(&f)) {
+        fprintf(out, "--> Cannot allocate the capture ring.\n");
+        return 0;
+    }
+    print_capture(out);
+    return 1;
+}
@@ -0,0 +1,53 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdio.h>
+#include "router.h"
+
+#define CAP_RING_SIZE 2048      // packets kept (the oldest ones are overwritten)
+#define CAP_SNAPLEN BUF_SIZE    // bytes kept per packet
+#define CAP_RX 0                // received datagram
+#define CAP_TX 1                // sent datagram
+
+// pcap file format (see tools/router.lua for the dissector)
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_DLT_USER0 147
+#define CAP_HDR_VERSION 1
+
+// Pseudo header written before each packet in the pcap file
+typedef struct {
+    unsigned char version;      // CAP_HDR_VERSION
+    unsigned char dir;          // CAP_RX / CAP_TX
+    unsigned char router;       // capturing router
+    unsigned char peer;         // next hop of sent packets (0: unknown, the
+                                // previous hop of a received packet is not known)
+} cap_hdr_t;
+
+// Capture filter
+typedef struct {
+    int sample;                 // keep 1 matching packet out of 'sample'
+    int type;                   // DATA, CTRL or -1 (any)
+    int src;                    // src_id or -1 (any)
+    int dst;                    // dst_id of DATA packets or -1 (any)
+} cap_filter_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int capture_on;
+/* ============================= */
+
+// Record a datagram: only a test of capture_on when the capture is off
+#define CAP_PACKET(dir, peer, buf, len) do {                \
+        if (__builtin_expect(capture_on, 0))                \
+            capture_packet(dir, peer, buf, len);            \
+    } while (0)
+
+/* ==================================================================== */
+void capture_packet(int dir, node_id_t peer, const void *buf, int len);
+int capture_start(const cap_filter_t *filter);
+void capture_stop();
+int capture_save(const char *file);
+void print_capture(FILE *out);
+int capture_command(const char *cmd, FILE *out);
+
+#endif
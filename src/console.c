@@ -6,37 +6,58 @@
 #include <pthread.h>
 
 #include "console.h"
+#include "ratelimit.h"
+#include "latency.h"
+#include "adaptive.h"
+#include "probes.h"
 
 // Sleep time (in ms) between 2 traceroute packets
 #define TRACEROUTE_SLEEP 200
 #define PING_SLEEP 200
 
-/* ============================= */
-/*  Shared data between threads  */
-int end_traceroute = 0;
-int end_pingforce  = 0;
-pthread_mutex_t lock;
-/* ============================= */
-
 /* ==================================================================== */
 void print_prompt() {
     printf("R%d> ", MY_ID);
 }
 
 /* ==================================================================== */
-void print_unknown_command() {
-    printf("Error: command not found\n");
+void print_unknown_command(FILE *out) {
+    fprintf(out, "Error: command not found\n");
 }
 
 /* ==================================================================== */
 void print_help() {
 
     printf("Commands:\n");
+    printf("  bulk <id> <bytes>[k|m|g] [size <n>] [rate <Mbit/s>]\n");
+    printf("\t\t\t Stream data to node <id> in packets of <n> payload bytes\n");
+    printf("\t\t\t (100 Mbit/s by default, rate 0: as fast as possible).\n");
+    printf("  capture on [sample <n>] [type data|ctrl|ack] [src <id>] [dst <id>]\n");
+    printf("\t\t\t Record sent/received packets in the capture ring.\n");
+    printf("  capture off|save <file>\n");
+    printf("\t\t\t Stop the capture / write the ring to a pcap file.\n");
     printf("  clear\t\t\t Clear the terminal screen.\n");
+    printf("  latency on|off|reset\t Enable/clear the forwarding latency histograms.\n");
+    printf("  latency hops on|off\t Add hop timestamps to ping/traceroute.\n");
+    printf("  netem load <file>|off\t Emulate loss, delay, jitter, duplication, reordering\n");
+    printf("\t\t\t and rate caps on the links / send directly again.\n");
+    printf("  netem\t\t\t Show the emulated links and their counters.\n");
     printf("  ping <id>\t\t Send echo request to node <id>.\n");
     printf("  pingforce <id>\t Send echo request until response or timeout (1min).\n");
+    printf("  ratelimit src|neigh <pps> [<burst>]\n");
+    printf("\t\t\t Limit forwarded packets per source / per next hop.\n");
+    printf("  ratelimit off\t\t Disable rate limiting.\n");
+    printf("  reliable [on|off]\t Acknowledge/retransmit the DVs, show the RTO per neighbor.\n");
+    printf("  reload\t\t Read the neighbors from the topology file again.\n");
+    printf("  shm [on|off]\t\t Shared memory links with the co-located neighbors, show them.\n");
+    printf("  show io\t\t Show the I/O backend and its syscalls per datagram.\n");
     printf("  show ip neigh\t\t Show neighbors table.\n");
     printf("  show ip route\t\t Show IP routing table.\n");
+    printf("  show flows\t\t Show the bulk transfers received, per source.\n");
+    printf("  show latency\t\t Show the forwarding latency histograms.\n");
+    printf("  show stats\t\t Show packet counters.\n");
+    printf("  stability [poison on|off | holddown <s> | damping <half-life s>|off]\n");
+    printf("\t\t\t Poison reverse, hold-down and flap damping of the routes.\n");
     printf("  traceroute <id>\t Print the path to destination <id>.\n");
     printf("  help \t\t\t Show help for commands.\n");
     printf("\n");
@@ -48,29 +69,78 @@ void clear_screen() {
 }
 
 /* ==================================================================== */
-void print_rt(routing_table_t *rt) {
+void print_rt(FILE *out, routing_table_t *rt) {
 
-    printf("========== Routing Table ==========\n" );
-    printf("Dest.\t | Next Hop\t | Metric | LifeTime\n" );
-    printf("-----------------------------------\n" );
+    fprintf(out, "========== Routing Table ==========\n" );
+    fprintf(out, "Dest.\t | Next Hop\t | Metric | LifeTime\n" );
+    fprintf(out, "-----------------------------------\n" );
     for (int i=0; i<rt->size; i++) {
-        printf("%d \t | %d \t\t | %d \t | %.1f\n",
-        rt->tab[i].dest, rt->tab[i].nexthop.id, rt->tab[i].metric,
+        if (rt->tab[i].plen == ID_BITS)
+            fprintf(out, "%d \t", rt->tab[i].dest);
+        else                    // area summary or default route
+            fprintf(out, "%d/%d \t", rt->tab[i].dest, rt->tab[i].plen);
+        fprintf(out, " | %d \t\t | %d \t | %.1f\n",
+        rt->tab[i].nexthop.id, rt->tab[i].metric,
         difftime(time(NULL), rt->tab[i].time));
     }
-    printf("===================================\n" );
+    fprintf(out, "===================================\n" );
 }
 
 /* ==================================================================== */
-void print_neighbors(neighbors_table_t *nt) {
+void print_neighbors(FILE *out, neighbors_table_t *nt) {
 
-    printf("============ Neighbors Table ============\n" );
-    printf("Id.\t | Host \t | Port \n" );
-    printf("-----------------------------------------\n" );
+    fprintf(out, "============ Neighbors Table ============\n" );
+    fprintf(out, "Id.\t | Host \t | Port \t | Interface\n" );
+    fprintf(out, "-----------------------------------------\n" );
     for (int i=0; i<nt->size; i++) {
-        printf("%d\t | %s\t | %d \n", nt->tab[i].id, nt->tab[i].ipv4, nt->tab[i].port);
+        fprintf(out, "%d\t | %s\t | %d \t | %d %s\n", nt->tab[i].id, nt->tab[i].ip, nt->tab[i].port,
+                nt->tab[i].iface, nt->stub[i] ? "(stub)" : "");
+    }
+    for (int i=0; i<nt->nb_ifaces; i++) {
+        fprintf(out, "Interface %d: %s port %d%s%s\n", i, nt->ifaces[i].ip[0] ? nt->ifaces[i].ip : "*",
+                nt->ifaces[i].port, nt->ifaces[i].dev[0] ? " dev " : "", nt->ifaces[i].dev);
+    }
+    if (nt->area_bits > 0)
+        fprintf(out, "Area: %d/%d\n", MY_ID & PREFIX_MASK(nt->area_bits), nt->area_bits);
+    fprintf(out, "=========================================\n" );
+}
+
+/* ==================================================================== */
+void print_stats(FILE *out) {
+
+    rl_config_t cfg;
+    rl_get_config(&cfg);
+
+    const router_stats_t *st = &cur_router -> stats;
+
+    fprintf(out, "============== Statistics ==============\n" );
+    fprintf(out, "DATA received\t\t %lu\n", st -> rx_data);
+    fprintf(out, "CTRL received\t\t %lu\n", st -> rx_ctrl);
+    fprintf(out, "Malformed (dropped)\t %lu\n", st -> rx_malformed);
+    fprintf(out, "Forwarded\t\t %lu\n", st -> fwd);
+    fprintf(out, "No route (dropped)\t %lu\n", st -> no_route);
+    fprintf(out, "TTL expired\t\t %lu\n", st -> ttl_expired);
+    fprintf(out, "CTRL sent\t\t %lu (%lu bytes)\n", st -> tx_ctrl, st -> tx_ctrl_bytes);
+    fprintf(out, "Routes expired\t\t %lu\n", st -> routes_expired);
+    print_adaptive(out);
+    fprintf(out, "---------------- Overload --------------\n" );
+    if (cfg.src_rate > 0)
+        fprintf(out, "Source limit\t\t %.0f pps (burst %.0f)\n", cfg.src_rate, cfg.src_burst);
+    else
+        fprintf(out, "Source limit\t\t off\n");
+    if (cfg.neigh_rate > 0)
+        fprintf(out, "Next hop limit\t\t %.0f pps (burst %.0f)\n", cfg.neigh_rate, cfg.neigh_burst);
+    else
+        fprintf(out, "Next hop limit\t\t off\n");
+    fprintf(out, "Policed (source)\t %lu\n", st -> rl_src_drop);
+    fprintf(out, "Queue full (dropped)\t %lu\n", st -> rl_queue_drop);
+    fprintf(out, "Delayed (next hop)\t %lu\n", st -> rl_neigh_delay);
+    for (int i=0; i<RL_MAX_IDS; i++) {
+        unsigned long n = __atomic_load_n(&rl_src_drops[i], __ATOMIC_RELAXED);
+        if (n)
+            fprintf(out, "  from R%d\t\t %lu policed\n", i, n);
     }
-    printf("=========================================\n" );
+    fprintf(out, "========================================\n" );
 }
 
 /* ==================================================================== */
@@ -90,78 +160,99 @@ void print_no_route() {
 }
 
 /* ==================================================================== */
-void print_ping_reply(packet_data_t *packet) {
+void print_ping_reply(packet_data_t *packet, int size) {
 
-    pthread_mutex_lock(&lock);
-    end_pingforce=1;
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_lock(&cur_router -> probe_lock);
+    cur_router -> end_pingforce = 1;
+    pthread_mutex_unlock(&cur_router -> probe_lock);
 
     struct timespec tstart = {packet->time_sec, packet->time_nsec};
     double delta = difftime_nano(&tstart);
+    PROBE3(ping_rtt, packet->src_id, packet->msg_seq, (long) (delta * 1e9));
     printf("--> Response from R%d: msg_seq=%d ttl=%d time=%.3fs\n",
             packet->src_id, packet->msg_seq, packet->ttl, delta);
+    print_hopts(stdout, (char *) packet, size);
 }
 
 /* ==================================================================== */
-void send_ping_reply(packet_data_t *pdata, routing_table_t *rt) {
-
-    packet_data_t packet;
-    packet.type = DATA;
-    packet.subtype = ECHO_REPLY;
-    packet.src_id = MY_ID;
-    packet.dst_id = pdata->src_id;
-    packet.ttl = DEFAULT_TTL;
-    packet.msg_seq = pdata->msg_seq;
-    packet.time_sec = pdata->time_sec; // htonl() ?
-    packet.time_nsec = pdata->time_nsec;
-    forward_packet(&packet, sizeof(packet_data_t), rt);
+// Called by the input thread, with the router lock
+void send_ping_reply(packet_data_t *pdata, int size, routing_table_t *rt) {
+
+    char buf[BUF_SIZE] __attribute__((aligned(8)));     // packet + hop timestamps
+    packet_data_t *packet = (packet_data_t *) buf;
+    packet->type = DATA;
+    PROBE2(echo_reply, pdata->src_id, pdata->msg_seq);
+    packet->subtype = ECHO_REPLY;
+    packet->src_id = MY_ID;
+    packet->dst_id = pdata->src_id;
+    packet->ttl = DEFAULT_TTL;
+    packet->msg_seq = pdata->msg_seq;
+    packet->len = 0;
+    packet->time_sec = pdata->time_sec; // htonl() ?
+    packet->time_nsec = pdata->time_nsec;
+    int psize = hopts_copy(buf, sizeof(packet_data_t), (char *) pdata, size, lat_rx_ns);
+    forward_packet(packet, psize, rt);
 }
 
 /* ==================================================================== */
-void print_traceroute_path(packet_data_t *packet) {
+void print_traceroute_path(packet_data_t *packet, int size) {
 
     struct timespec tstart = {packet->time_sec, packet->time_nsec};
     double delta = difftime_nano(&tstart);
-    printf("  %d\t R%d\t %.3fs\n", packet->msg_seq, packet->src_id, delta);
+    long oneway = hopts_oneway((char *) packet, size, packet->src_id);
+    if (oneway < 0)
+        printf("  %d\t R%d\t %.3fs\n", packet->msg_seq, packet->src_id, delta);
+    else
+        printf("  %d\t R%d\t %.3fs\t (one-way %.1fus)\n", packet->msg_seq,
+               packet->src_id, delta, oneway / 1000.0);
 }
 
 /* ==================================================================== */
-void print_traceroute_last(packet_data_t *packet) {
+void print_traceroute_last(packet_data_t *packet, int size) {
 
-    pthread_mutex_lock(&lock);
-    end_traceroute=1;
-    pthread_mutex_unlock(&lock);
-    print_traceroute_path(packet);
+    pthread_mutex_lock(&cur_router -> probe_lock);
+    cur_router -> end_traceroute = 1;
+    pthread_mutex_unlock(&cur_router -> probe_lock);
+    print_traceroute_path(packet, size);
 }
 
 /* ==================================================================== */
-void send_time_exceeded(packet_data_t *pdata, routing_table_t *rt) {
-
-    packet_data_t packet;
-    packet.type = DATA;
-    packet.subtype = TR_TIME_EXCEEDED;
-    packet.src_id = MY_ID;
-    packet.dst_id = pdata->src_id;
-    packet.ttl = DEFAULT_TTL;
-    packet.msg_seq = pdata->msg_seq;
-    packet.time_sec = pdata->time_sec;
-    packet.time_nsec = pdata->time_nsec;
-    forward_packet(&packet, sizeof(packet_data_t), rt);
+// Called by the input thread, with the router lock
+void send_time_exceeded(packet_data_t *pdata, int size, routing_table_t *rt) {
+
+    char buf[BUF_SIZE] __attribute__((aligned(8)));     // packet + hop timestamps
+    packet_data_t *packet = (packet_data_t *) buf;
+    packet->type = DATA;
+    PROBE2(time_exceeded, pdata->src_id, pdata->msg_seq);
+    packet->subtype = TR_TIME_EXCEEDED;
+    packet->src_id = MY_ID;
+    packet->dst_id = pdata->src_id;
+    packet->ttl = DEFAULT_TTL;
+    packet->msg_seq = pdata->msg_seq;
+    packet->len = 0;
+    packet->time_sec = pdata->time_sec;
+    packet->time_nsec = pdata->time_nsec;
+    int psize = hopts_copy(buf, sizeof(packet_data_t), (char *) pdata, size, lat_rx_ns);
+    forward_packet(packet, psize, rt);
 }
 
 /* ==================================================================== */
-void send_traceroute_reply(packet_data_t *pdata, routing_table_t *rt) {
-
-    packet_data_t packet;
-    packet.type = DATA;
-    packet.subtype = TR_ARRIVED;
-    packet.src_id = MY_ID;
-    packet.dst_id = pdata->src_id;
-    packet.ttl = DEFAULT_TTL;
-    packet.msg_seq = pdata->msg_seq;
-    packet.time_sec = pdata->time_sec;
-    packet.time_nsec = pdata->time_nsec;
-    forward_packet(&packet, sizeof(packet_data_t), rt);
+// Called by the input thread, with the router lock
+void send_traceroute_reply(packet_data_t *pdata, int size, routing_table_t *rt) {
+
+    char buf[BUF_SIZE] __attribute__((aligned(8)));     // packet + hop timestamps
+    packet_data_t *packet = (packet_data_t *) buf;
+    packet->type = DATA;
+    packet->subtype = TR_ARRIVED;
+    packet->src_id = MY_ID;
+    packet->dst_id = pdata->src_id;
+    packet->ttl = DEFAULT_TTL;
+    packet->msg_seq = pdata->msg_seq;
+    packet->len = 0;
+    packet->time_sec = pdata->time_sec;
+    packet->time_nsec = pdata->time_nsec;
+    int psize = hopts_copy(buf, sizeof(packet_data_t), (char *) pdata, size, lat_rx_ns);
+    forward_packet(packet, psize, rt);
 }
 
 /* ==================================================================== */
@@ -170,22 +261,28 @@ void send_traceroute_reply(packet_data_t *pdata, routing_table_t *rt) {
 
 void *ping(void *args) {
 
-    packet_data_t packet;
+    char buf[BUF_SIZE] __attribute__((aligned(8)));     // packet + hop timestamps
+    packet_data_t *packet = (packet_data_t *) buf;
     struct ping_traceroute_args *pargs = (struct ping_traceroute_args *) args;
     struct timespec tstart={0,0};
 
-    packet.type = DATA;
-    packet.subtype = ECHO_REQUEST;
-    packet.src_id = MY_ID;
-    packet.dst_id = pargs->dest;
-    packet.ttl = DEFAULT_TTL;
+    packet->type = DATA;
+    packet->subtype = ECHO_REQUEST;
+    packet->src_id = MY_ID;
+    packet->dst_id = pargs->dest;
+    packet->len = 0;
+    packet->ttl = DEFAULT_TTL;
     clock_gettime(CLOCK_MONOTONIC, &tstart);
-    packet.time_sec = tstart.tv_sec; // htonl() ?
-    packet.time_nsec = tstart.tv_nsec; // htonl() ?
+    packet->time_sec = tstart.tv_sec; // htonl() ?
+    packet->time_nsec = tstart.tv_nsec; // htonl() ?
     printf("Ping to R%d.\n", pargs->dest);
     for (int i=0; i<MAX_PING; i++) {
-        packet.msg_seq = i;
-        if (!forward_packet(&packet, sizeof(packet_data_t), pargs->rt)) {
+        packet->msg_seq = i;
+        int psize = hop_timestamps ? hopts_init(buf) : sizeof(packet_data_t);
+        pthread_mutex_lock(&cur_router -> lock);
+        int sent = forward_packet(packet, psize, pargs->rt);
+        pthread_mutex_unlock(&cur_router -> lock);
+        if (!sent) {
             print_no_route();
             pthread_exit(NULL);
         }
@@ -200,26 +297,31 @@ void *ping(void *args) {
 
 void *pingforce(void *args) {
 
-    packet_data_t packet;
+    char buf[BUF_SIZE] __attribute__((aligned(8)));     // packet + hop timestamps
+    packet_data_t *packet = (packet_data_t *) buf;
     struct ping_traceroute_args *pargs = (struct ping_traceroute_args *) args;
     struct timespec tstart={0,0};
 
-    packet.type = DATA;
-    packet.subtype = ECHO_REQUEST;
-    packet.src_id = MY_ID;
-    packet.dst_id = pargs->dest;
-    packet.ttl = DEFAULT_TTL;
+    packet->type = DATA;
+    packet->subtype = ECHO_REQUEST;
+    packet->src_id = MY_ID;
+    packet->dst_id = pargs->dest;
+    packet->len = 0;
+    packet->ttl = DEFAULT_TTL;
     clock_gettime(CLOCK_MONOTONIC, &tstart);
-    packet.time_sec = tstart.tv_sec; // htonl() ?
-    packet.time_nsec = tstart.tv_nsec; // htonl() ?
+    packet->time_sec = tstart.tv_sec; // htonl() ?
+    packet->time_nsec = tstart.tv_nsec; // htonl() ?
     printf("Force Ping to R%d. (1min max)\n", pargs->dest);
-    pthread_mutex_lock(&lock);
-    end_pingforce=0;
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_lock(&cur_router -> probe_lock);
+    cur_router -> end_pingforce = 0;
+    pthread_mutex_unlock(&cur_router -> probe_lock);
     int i=1;
-    while (i<60 && !end_pingforce) {
-        packet.msg_seq = i++;
-        forward_packet(&packet, sizeof(packet_data_t), pargs->rt);
+    while (i<60 && !cur_router -> end_pingforce) {
+        packet->msg_seq = i++;
+        int psize = hop_timestamps ? hopts_init(buf) : sizeof(packet_data_t);
+        pthread_mutex_lock(&cur_router -> lock);
+        forward_packet(packet, psize, pargs->rt);
+        pthread_mutex_unlock(&cur_router -> lock);
         printf("."); fflush(stdout);
         sleep(1); // 1sec
     }
@@ -234,30 +336,36 @@ void *pingforce(void *args) {
 
 void *traceroute(void *args) {
 
-    packet_data_t packet;
+    char buf[BUF_SIZE] __attribute__((aligned(8)));     // packet + hop timestamps
+    packet_data_t *packet = (packet_data_t *) buf;
     struct ping_traceroute_args *pargs = (struct ping_traceroute_args *) args;
     struct timespec tstart={0,0};
 
-    packet.type = DATA;
-    packet.subtype = TR_REQUEST;
-    packet.src_id = MY_ID;
-    packet.dst_id = pargs->dest;
+    packet->type = DATA;
+    packet->subtype = TR_REQUEST;
+    packet->src_id = MY_ID;
+    packet->dst_id = pargs->dest;
+    packet->len = 0;
     printf("Traceroute to R%d, 64 hops max.\n", pargs->dest);
-    pthread_mutex_lock(&lock);
-    end_traceroute=0;
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_lock(&cur_router -> probe_lock);
+    cur_router -> end_traceroute = 0;
+    pthread_mutex_unlock(&cur_router -> probe_lock);
     int i=1;
-    while (i<64 && !end_traceroute) {
-        packet.msg_seq = i;
-        packet.ttl = i++;
+    while (i<64 && !cur_router -> end_traceroute) {
+        packet->msg_seq = i;
+        packet->ttl = i++;
         clock_gettime(CLOCK_MONOTONIC, &tstart);
-        packet.time_sec = tstart.tv_sec;
-        packet.time_nsec = tstart.tv_nsec;
-        if (!forward_packet(&packet, sizeof(packet_data_t), pargs->rt)) {
+        packet->time_sec = tstart.tv_sec;
+        packet->time_nsec = tstart.tv_nsec;
+        int psize = hop_timestamps ? hopts_init(buf) : sizeof(packet_data_t);
+        pthread_mutex_lock(&cur_router -> lock);
+        int sent = forward_packet(packet, psize, pargs->rt);
+        pthread_mutex_unlock(&cur_router -> lock);
+        if (!sent) {
             print_no_route();
             pthread_exit(NULL);
         }
-        // printf("sent pack %d src %d dst %d ttl %d \n", packet.msg_seq, packet.src_id, packet.dst_id, packet.ttl);
+        // printf("sent pack %d src %d dst %d ttl %d \n", packet->msg_seq, packet->src_id, packet->dst_id, packet->ttl);
         usleep(TRACEROUTE_SLEEP * 1000);
     }
     pthread_exit(NULL);
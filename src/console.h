@@ -1,6 +1,8 @@
 #ifndef __CONSOLE_H__
 #define __CONSOLE_H__
 
+#include <stdio.h>
+
 #include "router.h"
 #include "packet.h"
 
@@ -13,7 +15,21 @@
 #define SH_IP_ROUTE_2 "ipr"
 #define SH_IP_NEIGH "show ip neigh"
 #define SH_IP_NEIGH_2 "ipn"
+#define SH_STATS "show stats"
+#define SH_STATS_2 "ips"
+#define RATELIMIT "ratelimit"
+#define RELOAD "reload"
+#define CAPTURE "capture"
+#define LATENCY "latency"
+#define SH_LATENCY "show latency"
+#define SH_IO "show io"
+#define RELIABLE "reliable"
+#define NETEM "netem"
+#define SHM "shm"
+#define STABILITY "stability"
 #define TRACEROUTE "traceroute"
+#define BULK "bulk"
+#define SH_FLOWS "show flows"
 
 #define MAX_PING 1
 
@@ -26,20 +42,22 @@ struct ping_traceroute_args {
 /* ==================================================================== */
 void clear_screen();
 void print_prompt();
-void print_unknown_command();
+void print_unknown_command(FILE *out);
 void print_help();
-void print_rt(routing_table_t *rt);
-void print_neighbors(neighbors_table_t *nt);
+void print_rt(FILE *out, routing_table_t *rt);
+void print_neighbors(FILE *out, neighbors_table_t *nt);
+void print_stats(FILE *out);
+void print_no_route();
 
 void *ping(void *args);
 void *pingforce(void *args);
-void send_ping_reply(packet_data_t *pdata, routing_table_t *rt);
-void print_ping_reply(packet_data_t *packet);
+void send_ping_reply(packet_data_t *pdata, int size, routing_table_t *rt);
+void print_ping_reply(packet_data_t *packet, int size);
 
 void *traceroute(void *args);
-void send_time_exceeded(packet_data_t *pdata, routing_table_t *rt);
-void send_traceroute_reply(packet_data_t *pdata, routing_table_t *rt);
-void print_traceroute_path(packet_data_t *packet);
-void print_traceroute_last(packet_data_t *packet);
+void send_time_exceeded(packet_data_t *pdata, int size, routing_table_t *rt);
+void send_traceroute_reply(packet_data_t *pdata, int size, routing_table_t *rt);
+void print_traceroute_path(packet_data_t *packet, int size);
+void print_traceroute_last(packet_data_t *packet, int size);
 
 #endif
@@ -0,0 +1,745 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "control.h"
+#include "console.h"
+#include "ratelimit.h"
+#include "capture.h"
+#include "latency.h"
+#include "reliable.h"
+#include "stability.h"
+#include "netem.h"
+#include "sockio.h"
+#include "shm.h"
+#include "bulk.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+static int reply_pipe[2] = {-1, -1};    // probe replies: input thread -> control thread
+/* ============================= */
+
+// Client of the control socket
+typedef struct {
+    int fd;                     // -1: free slot
+    char in[CTL_CMD_MAX];       // received bytes (requests not processed yet)
+    int in_len;
+    char *out;                  // response bytes not sent yet
+    size_t out_len, out_size;
+    int busy;                   // waiting for the replies of a ping/traceroute
+    router_t *r;                // router of the socket it connected to
+} ctl_client_t;
+
+// Reply to a probe, sent through the pipe (<= PIPE_BUF: atomic write)
+typedef struct {
+    router_t *r;                // router that received it
+    int size;
+    char data[BUF_SIZE] __attribute__((aligned(8)));
+} ctl_msg_t;
+
+// Ping or traceroute waiting for replies
+typedef struct {
+    int client;                 // -1: none
+    node_id_t dest;
+    double deadline;
+} ctl_probe_t;
+
+// Probes in progress on the control socket of a router (router_t, one
+// per router of the process: the routers of a daemon probe independently)
+typedef struct ctl_probes {
+    ctl_probe_t pings[CTL_MAX_PINGS];
+    int next_ping;
+    ctl_probe_t trace;
+    struct {
+        int seen;
+        node_id_t hop;
+        double rtt;
+        long oneway;            // ns, from the hop timestamps (-1: none)
+    } trace_hops[CTL_TR_MAX_HOPS + 1];
+    int trace_last;             // ttl of the first TR_ARRIVED reply (0: none yet)
+    ctl_probe_t bulk;
+    unsigned int bulk_flow;     // transfer of 'bulk'
+} ctl_probes_t;
+
+static ctl_client_t clients[CTL_MAX_CLIENTS];
+
+/* ==================================================================== */
+/* ============================= HELPERS ============================== */
+/* ==================================================================== */
+
+// Socket path of router 'id'
+void ctl_path(char *path, int size, int id) {
+    snprintf(path, size, CTL_PATH, id);
+}
+
+static double now_sec() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+// Round trip time of a reply (the request time is copied in the reply)
+static double packet_rtt(const packet_data_t *p) {
+    return now_sec() - (p -> time_sec + 1.0e-9 * p -> time_nsec);
+}
+
+static void client_write(ctl_client_t *c, const char *buf, size_t len) {
+    if (c -> out_len + len > c -> out_size) {
+        c -> out_size = 2 * (c -> out_len + len);
+        c -> out = realloc(c -> out, c -> out_size);
+        if (c -> out == NULL) {
+            perror("control realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(c -> out + c -> out_len, buf, len);
+    c -> out_len += len;
+}
+
+static void client_printf(ctl_client_t *c, const char *fmt, ...) {
+    char buf[CTL_CMD_MAX];
+    va_list params;
+    va_start(params, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, params);
+    va_end(params);
+    client_write(c, buf, len < (int) sizeof(buf) ? len : (int) sizeof(buf) - 1);
+}
+
+// End of the response to the current request (err == NULL: success)
+static void client_done(ctl_client_t *c, const char *err) {
+    if (err == NULL)
+        client_printf(c, CTL_END "\n");
+    else
+        client_printf(c, CTL_ERR " %s\n", err);
+    c -> busy = 0;
+}
+
+static void client_close(ctl_client_t *c) {
+    ctl_probes_t *pr = c -> r -> probes;
+    int idx = c - clients;
+    for (int i = 0; i < CTL_MAX_PINGS; i++) {
+        if (pr -> pings[i].client == idx)
+            pr -> pings[i].client = -1;
+    }
+    if (pr -> trace.client == idx)
+        pr -> trace.client = -1;
+    if (pr -> bulk.client == idx)
+        pr -> bulk.client = -1;
+    close(c -> fd);
+    free(c -> out);
+    memset(c, 0, sizeof(*c));
+    c -> fd = -1;
+}
+
+// Fill a probe, return its size (with hop timestamps if enabled)
+static int init_probe(packet_data_t *p, int subtype, node_id_t dest, int ttl, int seq) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    p -> type = DATA;
+    p -> subtype = subtype;
+    p -> src_id = MY_ID;
+    p -> dst_id = dest;
+    p -> ttl = ttl;
+    p -> msg_seq = seq;
+    p -> len = 0;
+    p -> time_sec = t.tv_sec;
+    p -> time_nsec = t.tv_nsec;
+    return hop_timestamps ? hopts_init((char *) p) : (int) sizeof(packet_data_t);
+}
+
+/* ==================================================================== */
+/* ============================= COMMANDS ============================= */
+/* ==================================================================== */
+
+// Send an echo request, the response is written when the reply arrives
+static void ctl_ping(ctl_client_t *c, int dest, routing_table_t *rt) {
+
+    ctl_probes_t *pr = c -> r -> probes;
+    ctl_msg_t m;
+    packet_data_t *p = (packet_data_t *) m.data;
+    int slot = -1, sent;
+    if (dest < 0 || dest >= MAX_ROUTES) {       // node_id_t would truncate it
+        client_done(c, "invalid router id");
+        return;
+    }
+    for (int i = 0; i < CTL_MAX_PINGS && slot < 0; i++) {
+        int s = (pr -> next_ping + i) % CTL_MAX_PINGS;
+        if (pr -> pings[s].client < 0)
+            slot = s;
+    }
+    if (slot < 0) {
+        client_done(c, "too many pings in progress");
+        return;
+    }
+    pr -> next_ping = (slot + 1) % CTL_MAX_PINGS;
+    m.size = init_probe(p, ECHO_REQUEST, dest, DEFAULT_TTL, CTL_PING_SEQ + slot);
+    pthread_mutex_lock(&cur_router -> lock);
+    sent = forward_packet(p, m.size, rt);
+    pthread_mutex_unlock(&cur_router -> lock);
+    if (!sent) {
+        client_done(c, "no route to destination");
+        return;
+    }
+    pr -> pings[slot].client = c - clients;
+    pr -> pings[slot].dest = dest;
+    pr -> pings[slot].deadline = now_sec() + CTL_PING_TIMEOUT / 1000.0;
+    c -> busy = 1;
+}
+
+// Send all the traceroute probes at once (ttl 1 .. CTL_TR_MAX_HOPS)
+static void ctl_traceroute(ctl_client_t *c, int dest, routing_table_t *rt) {
+
+    ctl_probes_t *pr = c -> r -> probes;
+    ctl_msg_t m;
+    packet_data_t *p = (packet_data_t *) m.data;
+    int sent = 1;
+    if (dest < 0 || dest >= MAX_ROUTES) {
+        client_done(c, "invalid router id");
+        return;
+    }
+    if (pr -> trace.client >= 0) {
+        client_done(c, "traceroute already in progress");
+        return;
+    }
+    pthread_mutex_lock(&cur_router -> lock);
+    for (int ttl = 1; ttl <= CTL_TR_MAX_HOPS && sent; ttl++) {
+        m.size = init_probe(p, TR_REQUEST, dest, ttl, CTL_TR_SEQ + ttl);
+        sent = forward_packet(p, m.size, rt);
+    }
+    pthread_mutex_unlock(&cur_router -> lock);
+    if (!sent) {
+        client_done(c, "no route to destination");
+        return;
+    }
+    memset(pr -> trace_hops, 0, sizeof(pr -> trace_hops));
+    pr -> trace_last = 0;
+    pr -> trace.client = c - clients;
+    pr -> trace.dest = dest;
+    pr -> trace.deadline = now_sec() + CTL_TR_TIMEOUT / 1000.0;
+    client_printf(c, "Traceroute to R%d, %d hops max.\n", dest, CTL_TR_MAX_HOPS);
+    c -> busy = 1;
+}
+
+struct bulk_args {
+    router_t *r;
+    node_id_t dest;
+    long bytes;
+    int size;
+    double rate;
+    unsigned int flow;
+};
+
+// Sender of a bulk transfer, its report is answered through ctl_reply
+static void *bulk_thread(void *args) {
+    struct bulk_args *a = args;
+    bulk_report_t res;
+    cur_router = a -> r;
+    bulk_send(a -> dest, a -> bytes, a -> size, a -> rate, a -> flow, CTL_BULK_SEQ, &a -> r -> rt, &res);
+    free(a);
+    return NULL;
+}
+
+// Start a bulk transfer in its own thread, the response is written when
+// the report of the destination arrives
+static void ctl_bulk(ctl_client_t *c, const char *cmd, routing_table_t *rt) {
+
+    ctl_probes_t *pr = c -> r -> probes;
+    struct bulk_args *a;
+    pthread_t th_id;
+    int dest, size, route;
+    long bytes;
+    double rate;
+
+    if (!bulk_parse(cmd, &dest, &bytes, &size, &rate)) {
+        client_done(c, "syntax error");
+        return;
+    }
+    pthread_mutex_lock(&cur_router -> lock);
+    route = rt -> fib[dest] != FIB_NONE;
+    pthread_mutex_unlock(&cur_router -> lock);
+    if (!route || pr -> bulk.client >= 0) {
+        client_done(c, route ? "bulk transfer already in progress" : "no route to destination");
+        return;
+    }
+    if ((a = malloc(sizeof(*a))) == NULL) {
+        client_done(c, strerror(errno));
+        return;
+    }
+    *a = (struct bulk_args) {c -> r, dest, bytes, size, rate, bulk_new_flow()};
+    pr -> bulk_flow = a -> flow;              // 'a' belongs to the thread once started
+    if (pthread_create(&th_id, NULL, &bulk_thread, a) != 0) {
+        free(a);
+        client_done(c, "cannot start the sender thread");
+        return;
+    }
+    pthread_detach(th_id);
+    pr -> bulk.client = c - clients;
+    pr -> bulk.dest = dest;
+    pr -> bulk.deadline = now_sec() + (rate > 0 ? bytes * 8 / (rate * 1e6) : 0) + CTL_BULK_TIMEOUT / 1000.0;
+    c -> busy = 1;
+}
+
+// Inject a route as if 'neigh' advertised 'dest' at 'metric' - 1:
+// the DV is sent to our own server thread which merges it like any other
+// (to the address of our first interface, the wildcard address meaning
+// this host)
+static void ctl_route_add(ctl_client_t *c, int dest, int neigh, int metric, neighbors_table_t *nt) {
+
+    packet_ctrl_t p;
+    sock_addr_t adr;
+    socklen_t len = sizeof(adr);
+    int found = 0;
+
+    pthread_mutex_lock(&cur_router -> lock);
+    for (int i = 0; i < nt -> size; i++)
+        found |= nt -> tab[i].id == neigh;
+    pthread_mutex_unlock(&cur_router -> lock);
+    if (!found) {
+        client_done(c, "next hop is not a neighbor");
+        return;
+    }
+    if (dest < 0 || dest >= MAX_ROUTES || metric < 1 || metric > MAX_METRIC) {
+        client_done(c, "invalid destination or metric");
+        return;
+    }
+    p.type = CTRL;
+    p.src_id = neigh;
+    p.dv_size = 1;
+    p.period = 0;                       // DV interval of the neighbor unchanged
+    p.dv[0].dest = dest;
+    p.dv[0].metric = metric - 1;
+
+    int sock = -1;
+    if (getsockname(cur_router -> if_sock[0], &adr.sa, &len) == 0)
+        sock = socket(adr.sa.sa_family, SOCK_DGRAM, 0);
+    int err = sock < 0 || sendto(sock, &p, CTRL_SIZE(1), 0, &adr.sa, len) < 0;
+    if (sock >= 0)
+        close(sock);
+    client_done(c, err ? strerror(errno) : NULL);
+}
+
+// Write the output of 'print' to the client, return its result
+static int print_output(ctl_client_t *c, int (*print)(FILE *, void *), void *arg) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    int ret = print(out, arg);
+    fclose(out);
+    client_write(c, buf, len);
+    free(buf);
+    return ret;
+}
+
+static int print_rt_cb(FILE *out, void *rt) { print_rt(out, rt); return 1; }
+static int print_nt_cb(FILE *out, void *nt) { print_neighbors(out, nt); return 1; }
+static int print_stats_cb(FILE *out, void *unused) { print_stats(out); return 1; }
+static int reload_cb(FILE *out, void *pargs) { return reload_neighbors(pargs, out); }
+static int capture_cb(FILE *out, void *cmd) { return capture_command(cmd, out); }
+static int latency_cb(FILE *out, void *cmd) { return latency_command(cmd, out); }
+static int print_latency_cb(FILE *out, void *unused) { print_latency(out); return 1; }
+static int print_io_cb(FILE *out, void *unused) { print_io(out); return 1; }
+static int netem_cb(FILE *out, void *cmd) { return netem_command(cmd, out); }
+struct nt_cmd_args { char *cmd; neighbors_table_t *nt; };
+static int reliable_cb(FILE *out, void *a) {
+    return reliable_command(((struct nt_cmd_args *) a) -> cmd, ((struct nt_cmd_args *) a) -> nt, out);
+}
+static int shm_cb(FILE *out, void *a) {
+    return shm_command(((struct nt_cmd_args *) a) -> cmd, ((struct nt_cmd_args *) a) -> nt, out);
+}
+struct rt_cmd_args { char *cmd; routing_table_t *rt; };
+static int stability_cb(FILE *out, void *a) {
+    return stability_command(((struct rt_cmd_args *) a) -> cmd, ((struct rt_cmd_args *) a) -> rt, out);
+}
+static int print_flows_cb(FILE *out, void *unused) { print_flows(out); return 1; }
+static int print_bulk_cb(FILE *out, void *m) {
+    const packet_data_t *p = (const packet_data_t *) ((ctl_msg_t *) m) -> data;
+    const bulk_report_t *r = (const bulk_report_t *) (p + 1);
+    print_bulk(out, r, p -> src_id);
+    print_bulk_report(out, r, p -> src_id);
+    return 1;
+}
+static int print_hopts_cb(FILE *out, void *m) {
+    print_hopts(out, ((ctl_msg_t *) m) -> data, ((ctl_msg_t *) m) -> size);
+    return 1;
+}
+
+// Run a control command
+static void control_command(ctl_client_t *c, char *cmd, struct th_args *pargs) {
+
+    int dest, neigh, metric;
+
+    if (multi_router && (!strncmp(cmd, RELIABLE, strlen(RELIABLE)) || !strncmp(cmd, NETEM, strlen(NETEM))
+            || !strncmp(cmd, SHM, strlen(SHM)) || !strncmp(cmd, RATELIMIT, strlen(RATELIMIT))
+            || (!strncmp(cmd, STABILITY, strlen(STABILITY)) && strcmp(cmd, STABILITY)))) {
+        client_done(c, "not available with several routers per process");
+    } else if (!strcmp(cmd, SH_IP_ROUTE) || !strcmp(cmd, SH_IP_ROUTE_2)) {
+        pthread_mutex_lock(&cur_router -> lock);
+        print_output(c, print_rt_cb, pargs -> rt);
+        pthread_mutex_unlock(&cur_router -> lock);
+        client_done(c, NULL);
+    } else if (!strcmp(cmd, SH_IP_NEIGH) || !strcmp(cmd, SH_IP_NEIGH_2)) {
+        pthread_mutex_lock(&cur_router -> lock);
+        print_output(c, print_nt_cb, pargs -> nt);
+        pthread_mutex_unlock(&cur_router -> lock);
+        client_done(c, NULL);
+    } else if (!strcmp(cmd, SH_LATENCY)) {
+        print_output(c, print_latency_cb, NULL);
+        client_done(c, NULL);
+    } else if (!strcmp(cmd, SH_IO)) {
+        print_output(c, print_io_cb, NULL);
+        client_done(c, NULL);
+    } else if (!strncmp(cmd, LATENCY, strlen(LATENCY))) {
+        int ok = print_output(c, latency_cb, cmd);
+        client_done(c, ok ? NULL : "invalid latency command");
+    } else if (!strncmp(cmd, RELIABLE, strlen(RELIABLE))) {
+        struct nt_cmd_args a = {cmd, pargs -> nt};
+        int ok = print_output(c, reliable_cb, &a);
+        client_done(c, ok ? NULL : "invalid reliable command");
+    } else if (!strncmp(cmd, NETEM, strlen(NETEM))) {
+        int ok = print_output(c, netem_cb, cmd);
+        client_done(c, ok ? NULL : "invalid netem command");
+    } else if (!strncmp(cmd, SHM, strlen(SHM))) {
+        struct nt_cmd_args a = {cmd, pargs -> nt};
+        int ok = print_output(c, shm_cb, &a);
+        client_done(c, ok ? NULL : "invalid shm command");
+    } else if (!strncmp(cmd, STABILITY, strlen(STABILITY))) {
+        struct rt_cmd_args a = {cmd, pargs -> rt};
+        int ok = print_output(c, stability_cb, &a);
+        client_done(c, ok ? NULL : "invalid stability command");
+    } else if (!strncmp(cmd, CAPTURE, strlen(CAPTURE))) {
+        int ok = print_output(c, capture_cb, cmd);
+        client_done(c, ok ? NULL : "invalid capture command");
+    } else if (!strcmp(cmd, RELOAD)) {
+        int ok = print_output(c, reload_cb, pargs);
+        client_done(c, ok ? NULL : "cannot read the topology file");
+    } else if (!strcmp(cmd, SH_STATS) || !strcmp(cmd, SH_STATS_2)) {
+        print_output(c, print_stats_cb, NULL);
+        client_done(c, NULL);
+    } else if (!strncmp(cmd, RATELIMIT, strlen(RATELIMIT))) {
+        client_done(c, rl_command(cmd) ? NULL : "syntax error");
+    } else if (!strcmp(cmd, SH_FLOWS)) {
+        pthread_mutex_lock(&cur_router -> lock);
+        print_output(c, print_flows_cb, NULL);
+        pthread_mutex_unlock(&cur_router -> lock);
+        client_done(c, NULL);
+    } else if (!strncmp(cmd, BULK " ", strlen(BULK) + 1)) {
+        ctl_bulk(c, cmd, pargs -> rt);
+    } else if (sscanf(cmd, PING " %d", &dest) == 1 && cmd[strlen(PING)] == ' ') {
+        ctl_ping(c, dest, pargs -> rt);
+    } else if (sscanf(cmd, TRACEROUTE " %d", &dest) == 1) {
+        ctl_traceroute(c, dest, pargs -> rt);
+    } else if (sscanf(cmd, ROUTE_ADD " %d %d %d", &dest, &neigh, &metric) == 3) {
+        ctl_route_add(c, dest, neigh, metric, pargs -> nt);
+    } else if (strlen(cmd) == 0) {
+        client_done(c, NULL);
+    } else {
+        client_done(c, "command not found");
+    }
+}
+
+/* ==================================================================== */
+/* ============================== REPLIES ============================= */
+/* ==================================================================== */
+
+// Called by the input packets thread for each reply addressed to us:
+// return 1 if it answers a control probe (handed to the control thread)
+int ctl_reply(const char *buf, int size) {
+
+    ctl_msg_t m;
+    if (reply_pipe[1] < 0 || ((const packet_data_t *) buf) -> msg_seq < CTL_TR_SEQ)
+        return 0;
+    m.r = cur_router;
+    m.size = size < BUF_SIZE ? size : BUF_SIZE;
+    memcpy(m.data, buf, m.size);
+    if (write(reply_pipe[1], &m, offsetof(ctl_msg_t, data) + m.size) < 0)
+        logger("SERVER TH", "control reply dropped (%s)", strerror(errno));
+    return 1;
+}
+
+static void trace_finish(ctl_probes_t *pr, int timeout) {
+
+    ctl_client_t *c = &clients[pr -> trace.client];
+    int last = pr -> trace_last ? pr -> trace_last : CTL_TR_MAX_HOPS;
+    for (int ttl = 1; ttl <= last; ttl++) {
+        if (pr -> trace_hops[ttl].seen && pr -> trace_hops[ttl].oneway >= 0)
+            client_printf(c, "  %d\t R%d\t %.3fs\t (one-way %.1fus)\n", ttl, pr -> trace_hops[ttl].hop,
+                          pr -> trace_hops[ttl].rtt, pr -> trace_hops[ttl].oneway / 1000.0);
+        else if (pr -> trace_hops[ttl].seen)
+            client_printf(c, "  %d\t R%d\t %.3fs\n", ttl, pr -> trace_hops[ttl].hop,
+                          pr -> trace_hops[ttl].rtt);
+        else if (pr -> trace_last || ttl == 1 || pr -> trace_hops[ttl - 1].seen)
+            client_printf(c, "  %d\t *\n", ttl);
+    }
+    client_done(c, pr -> trace_last || !timeout ? NULL : "timeout");
+    pr -> trace.client = -1;
+}
+
+static void handle_reply(const ctl_msg_t *m) {
+
+    const packet_data_t *p = (const packet_data_t *) m -> data;
+    ctl_probes_t *pr = m -> r -> probes;
+
+    if (p -> subtype == ECHO_REPLY && p -> msg_seq >= CTL_PING_SEQ) {
+        ctl_probe_t *ping = &pr -> pings[p -> msg_seq - CTL_PING_SEQ];
+        if (ping -> client < 0)
+            return;                 // late reply
+        ctl_client_t *c = &clients[ping -> client];
+        client_printf(c, "--> Response from R%d: msg_seq=%d ttl=%d time=%.3fs\n",
+                      p -> src_id, p -> msg_seq, p -> ttl, packet_rtt(p));
+        print_output(c, print_hopts_cb, (void *) m);
+        client_done(c, NULL);
+        ping -> client = -1;
+        return;
+    }
+    if (p -> subtype == BULK_REPORT && p -> msg_seq == CTL_BULK_SEQ) {
+        if (pr -> bulk.client < 0 || p -> len < sizeof(bulk_report_t)
+                || ((const bulk_report_t *) (p + 1)) -> hdr.flow != pr -> bulk_flow)
+            return;                 // late or duplicated report
+        ctl_client_t *c = &clients[pr -> bulk.client];
+        print_output(c, print_bulk_cb, (void *) m);
+        client_done(c, NULL);
+        pr -> bulk.client = -1;
+        return;
+    }
+    int ttl = p -> msg_seq - CTL_TR_SEQ;
+    if (pr -> trace.client < 0 || ttl < 1 || ttl > CTL_TR_MAX_HOPS)
+        return;
+    if (p -> subtype == TR_TIME_EXCEEDED || p -> subtype == TR_ARRIVED) {
+        pr -> trace_hops[ttl].seen = 1;
+        pr -> trace_hops[ttl].hop = p -> src_id;
+        pr -> trace_hops[ttl].rtt = packet_rtt(p);
+        pr -> trace_hops[ttl].oneway = hopts_oneway(m -> data, m -> size, p -> src_id);
+        if (p -> subtype == TR_ARRIVED && (pr -> trace_last == 0 || ttl < pr -> trace_last))
+            pr -> trace_last = ttl;
+    }
+    if (pr -> trace_last) {         // done when every hop before the destination answered
+        int ttl = 1;
+        while (ttl < pr -> trace_last && pr -> trace_hops[ttl].seen)
+            ttl++;
+        if (ttl == pr -> trace_last)
+            trace_finish(pr, 0);
+    }
+}
+
+static void check_timeouts(ctl_routers_t *routers, double now) {
+    for (int l = 0; l < routers -> size; l++) {
+        ctl_probes_t *pr = routers -> tab[l] -> probes;
+        for (int i = 0; i < CTL_MAX_PINGS; i++) {
+            if (pr -> pings[i].client >= 0 && now >= pr -> pings[i].deadline) {
+                client_done(&clients[pr -> pings[i].client], "timeout");
+                pr -> pings[i].client = -1;
+            }
+        }
+        if (pr -> trace.client >= 0 && now >= pr -> trace.deadline)
+            trace_finish(pr, 1);
+        if (pr -> bulk.client >= 0 && now >= pr -> bulk.deadline) {
+            client_done(&clients[pr -> bulk.client], "timeout");
+            pr -> bulk.client = -1;
+        }
+    }
+}
+
+// Time (ms) until the next probe timeout (-1: none)
+static int next_timeout(ctl_routers_t *routers, double now) {
+    double next = -1;
+    for (int l = 0; l < routers -> size; l++) {
+        const ctl_probes_t *pr = routers -> tab[l] -> probes;
+        for (int i = 0; i < CTL_MAX_PINGS; i++) {
+            if (pr -> pings[i].client >= 0 && (next < 0 || pr -> pings[i].deadline < next))
+                next = pr -> pings[i].deadline;
+        }
+        if (pr -> trace.client >= 0 && (next < 0 || pr -> trace.deadline < next))
+            next = pr -> trace.deadline;
+        if (pr -> bulk.client >= 0 && (next < 0 || pr -> bulk.deadline < next))
+            next = pr -> bulk.deadline;
+    }
+    if (next < 0)
+        return -1;
+    return next <= now ? 0 : (int) ((next - now) * 1000) + 1;
+}
+
+/* ==================================================================== */
+/* ========================== CONTROL THREAD ========================== */
+/* ==================================================================== */
+
+// Process the complete request lines of a client, one at a time
+static void client_process(ctl_client_t *c) {
+    char *eol;
+    while (!c -> busy && (eol = memchr(c -> in, '\n', c -> in_len)) != NULL) {
+        int len = eol - c -> in;
+        char cmd[CTL_CMD_MAX];
+        memcpy(cmd, c -> in, len);
+        cmd[len] = '\0';
+        if (len > 0 && cmd[len - 1] == '\r')
+            cmd[len - 1] = '\0';
+        c -> in_len -= len + 1;
+        memmove(c -> in, eol + 1, c -> in_len);
+        cur_router = c -> r;
+        control_command(c, cmd, &c -> r -> args);
+    }
+    if (!c -> busy && c -> in_len == (int) sizeof(c -> in)) {
+        c -> in_len = 0;            // no end of line in a full buffer
+        client_done(c, "request too long");
+    }
+}
+
+// Read the available bytes of a client, return 0 if it left
+static int client_read(ctl_client_t *c) {
+    int n = recv(c -> fd, c -> in + c -> in_len, sizeof(c -> in) - c -> in_len, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        return 0;
+    if (n > 0)
+        c -> in_len += n;
+    return 1;
+}
+
+// Send the pending response bytes, return 0 if the client left
+static int client_flush(ctl_client_t *c) {
+    while (c -> out_len > 0) {
+        int n = send(c -> fd, c -> out, c -> out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        memmove(c -> out, c -> out + n, c -> out_len - n);
+        c -> out_len -= n;
+    }
+    return 1;
+}
+
+// Listening control socket of router 'r', exit on error
+static int control_listen(router_t *r) {
+
+    struct sockaddr_un adr;
+    int sock;
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("control socket error");
+        exit(EXIT_FAILURE);
+    }
+    memset(&adr, 0, sizeof(adr));
+    adr.sun_family = AF_UNIX;
+    ctl_path(adr.sun_path, sizeof(adr.sun_path), r -> id);
+    unlink(adr.sun_path);       // left by a previous run
+    if (bind(sock, (struct sockaddr *) &adr, sizeof(adr)) < 0
+            || listen(sock, CTL_BACKLOG) < 0) {
+        perror("control bind error");
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+    logger("CONTROL TH", "listening on %s", adr.sun_path);
+    return sock;
+}
+
+// Control thread: serve all the clients of the control sockets,
+// one socket per router of the process
+void *control_server(void *args) {
+
+    ctl_routers_t *routers = (ctl_routers_t *) args;
+    int nl = routers -> size;           // listening sockets: fds[0 .. nl - 1]
+    struct pollfd *fds = malloc((nl + 1 + CTL_MAX_CLIENTS) * sizeof(*fds));
+    int *map = malloc((nl + 1 + CTL_MAX_CLIENTS) * sizeof(*map));  // pollfd index -> client index
+    int *socks = malloc(nl * sizeof(*socks));
+
+    if (fds == NULL || map == NULL || socks == NULL) {
+        perror("control malloc error");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < CTL_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    for (int l = 0; l < nl; l++) {
+        ctl_probes_t *pr = malloc(sizeof(*pr));
+        if (pr == NULL) {
+            perror("control malloc error");
+            exit(EXIT_FAILURE);
+        }
+        memset(pr, 0, sizeof(*pr));
+        for (int i = 0; i < CTL_MAX_PINGS; i++)
+            pr -> pings[i].client = -1;
+        pr -> trace.client = pr -> bulk.client = -1;
+        routers -> tab[l] -> probes = pr;
+    }
+    if (pipe(reply_pipe) < 0) {
+        perror("control pipe error");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(reply_pipe[1], F_SETFL, O_NONBLOCK);  // never block the input thread
+
+    for (int l = 0; l < nl; l++) {
+        cur_router = routers -> tab[l];
+        socks[l] = control_listen(routers -> tab[l]);
+    }
+
+    while (1) {
+        int nfds = nl + 1;
+        for (int l = 0; l < nl; l++)
+            fds[l] = (struct pollfd) {socks[l], POLLIN, 0};
+        fds[nl] = (struct pollfd) {reply_pipe[0], POLLIN, 0};
+        for (int i = 0; i < CTL_MAX_CLIENTS; i++) {
+            ctl_client_t *c = &clients[i];
+            if (c -> fd < 0)
+                continue;
+            short events = c -> out_len > 0 ? POLLOUT : 0;
+            if (c -> in_len < (int) sizeof(c -> in))
+                events |= POLLIN;
+            map[nfds] = i;
+            fds[nfds++] = (struct pollfd) {c -> fd, events, 0};
+        }
+        if (poll(fds, nfds, next_timeout(routers, now_sec())) < 0) {
+            if (errno == EINTR)
+                continue;
+            logger("ERROR", "control poll %s", strerror(errno));
+            continue;
+        }
+
+        for (int l = 0; l < nl; l++) {
+            if (!(fds[l].revents & POLLIN))
+                continue;
+            int fd = accept(socks[l], NULL, NULL);      // new client
+            int i = 0;
+            while (i < CTL_MAX_CLIENTS && clients[i].fd >= 0)
+                i++;
+            if (fd >= 0 && i == CTL_MAX_CLIENTS) {
+                logger("CONTROL TH", "too many clients");
+                close(fd);
+            } else if (fd >= 0) {
+                clients[i].fd = fd;
+                clients[i].r = routers -> tab[l];
+            }
+        }
+        if (fds[nl].revents & POLLIN) {          // replies to the probes
+            // messages have variable sizes: header, then the datagram
+            ctl_msg_t m;
+            int n = read(reply_pipe[0], &m, offsetof(ctl_msg_t, data));
+            if (n == (int) offsetof(ctl_msg_t, data) && m.size >= (int) sizeof(packet_data_t)
+                    && m.size <= BUF_SIZE && read(reply_pipe[0], m.data, m.size) == m.size)
+                handle_reply(&m);
+        }
+        for (int k = nl + 1; k < nfds; k++) {
+            ctl_client_t *c = &clients[map[k]];
+            if (c -> fd < 0)
+                continue;
+            if ((fds[k].revents & (POLLIN | POLLHUP | POLLERR)) && !client_read(c)) {
+                client_close(c);
+                continue;
+            }
+        }
+        check_timeouts(routers, now_sec());
+        for (int i = 0; i < CTL_MAX_CLIENTS; i++) {
+            ctl_client_t *c = &clients[i];
+            if (c -> fd < 0)
+                continue;
+            client_process(c);
+            if (!client_flush(c))
+                client_close(c);
+        }
+    }
+}
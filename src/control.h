@@ -0,0 +1,43 @@
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include "router.h"
+
+// Control socket (UNIX domain, stream)
+// request:  one command per line (same syntax as the console)
+// response: command output, ended by a line CTL_END (success)
+//           or a line CTL_ERR followed by the reason
+// Requests of a client are answered in order; ping and traceroute are
+// answered when the replies arrive, without blocking the other clients.
+#define CTL_PATH "/tmp/router_R%d.sock"
+#define CTL_END "END"
+#define CTL_ERR "ERR"
+#define CTL_BACKLOG 8
+#define CTL_CMD_MAX 256
+#define CTL_MAX_CLIENTS 64
+
+// Control commands (on top of the console ones)
+#define ROUTE_ADD "route add"
+
+// Sequence numbers of the control socket probes (console ones are < 128)
+#define CTL_TR_SEQ 128          // traceroute: CTL_TR_SEQ + ttl
+#define CTL_TR_MAX_HOPS 32
+#define CTL_BULK_SEQ 161        // bulk transfer: BULK_END and BULK_REPORT
+#define CTL_PING_SEQ 192        // ping: CTL_PING_SEQ .. 255
+#define CTL_MAX_PINGS 64
+#define CTL_PING_TIMEOUT 2000   // ms
+#define CTL_TR_TIMEOUT 3000     // ms
+#define CTL_BULK_TIMEOUT 5000   // ms after the expected end of a bulk transfer
+
+// Routers served by the control thread (see control_server)
+typedef struct {
+    router_t **tab;
+    int size;
+} ctl_routers_t;
+
+/* ==================================================================== */
+void ctl_path(char *path, int size, int id);
+int ctl_reply(const char *buf, int size);
+void *control_server(void *args);
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "dvsimd.h"
+#include "stability.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(NO_SIMD)
+#define DV_X86
+#include <immintrin.h>
+#endif
+
+/* ============================= */
+/*  Shared data between threads  */
+int dv_kernel = DV_KERNEL_SCALAR;
+/* ============================= */
+
+static int dv_filter_scalar(const routing_table_t *rt, node_id_t neigh, int poison, dv_entry_t *out);
+
+static int (*filter_fn)(const routing_table_t *, node_id_t, int, dv_entry_t *) = dv_filter_scalar;
+
+/* ==================================================================== */
+/* ============================== SCALAR ============================== */
+/* ==================================================================== */
+
+// Split horizon: append to 'out' the (dest, metric | flags) pairs of the
+// routes from index 'i' not learnt from 'neigh', reachable and not default,
+// return the new number of entries 'n' (at most MAX_DV_SIZE).
+// With 'poison' (poison reverse), the routes learnt from 'neigh' and the
+// unreachable ones are kept with the metric STAB_INFINITY.
+static int filter_from(const routing_table_t *rt, int i, node_id_t neigh, int poison,
+                       dv_entry_t *out, int n) {
+    for (; i < rt -> size && n < MAX_DV_SIZE; i++) {
+        int lost = rt -> col_nh[i] == neigh || rt -> col_metric[i] > MAX_METRIC;
+        if ((lost && !poison) || rt -> col_flags[i] == DV_DEFAULT)
+            continue;
+        out[n].dest = rt -> col_dest[i];
+        out[n].metric = (lost ? STAB_INFINITY : rt -> col_metric[i]) | rt -> col_flags[i];
+        n++;
+    }
+    return n;
+}
+
+static int dv_filter_scalar(const routing_table_t *rt, node_id_t neigh, int poison, dv_entry_t *out) {
+    return filter_from(rt, 0, neigh, poison, out, 0);
+}
+
+/* ==================================================================== */
+/* ================================ X86 =============================== */
+/* ==================================================================== */
+
+#ifdef DV_X86
+// pshufb masks packing the 2-byte entries selected by an 8-bit mask
+static unsigned char pack_lut[256][16] __attribute__((aligned(16)));
+
+static void pack_lut_init() {
+    for (int mask = 0; mask < 256; mask++) {
+        int n = 0;
+        memset(pack_lut[mask], 0x80, 16);
+        for (int j = 0; j < 8; j++) {
+            if (mask & (1 << j)) {
+                pack_lut[mask][2 * n] = 2 * j;
+                pack_lut[mask][2 * n + 1] = 2 * j + 1;
+                n++;
+            }
+        }
+    }
+}
+
+// Store the entries of 'pairs' (8 x {dest, metric}) selected by 'mask' at
+// 'out' (16 bytes written), return the number of entries stored
+__attribute__((target("ssse3")))
+static inline int pack8(dv_entry_t *out, __m128i pairs, unsigned mask) {
+    __m128i shuf = _mm_load_si128((const __m128i *) pack_lut[mask]);
+    _mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(pairs, shuf));
+    return __builtin_popcount(mask);
+}
+
+// Filter routes i..i+15 (see filter_from), return the new number of
+// entries. At most i entries are written before, so the 16-byte stores
+// stay inside 'out' (MAX_DV_SIZE entries) while i + 16 <= MAX_DV_SIZE.
+__attribute__((target("ssse3")))
+static inline int filter16(const routing_table_t *rt, int i, node_id_t neigh, int poison,
+                           dv_entry_t *out, int n) {
+    const __m128i vinf = _mm_set1_epi8(STAB_INFINITY);
+    __m128i d = _mm_loadu_si128((const __m128i *) (rt -> col_dest + i));
+    __m128i m = _mm_loadu_si128((const __m128i *) (rt -> col_metric + i));
+    __m128i h = _mm_loadu_si128((const __m128i *) (rt -> col_nh + i));
+    __m128i f = _mm_loadu_si128((const __m128i *) (rt -> col_flags + i));
+    __m128i learnt = _mm_cmpeq_epi8(h, _mm_set1_epi8(neigh));
+    __m128i def = _mm_cmpeq_epi8(f, _mm_set1_epi8(DV_DEFAULT));
+    __m128i reach = _mm_cmpeq_epi8(_mm_min_epu8(m, _mm_set1_epi8(MAX_METRIC)), m);
+    unsigned keep;
+    if (poison) {       // lost routes: min(max(m, learnt ? inf : 0), inf)
+        keep = ~_mm_movemask_epi8(def) & 0xffff;
+        m = _mm_min_epu8(_mm_max_epu8(m, _mm_and_si128(learnt, vinf)), vinf);
+    } else
+        keep = _mm_movemask_epi8(_mm_andnot_si128(_mm_or_si128(learnt, def), reach));
+    __m128i om = _mm_or_si128(m, f);
+    n += pack8(out + n, _mm_unpacklo_epi8(d, om), keep & 0xff);
+    n += pack8(out + n, _mm_unpackhi_epi8(d, om), keep >> 8);
+    return n;
+}
+
+__attribute__((target("ssse3")))
+static int dv_filter_ssse3(const routing_table_t *rt, node_id_t neigh, int poison, dv_entry_t *out) {
+    int n = 0, i = 0;
+    for (; i + 16 <= rt -> size && i + 16 <= MAX_DV_SIZE; i += 16)
+        n = filter16(rt, i, neigh, poison, out, n);
+    return filter_from(rt, i, neigh, poison, out, n);
+}
+
+// 32 routes per iteration, then 16 and scalar on the tail
+__attribute__((target("avx2")))
+static int dv_filter_avx2(const routing_table_t *rt, node_id_t neigh, int poison, dv_entry_t *out) {
+    const __m256i vneigh = _mm256_set1_epi8(neigh);
+    const __m256i vmax = _mm256_set1_epi8(MAX_METRIC);
+    const __m256i vdef = _mm256_set1_epi8(DV_DEFAULT);
+    const __m256i vinf = _mm256_set1_epi8(STAB_INFINITY);
+    int n = 0, i = 0;
+    for (; i + 32 <= rt -> size && i + 32 <= MAX_DV_SIZE; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *) (rt -> col_dest + i));
+        __m256i m = _mm256_loadu_si256((const __m256i *) (rt -> col_metric + i));
+        __m256i h = _mm256_loadu_si256((const __m256i *) (rt -> col_nh + i));
+        __m256i f = _mm256_loadu_si256((const __m256i *) (rt -> col_flags + i));
+        __m256i learnt = _mm256_cmpeq_epi8(h, vneigh), def = _mm256_cmpeq_epi8(f, vdef);
+        __m256i reach = _mm256_cmpeq_epi8(_mm256_min_epu8(m, vmax), m);
+        unsigned keep;
+        if (poison) {
+            keep = ~_mm256_movemask_epi8(def);
+            m = _mm256_min_epu8(_mm256_max_epu8(m, _mm256_and_si256(learnt, vinf)), vinf);
+        } else
+            keep = _mm256_movemask_epi8(_mm256_andnot_si256(_mm256_or_si256(learnt, def), reach));
+        __m256i om = _mm256_or_si256(m, f);
+        // unpack works per 128-bit lane: lo = routes 0-7 and 16-23, hi = 8-15 and 24-31
+        __m256i lo = _mm256_unpacklo_epi8(d, om), hi = _mm256_unpackhi_epi8(d, om);
+        n += pack8(out + n, _mm256_castsi256_si128(lo), keep & 0xff);
+        n += pack8(out + n, _mm256_castsi256_si128(hi), (keep >> 8) & 0xff);
+        n += pack8(out + n, _mm256_extracti128_si256(lo, 1), (keep >> 16) & 0xff);
+        n += pack8(out + n, _mm256_extracti128_si256(hi, 1), keep >> 24);
+    }
+    if (i + 16 <= rt -> size && i + 16 <= MAX_DV_SIZE) {
+        n = filter16(rt, i, neigh, poison, out, n);
+        i += 16;
+    }
+    return filter_from(rt, i, neigh, poison, out, n);
+}
+#endif
+
+/* ==================================================================== */
+/* ============================= DISPATCH ============================= */
+/* ==================================================================== */
+
+// Select a kernel, return 0 if the CPU (or the build) does not support it
+int dv_kernel_set(int kernel) {
+    switch (kernel) {
+        case DV_KERNEL_SCALAR:
+            filter_fn = dv_filter_scalar;
+            break;
+#ifdef DV_X86
+        case DV_KERNEL_SSSE3:
+            if (!__builtin_cpu_supports("ssse3"))
+                return 0;
+            filter_fn = dv_filter_ssse3;
+            break;
+        case DV_KERNEL_AVX2:
+            if (!__builtin_cpu_supports("avx2"))
+                return 0;
+            filter_fn = dv_filter_avx2;
+            break;
+#endif
+        default:
+            return 0;
+    }
+    dv_kernel = kernel;
+    return 1;
+}
+
+const char *dv_kernel_name(int kernel) {
+    static const char *names[] = {"scalar", "ssse3", "avx2"};
+    return kernel >= 0 && kernel <= DV_KERNEL_AVX2 ? names[kernel] : "?";
+}
+
+// Best kernel of the CPU
+__attribute__((constructor))
+static void dv_kernel_init() {
+#ifdef DV_X86
+    __builtin_cpu_init();
+    pack_lut_init();
+    if (!dv_kernel_set(DV_KERNEL_AVX2))
+        dv_kernel_set(DV_KERNEL_SSSE3);
+#endif
+}
+
+int dv_filter(const routing_table_t *rt, node_id_t neigh, int poison, dv_entry_t *out) {
+    return filter_fn(rt, neigh, poison, out);
+}
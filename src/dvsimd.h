@@ -0,0 +1,26 @@
+#ifndef __DVSIMD_H__
+#define __DVSIMD_H__
+
+#include "router.h"
+
+// Split horizon DV construction (or poison reverse, see stability.h) on
+// the struct-of-arrays columns of the routing table (col_dest, col_metric,
+// col_nh, col_flags). The SSSE3 and AVX2 versions
+// are selected at startup from the CPU features, the scalar ones are
+// used on other CPUs or when built with -DNO_SIMD.
+#define DV_KERNEL_SCALAR 0
+#define DV_KERNEL_SSSE3 1
+#define DV_KERNEL_AVX2 2
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int dv_kernel;               // DV_KERNEL_xxx in use
+/* ============================= */
+
+/* ==================================================================== */
+int dv_kernel_set(int kernel);
+const char *dv_kernel_name(int kernel);
+
+int dv_filter(const routing_table_t *rt, node_id_t neigh, int poison, dv_entry_t *out);
+
+#endif
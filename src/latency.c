@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+int latency_on = 0;
+int hop_timestamps = 0;
+__thread long lat_rx_ns = 0;
+/* ============================= */
+
+static const char *stage_names[LAT_STAGES] = {
+    "recv", "classify", "lookup", "send", "total"
+};
+
+/* ==================================================================== */
+/* ============================ HISTOGRAMS ============================ */
+/* ==================================================================== */
+
+// CLOCK_REALTIME, same clock as the kernel receive timestamps
+long lat_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+static int lat_bucket(unsigned long v) {
+    if (v < LAT_SUB_COUNT)
+        return v;
+    int e = 63 - __builtin_clzl(v);         // v in [2^e, 2^(e+1))
+    if (e > LAT_MAX_EXP)
+        return LAT_BUCKETS - 1;
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB_COUNT
+           + ((v >> (e - LAT_SUB_BITS)) & (LAT_SUB_COUNT - 1));
+}
+
+// Highest value of a bucket
+static unsigned long lat_bucket_max(int b) {
+    if (b < LAT_SUB_COUNT)
+        return b;
+    int e = b / LAT_SUB_COUNT + LAT_SUB_BITS - 1;
+    unsigned long low = (unsigned long) (LAT_SUB_COUNT + b % LAT_SUB_COUNT) << (e - LAT_SUB_BITS);
+    return low + (1UL << (e - LAT_SUB_BITS)) - 1;
+}
+
+// Histograms of the current router, allocated by the first thread that
+// records one (NULL if out of memory)
+static lat_hist_t *lat_hists() {
+    lat_hist_t *h = __atomic_load_n(&cur_router -> lat_hists, __ATOMIC_ACQUIRE);
+    if (h != NULL)
+        return h;
+    lat_hist_t *n = calloc(LAT_STAGES, sizeof(lat_hist_t));
+    if (n == NULL)
+        return NULL;
+    if (__atomic_compare_exchange_n(&cur_router -> lat_hists, &h, n, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return n;
+    free(n);                    // another thread was first, h is its array
+    return h;
+}
+
+// Called by any thread sending packets (relaxed atomics)
+void lat_record(int stage, long ns) {
+    lat_hist_t *hists = lat_hists();
+    if (hists == NULL)
+        return;
+    lat_hist_t *h = &hists[stage];
+    unsigned long v = ns < 0 ? 0 : ns;
+    __atomic_add_fetch(&h -> count[lat_bucket(v)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h -> n, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h -> sum, v, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&h -> max, __ATOMIC_RELAXED);
+    while (v > max && !__atomic_compare_exchange_n(&h -> max, &max, v, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Clear the histograms of the current router
+void lat_reset() {
+    lat_hist_t *hists = __atomic_load_n(&cur_router -> lat_hists, __ATOMIC_ACQUIRE);
+    if (hists != NULL)
+        memset(hists, 0, LAT_STAGES * sizeof(lat_hist_t));
+}
+
+// Value at quantile q (highest value of its bucket)
+static double lat_quantile(const lat_hist_t *h, double q) {
+    unsigned long rank = (unsigned long) (q * h -> n), seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h -> count[b];
+        if (seen > rank) {
+            unsigned long v = lat_bucket_max(b);
+            return v < h -> max ? v : h -> max;
+        }
+    }
+    return h -> max;
+}
+
+// Histograms of the current router
+void print_latency(FILE *out) {
+
+    const lat_hist_t *hists = __atomic_load_n(&cur_router -> lat_hists, __ATOMIC_ACQUIRE);
+    fprintf(out, "========================= Forwarding latency (us) =========================\n");
+    fprintf(out, "Stage\t  |    count |   mean |    p50 |    p90 |    p99 |  p99.9 |    max\n");
+    fprintf(out, "---------------------------------------------------------------------------\n");
+    for (int s = 0; s < LAT_STAGES; s++) {
+        lat_hist_t h;
+        if (hists != NULL)
+            h = hists[s];                   // snapshot
+        else
+            memset(&h, 0, sizeof(h));
+        fprintf(out, "%-9s | %8lu", stage_names[s], h.n);
+        if (h.n == 0) {
+            fprintf(out, " |      - |      - |      - |      - |      - |      -\n");
+            continue;
+        }
+        fprintf(out, " | %6.1f | %6.1f | %6.1f | %6.1f | %6.1f | %6.1f\n",
+                h.sum / 1000.0 / h.n, lat_quantile(&h, 0.5) / 1000,
+                lat_quantile(&h, 0.9) / 1000, lat_quantile(&h, 0.99) / 1000,
+                lat_quantile(&h, 0.999) / 1000, h.max / 1000.0);
+    }
+    fprintf(out, "===========================================================================\n");
+    fprintf(out, "Histograms %s, hop timestamps %s.\n",
+            latency_on ? "on" : "off", hop_timestamps ? "on" : "off");
+}
+
+// Parse "latency on|off|reset" or "latency hops on|off",
+// return 0 on syntax error
+int latency_command(const char *cmd, FILE *out) {
+
+    char temp[16], arg[16], arg2[16];
+    int n = sscanf(cmd, "%15s%15s%15s", temp, arg, arg2);
+
+    if (n == 2 && !strcmp(arg, "on"))
+        latency_on = 1;
+    else if (n == 2 && !strcmp(arg, "off"))
+        latency_on = 0;
+    else if (n == 2 && !strcmp(arg, "reset"))
+        lat_reset();
+    else if (n == 3 && !strcmp(arg, "hops") && !strcmp(arg2, "on"))
+        hop_timestamps = 1;
+    else if (n == 3 && !strcmp(arg, "hops") && !strcmp(arg2, "off"))
+        hop_timestamps = 0;
+    else
+        return 0;
+    fprintf(out, "Histograms %s, hop timestamps %s.\n",
+            latency_on ? "on" : "off", hop_timestamps ? "on" : "off");
+    return 1;
+}
+
+/* ==================================================================== */
+/* ========================== HOP TIMESTAMPS ========================== */
+/* ==================================================================== */
+
+// Hop trailer of a DATA datagram (NULL if none or malformed)
+const hopts_hdr_t *hopts_find(const char *buf, int size) {
+    int off = HOPTS_OFFSET(((const packet_data_t *) buf) -> len);
+    const hopts_hdr_t *h = (const hopts_hdr_t *) (buf + off);
+    if (size < off + (int) HOPTS_SIZE(0) || h -> magic != HOPTS_MAGIC
+            || h -> count > HOPTS_MAX || size < off + (int) HOPTS_SIZE(h -> count))
+        return NULL;
+    return h;
+}
+
+// Add a trailer to the packet_data_t (and payload) at the start of 'buf'
+// with our entry (sending time), return the new size
+int hopts_init(char *buf) {
+    int off = HOPTS_OFFSET(((packet_data_t *) buf) -> len);
+    if (off + HOPTS_SIZE(1) > BUF_SIZE)         // no room left
+        return DATA_SIZE(((packet_data_t *) buf) -> len);
+    hopts_hdr_t *h = (hopts_hdr_t *) (buf + off);
+    memset(h, 0, sizeof(*h));
+    h -> magic = HOPTS_MAGIC;
+    return hopts_append(buf, off + HOPTS_SIZE(0), lat_now());
+}
+
+// Append our entry to the trailer of a packet (buffer of BUF_SIZE bytes)
+// received at 'rx_ns', return the new size (unchanged if no trailer or full)
+int hopts_append(char *buf, int size, long rx_ns) {
+    hopts_hdr_t *h = (hopts_hdr_t *) hopts_find(buf, size);
+    int off = HOPTS_OFFSET(((packet_data_t *) buf) -> len);
+    if (h == NULL || h -> count == HOPTS_MAX || off + HOPTS_SIZE(h -> count + 1) > BUF_SIZE)
+        return size;
+    if (rx_ns <= 0)             // no receive timestamp
+        rx_ns = lat_now();
+    hopts_entry_t *e = (hopts_entry_t *) (buf + off + HOPTS_SIZE(h -> count));
+    memset(e, 0, sizeof(*e));
+    e -> rx_ns = rx_ns;
+    e -> res_ns = lat_now() - rx_ns;
+    e -> id = MY_ID;
+    h -> count++;
+    return off + HOPTS_SIZE(h -> count);
+}
+
+// Copy the trailer of the request 'src' to the reply 'dst' (a packet_data_t
+// without payload in a buffer of BUF_SIZE bytes) and append our entry,
+// return the reply size
+int hopts_copy(char *dst, int dst_size, const char *src, int src_size, long rx_ns) {
+    const hopts_hdr_t *h = hopts_find(src, src_size);
+    if (h == NULL)
+        return dst_size;
+    memcpy(dst + sizeof(packet_data_t), h, HOPTS_SIZE(h -> count));
+    return hopts_append(dst, sizeof(packet_data_t) + HOPTS_SIZE(h -> count), rx_ns);
+}
+
+// One-way delay (ns) from the origin to the first entry of router 'id'
+// (-1 if not in the trailer)
+long hopts_oneway(const char *buf, int size, node_id_t id) {
+    const hopts_hdr_t *h = hopts_find(buf, size);
+    if (h == NULL || h -> count == 0)
+        return -1;
+    const hopts_entry_t *e = (const hopts_entry_t *) (h + 1);
+    for (int i = 1; i < h -> count; i++) {
+        if (e[i].id == id)
+            return e[i].rx_ns - e[0].rx_ns;
+    }
+    return -1;
+}
+
+// Print the hops of a reply: link delay from the previous hop and time
+// spent in each router
+void print_hopts(FILE *out, const char *buf, int size) {
+    const hopts_hdr_t *h = hopts_find(buf, size);
+    if (h == NULL)
+        return;
+    const hopts_entry_t *e = (const hopts_entry_t *) (h + 1);
+    for (int i = 0; i < h -> count; i++) {
+        long link = i == 0 ? 0 : (long) (e[i].rx_ns - e[i - 1].rx_ns) - e[i - 1].res_ns;
+        fprintf(out, "     R%-3d link %8.1fus   router %8.1fus\n",
+                e[i].id, link / 1000.0, e[i].res_ns / 1000.0);
+    }
+}
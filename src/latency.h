@@ -0,0 +1,87 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdio.h>
+#include "router.h"
+
+// Forwarding path stages
+#define LAT_RECV 0              // kernel receive timestamp -> read by the input thread
+#define LAT_CLASSIFY 1          // read -> forwarding decision (parse, rate limit, ttl)
+#define LAT_LOOKUP 2            // route lookup (forward_packet)
+#define LAT_SEND 3              // socket + sendto (forward_packet)
+#define LAT_TOTAL 4             // kernel receive timestamp -> forwarded
+#define LAT_STAGES 5
+
+// Log-linear (HDR-style) histogram: values < 2^LAT_SUB_BITS ns are exact,
+// above each power of 2 is split in 2^LAT_SUB_BITS buckets (~6% error)
+#define LAT_SUB_BITS 4
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_MAX_EXP 40          // values >= 2^41 ns (~37 min) are clamped
+#define LAT_BUCKETS ((LAT_MAX_EXP - LAT_SUB_BITS + 2) * LAT_SUB_COUNT)
+
+typedef struct lat_hist {
+    unsigned long count[LAT_BUCKETS];
+    unsigned long n;
+    unsigned long sum;          // ns
+    unsigned long max;          // ns
+} lat_hist_t;
+
+// In-band hop timestamps: optional trailer after a packet_data_t and its
+// payload (at the next multiple of 8 bytes), if there is room left in
+// BUF_SIZE. Every router appends its entry before forwarding or answering the
+// packet, replies carry the trailer of the request back.
+// Timestamps are CLOCK_REALTIME: one-way delays need synchronized clocks
+// (always true when all the routers run on the same host).
+#define HOPTS_MAGIC 0xd7
+#define HOPTS_MAX 32
+
+typedef struct {
+    unsigned char magic;        // HOPTS_MAGIC
+    unsigned char count;        // entries following the header
+    unsigned char pad[6];
+} hopts_hdr_t;
+
+typedef struct {
+    unsigned long rx_ns;        // packet received (origin: packet sent)
+    unsigned int res_ns;        // time spent in the router (received -> sent)
+    node_id_t id;
+    unsigned char pad[3];
+} hopts_entry_t;
+
+#define HOPTS_SIZE(n) (sizeof(hopts_hdr_t) + (n) * sizeof(hopts_entry_t))
+#define HOPTS_OFFSET(len) DATA_SIZE(((len) + 7) & ~7)   // trailer of a packet with 'len' payload bytes
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int latency_on;          // stage histograms enabled (every router of
+                                // the process, each has its own, see router_t)
+extern int hop_timestamps;      // ping/traceroute requests carry a hop trailer
+extern __thread long lat_rx_ns; // receive time of the packet being handled
+                                // (written by the input thread only)
+/* ============================= */
+
+long lat_now();
+void lat_record(int stage, long ns);
+
+// Current time if the histograms are enabled, 0 otherwise
+#define LAT_NOW() (__builtin_expect(latency_on, 0) ? lat_now() : 0)
+
+// Record the stage between t0 and t1 (both from LAT_NOW)
+#define LAT_STAGE(stage, t0, t1) do {                       \
+        if (__builtin_expect(latency_on, 0) && (t0) > 0)    \
+            lat_record(stage, (t1) - (t0));                 \
+    } while (0)
+
+/* ==================================================================== */
+void lat_reset();
+void print_latency(FILE *out);
+int latency_command(const char *cmd, FILE *out);
+
+const hopts_hdr_t *hopts_find(const char *buf, int size);
+int hopts_init(char *buf);
+int hopts_append(char *buf, int size, long rx_ns);
+int hopts_copy(char *dst, int dst_size, const char *src, int src_size, long rx_ns);
+long hopts_oneway(const char *buf, int size, node_id_t id);
+void print_hopts(FILE *out, const char *buf, int size);
+
+#endif
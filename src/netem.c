@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "netem.h"
+
+// Datagram waiting for its departure time
+typedef struct {
+    double when;                    // monotonic time to send it
+    unsigned long order;            // FIFO between equal times
+    int len;
+    int sock;                       // of the interface it leaves from
+    sock_addr_t adr;
+    char data[BUF_SIZE];
+} netem_pkt_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+int netem_on = 0;
+static netem_link_t links[NETEM_IDS];           // indexed by neighbor id
+static netem_stats_t nstats[NETEM_IDS];
+static double busy[NETEM_IDS];                  // end of the last transmission (rate cap)
+static netem_pkt_t *heap;                       // min-heap on (when, order)
+static int heap_size = 0;
+static unsigned long heap_order = 0;
+static struct drand48_data rnd;
+static char config_file[256];
+static pthread_mutex_t netem_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netem_cond;
+static pthread_t netem_th;
+static int netem_started = 0;
+/* ============================= */
+
+static double netem_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+// Uniform in [0, 1) (netem_lock held)
+static double uniform() {
+    double r;
+    drand48_r(&rnd, &r);
+    return r;
+}
+
+/* ==================================================================== */
+/* ============================ TIMER QUEUE =========================== */
+/* ==================================================================== */
+
+static int pkt_before(const netem_pkt_t *a, const netem_pkt_t *b) {
+    return a -> when < b -> when || (a -> when == b -> when && a -> order < b -> order);
+}
+
+static void heap_swap(int i, int j) {
+    netem_pkt_t t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+}
+
+// Queue a datagram, return 0 if the queue is full (netem_lock held)
+static int heap_push(double when, int sock, const void *buf, int len, const sock_addr_t *adr) {
+    if (heap_size == NETEM_QUEUE_SLOTS)
+        return 0;
+    int i = heap_size++;
+    heap[i].when = when;
+    heap[i].order = heap_order++;
+    heap[i].len = len;
+    heap[i].sock = sock;
+    heap[i].adr = *adr;
+    memcpy(heap[i].data, buf, len);
+    while (i > 0 && pkt_before(&heap[i], &heap[(i - 1) / 2])) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return 1;
+}
+
+// Remove the first datagram into 'p' (netem_lock held, heap not empty)
+static void heap_pop(netem_pkt_t *p) {
+    *p = heap[0];
+    heap[0] = heap[--heap_size];
+    int i = 0;
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < heap_size && pkt_before(&heap[l], &heap[m]))
+            m = l;
+        if (r < heap_size && pkt_before(&heap[r], &heap[m]))
+            m = r;
+        if (m == i)
+            break;
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+// Send the delayed datagrams at their departure time
+static void *netem_thread(void *unused) {
+
+    netem_pkt_t p;
+
+    pthread_mutex_lock(&netem_lock);
+    while (1) {
+        if (heap_size == 0) {
+            pthread_cond_wait(&netem_cond, &netem_lock);
+            continue;
+        }
+        double wait = heap[0].when - netem_now();
+        if (wait > 0) {
+            struct timespec t;
+            clock_gettime(CLOCK_MONOTONIC, &t);
+            t.tv_sec += (time_t) wait;
+            t.tv_nsec += (long) ((wait - (time_t) wait) * 1e9);
+            if (t.tv_nsec >= 1000000000L) {
+                t.tv_sec++;
+                t.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&netem_cond, &netem_lock, &t);
+            continue;
+        }
+        heap_pop(&p);
+        pthread_mutex_unlock(&netem_lock);
+        if (sendto(p.sock, p.data, p.len, 0, &p.adr.sa, SOCK_ADDR_LEN(&p.adr)) < 0)
+            logger("NETEM TH", "sendto %s", strerror(errno));
+        pthread_mutex_lock(&netem_lock);
+    }
+    return NULL;
+}
+
+/* ==================================================================== */
+/* ============================== SENDER ============================== */
+/* ==================================================================== */
+
+// Send a datagram to neighbor 'neigh' through its emulated link, return
+// 'len' (even if the link dropped it) or -1 on sendto error
+int netem_sendto(int sock, const void *buf, int len, node_id_t neigh,
+                 const sock_addr_t *adr) {
+
+    if (__builtin_expect(!netem_on, 1))
+        return sendto(sock, buf, len, 0, &adr -> sa, SOCK_ADDR_LEN(adr));
+
+    int ret = len;
+    pthread_mutex_lock(&netem_lock);
+    netem_link_t *l = &links[neigh];
+    netem_stats_t *s = &nstats[neigh];
+    s -> sent++;
+    int copies = 1;
+    if (l -> dup > 0 && uniform() < l -> dup) {
+        copies = 2;
+        s -> duplicated++;
+    }
+    for (int c = 0; c < copies; c++) {
+        if (l -> loss > 0 && uniform() < l -> loss) {
+            s -> dropped++;
+            continue;
+        }
+        double now = netem_now(), when = now;
+        if (l -> reorder > 0 && uniform() < l -> reorder) {
+            s -> reordered++;           // jumps over the delayed datagrams
+        } else {
+            if (l -> rate > 0) {        // serialization behind the previous datagrams
+                double start = busy[neigh] > now ? busy[neigh] : now;
+                if (start - now > NETEM_MAX_BACKLOG) {
+                    s -> overflow++;
+                    continue;
+                }
+                busy[neigh] = start + len * 8 / l -> rate;
+                when = busy[neigh];
+            }
+            when += l -> delay + l -> jitter * (2 * uniform() - 1);
+        }
+        if (when <= now) {
+            if (sendto(sock, buf, len, 0, &adr -> sa, SOCK_ADDR_LEN(adr)) < 0)
+                ret = -1;
+        } else if (heap_push(when, sock, buf, len, adr)) {
+            s -> delayed++;
+            pthread_cond_signal(&netem_cond);
+        } else {
+            s -> overflow++;
+        }
+    }
+    pthread_mutex_unlock(&netem_lock);
+    return ret;
+}
+
+/* ==================================================================== */
+/* ============================== CONFIG ============================== */
+/* ==================================================================== */
+
+// Parameters of a config line, with their unit conversion
+static const struct {
+    const char *name;
+    size_t offset;                  // in netem_link_t
+    double scale;
+} params[] = {
+    {"loss", offsetof(netem_link_t, loss), 1},
+    {"delay", offsetof(netem_link_t, delay), 1e-3},         // ms
+    {"jitter", offsetof(netem_link_t, jitter), 1e-3},       // ms
+    {"dup", offsetof(netem_link_t, dup), 1},
+    {"reorder", offsetof(netem_link_t, reorder), 1},
+    {"rate", offsetof(netem_link_t, rate), 1e3},            // kbit/s
+};
+#define NB_PARAMS (int) (sizeof(params) / sizeof(params[0]))
+#define PARAM(l, i) (*(double *) ((char *) (l) + params[i].offset))
+
+// 1 if the endpoints 'a' and 'b' of a config line (-1: '*') match
+// the link between us and 'neigh'
+static int link_match(int a, int b, int neigh) {
+    return ((a < 0 || a == MY_ID) && (b < 0 || b == neigh))
+           || ((b < 0 || b == MY_ID) && (a < 0 || a == neigh));
+}
+
+static int parse_endpoint(const char *tok, int *id) {
+    if (!strcmp(tok, "*")) {
+        *id = -1;
+        return 1;
+    }
+    char *end;
+    *id = strtol(tok, &end, 10);
+    return *end == '\0' && *id > 0 && *id < NETEM_IDS;
+}
+
+// Read the link parameters of this router. Config file syntax:
+//   # comment
+//   seed <n>
+//   <a> <b> [loss <p>] [delay <ms>] [jitter <ms>] [dup <p>] [reorder <p>] [rate <kbit/s>]
+// <a> and <b> are node ids or '*'. A line applies to both directions of the
+// matching links, later lines override the parameters they set.
+// Return 0 if the file cannot be read or has a syntax error.
+int netem_load(const char *file) {
+
+    static netem_link_t new_links[NETEM_IDS];
+    char line[256], *save;
+    long seed = MY_ID;
+    int lineno = 0;
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        logger("NETEM", "cannot open %s: %s", file, strerror(errno));
+        return 0;
+    }
+    memset(new_links, 0, sizeof(new_links));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char *tok = strtok_r(line, " \t\n", &save);
+        if (tok == NULL || tok[0] == '#')
+            continue;
+        if (!strcmp(tok, "seed")) {
+            if ((tok = strtok_r(NULL, " \t\n", &save)) == NULL)
+                goto syntax;
+            seed = atol(tok);
+            continue;
+        }
+        int a, b;
+        char *tok_b = strtok_r(NULL, " \t\n", &save);
+        if (tok_b == NULL || !parse_endpoint(tok, &a) || !parse_endpoint(tok_b, &b))
+            goto syntax;
+        netem_link_t set = {0};
+        int given = 0;          // bit i => params[i] is on the line
+        char *key, *val;
+        while ((key = strtok_r(NULL, " \t\n", &save)) != NULL) {
+            if ((val = strtok_r(NULL, " \t\n", &save)) == NULL)
+                goto syntax;
+            int i = 0;
+            while (i < NB_PARAMS && strcmp(key, params[i].name))
+                i++;
+            if (i == NB_PARAMS || atof(val) < 0)
+                goto syntax;
+            PARAM(&set, i) = atof(val) * params[i].scale;
+            given |= 1 << i;
+        }
+        for (int n = 1; n < NETEM_IDS; n++) {
+            if (n == MY_ID || !link_match(a, b, n))
+                continue;
+            for (int i = 0; i < NB_PARAMS; i++) {
+                if (given & (1 << i))
+                    PARAM(&new_links[n], i) = PARAM(&set, i);
+            }
+        }
+    }
+    fclose(f);
+
+    pthread_mutex_lock(&netem_lock);
+    if (heap == NULL && (heap = malloc(NETEM_QUEUE_SLOTS * sizeof(netem_pkt_t))) == NULL) {
+        pthread_mutex_unlock(&netem_lock);
+        logger("NETEM", "cannot allocate the timer queue");
+        return 0;
+    }
+    if (!netem_started) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&netem_cond, &attr);
+        pthread_create(&netem_th, NULL, &netem_thread, NULL);
+        netem_started = 1;
+    }
+    memcpy(links, new_links, sizeof(links));
+    memset(nstats, 0, sizeof(nstats));
+    memset(busy, 0, sizeof(busy));
+    srand48_r(seed, &rnd);
+    snprintf(config_file, sizeof(config_file), "%s", file);
+    netem_on = 1;
+    pthread_mutex_unlock(&netem_lock);
+    logger("NETEM", "links emulated from %s", file);
+    return 1;
+
+syntax:
+    fclose(f);
+    logger("NETEM", "%s:%d: syntax error", file, lineno);
+    return 0;
+}
+
+// Send the datagrams directly again (the queued ones still leave on time)
+void netem_off() {
+    netem_on = 0;
+}
+
+/* ==================================================================== */
+/* ============================= COMMAND ============================== */
+/* ==================================================================== */
+
+void print_netem(FILE *out) {
+
+    if (!netem_on) {
+        fprintf(out, "Link emulation off.\n");
+        return;
+    }
+    pthread_mutex_lock(&netem_lock);
+    fprintf(out, "Link emulation from %s, %d datagrams queued.\n", config_file, heap_size);
+    fprintf(out, "Link | Loss | Delay (ms) | Jitter | Dup  | Reord. | Rate (kbit/s) "
+                 "| Sent   | Lost   | Dup.   | Reord. | Delay. | Overfl.\n");
+    for (int n = 1; n < NETEM_IDS; n++) {
+        netem_link_t *l = &links[n];
+        netem_stats_t *s = &nstats[n];
+        if (s -> sent == 0)         // not a neighbor (or no traffic yet)
+            continue;
+        fprintf(out, "R%-3d | %4.2f | %10.1f | %6.1f | %4.2f | %6.2f | ",
+                n, l -> loss, l -> delay * 1000, l -> jitter * 1000, l -> dup, l -> reorder);
+        if (l -> rate > 0)
+            fprintf(out, "%13.0f ", l -> rate / 1000);
+        else
+            fprintf(out, "            - ");
+        fprintf(out, "| %6lu | %6lu | %6lu | %6lu | %6lu | %lu\n", s -> sent, s -> dropped,
+                s -> duplicated, s -> reordered, s -> delayed, s -> overflow);
+    }
+    pthread_mutex_unlock(&netem_lock);
+}
+
+// Parse "netem load <file>", "netem off" or "netem", return 0 on error
+int netem_command(const char *cmd, FILE *out) {
+
+    char temp[16], arg[16], file[256];
+    int n = sscanf(cmd, "%15s%15s%255s", temp, arg, file);
+
+    if (n == 3 && !strcmp(arg, "load")) {
+        if (!netem_load(file)) {
+            fprintf(out, "--> Cannot load %s (see the log).\n", file);
+            return 0;
+        }
+    } else if (n == 2 && !strcmp(arg, "off")) {
+        netem_off();
+    } else if (n != 1) {
+        return 0;
+    }
+    print_netem(out);
+    return 1;
+}
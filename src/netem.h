@@ -0,0 +1,49 @@
+#ifndef __NETEM_H__
+#define __NETEM_H__
+
+#include <stdio.h>
+#include <netinet/in.h>
+#include "router.h"
+
+// Link emulation: loss, delay, jitter, duplication, reordering and
+// bandwidth caps applied by the sender to the datagrams sent to each
+// neighbor (DVs, ACKs and forwarded packets), without netem or root.
+// Delayed datagrams wait in a timer queue served by the netem thread.
+#define NETEM_IDS 256               // one link per possible neighbor id
+#define NETEM_QUEUE_SLOTS 1024      // delayed datagrams (all links)
+#define NETEM_MAX_BACKLOG 1.0       // s of queued traffic at the rate cap (tail drop)
+
+// Link parameters ('<a> <b> ...' lines of the config file)
+typedef struct {
+    double loss;                    // drop probability
+    double delay;                   // s
+    double jitter;                  // s, uniform in [-jitter, +jitter]
+    double dup;                     // duplication probability
+    double reorder;                 // probability to skip the delay (sent at once)
+    double rate;                    // bit/s, 0 => unlimited
+} netem_link_t;
+
+typedef struct {
+    unsigned long sent;             // datagrams given to netem_sendto
+    unsigned long dropped;          // lost (loss probability)
+    unsigned long duplicated;
+    unsigned long reordered;        // sent ahead of the delayed ones
+    unsigned long delayed;          // went through the timer queue
+    unsigned long overflow;         // dropped: queue full or backlog too long
+} netem_stats_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int netem_on;                // a config is loaded
+/* ============================= */
+
+/* ==================================================================== */
+int netem_load(const char *file);
+void netem_off();
+int netem_sendto(int sock, const void *buf, int len, node_id_t neigh,
+                 const sock_addr_t *adr);
+
+void print_netem(FILE *out);
+int netem_command(const char *cmd, FILE *out);
+
+#endif
@@ -0,0 +1,56 @@
+#include "packet.h"
+
+// Check that the datagram 'buf' of 'size' bytes holds a well-formed packet.
+// Return its type (DATA, CTRL or ACK), or a PKT_ERR_* code (< 0).
+// Trailing bytes after the packet are allowed.
+int parse_packet(const char *buf, int size) {
+
+    if (size < 1)
+        return PKT_ERR_SHORT;
+
+    switch (buf[0]) {
+
+        case DATA: {
+            const packet_data_t *p = (const packet_data_t *) buf;
+            if (size < (int) sizeof(packet_data_t))
+                return PKT_ERR_SHORT;
+            if (p -> len > MAX_PAYLOAD)
+                return PKT_ERR_LEN;
+            if (size < (int) DATA_SIZE(p -> len))
+                return PKT_ERR_SHORT;
+            return DATA;
+        }
+
+        case CTRL: {
+            const packet_ctrl_t *p = (const packet_ctrl_t *) buf;
+            if (size < (int) CTRL_HDR_SIZE)
+                return PKT_ERR_SHORT;
+            if (size < (int) CTRL_SIZE(p -> dv_size))    // dv_size <= MAX_DV_SIZE (a byte)
+                return PKT_ERR_DV_SIZE;
+            for (int i = 0; i < p -> dv_size; i++) {
+                unsigned char m = p -> dv[i].metric;
+                if (DV_METRIC(m) > MAX_METRIC + 1
+                        || (m & (DV_SUMMARY | DV_DEFAULT)) == (DV_SUMMARY | DV_DEFAULT))
+                    return PKT_ERR_METRIC;
+            }
+            return CTRL;
+        }
+
+        case ACK:
+            if (size < (int) sizeof(packet_ack_t))
+                return PKT_ERR_SHORT;
+            return ACK;
+    }
+    return PKT_ERR_TYPE;
+}
+
+const char *packet_strerror(int err) {
+    switch (err) {
+        case PKT_ERR_SHORT:     return "truncated packet";
+        case PKT_ERR_TYPE:      return "unknown packet type";
+        case PKT_ERR_DV_SIZE:   return "DV longer than the datagram";
+        case PKT_ERR_METRIC:    return "invalid metric";
+        case PKT_ERR_LEN:       return "payload too large";
+    }
+    return "no error";
+}
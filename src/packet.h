@@ -1,9 +1,12 @@
 #ifndef __PACKET_H__
 #define __PACKET_H__
 
+#include <stddef.h>
+
 // Packet types
 #define CTRL 1
 #define DATA 0
+#define ACK 2       // acknowledgement of a DV (see reliable.h)
 
 // Data types
 #define ECHO_REQUEST 1
@@ -11,9 +14,28 @@
 #define TR_REQUEST 10
 #define TR_TIME_EXCEEDED 11
 #define TR_ARRIVED 12
+#define BULK_DATA 20        // bulk transfer (see bulk.h)
+#define BULK_END 21
+#define BULK_REPORT 22
 
-#define MAX_DV_SIZE 20
+#define MAX_DV_SIZE 255     // dv_size is an unsigned char
 #define DEFAULT_TTL 32
+#define MAX_METRIC 16       // example for RIPv2
+#define MAX_PAYLOAD 1448    // DATA payload: BUF_SIZE (router.h) - sizeof(packet_data_t)
+                            // (over IPv6, 1428 avoids fragmenting on a 1500 bytes MTU)
+
+// DV entry flags, in the high bits of the metric byte
+#define DV_SUMMARY 0x80     // dest is an area prefix (see area_bits in router.h)
+#define DV_DEFAULT 0x40     // default route (dest is ignored)
+#define DV_METRIC_MASK 0x3f
+#define DV_METRIC(m) ((m) & DV_METRIC_MASK)
+
+// Parse errors (see parse_packet)
+#define PKT_ERR_SHORT -1    // datagram shorter than the packet it claims to be
+#define PKT_ERR_TYPE -2     // unknown packet type
+#define PKT_ERR_DV_SIZE -3  // dv_size entries do not fit in the datagram
+#define PKT_ERR_METRIC -4   // metric greater than MAX_METRIC + 1 or invalid flags
+#define PKT_ERR_LEN -5      // payload longer than MAX_PAYLOAD
 
 // Distance vector entry
 typedef struct {
@@ -26,10 +48,23 @@ typedef struct {
     unsigned char type; // CTRL
     unsigned char src_id;
     unsigned char dv_size;
+    unsigned char period; // s until the next periodic DVs of src (0: BROADCAST_PERIOD, see adaptive.h)
     dv_entry_t dv[MAX_DV_SIZE];
 } packet_ctrl_t;
 
-// Data packet
+// Size of a control packet carrying n DV entries
+#define CTRL_HDR_SIZE offsetof(packet_ctrl_t, dv)
+#define CTRL_SIZE(n) (CTRL_HDR_SIZE + (n) * sizeof(dv_entry_t))
+
+// Acknowledgement packet
+typedef struct {
+    unsigned char type; // ACK
+    unsigned char src_id;
+    unsigned short seq; // sequence number of the DV trailer
+} packet_ack_t;
+
+// Data packet, followed by 'len' bytes of payload, then by the optional
+// hop timestamps (see latency.h)
 typedef struct {
     unsigned char type; // DATA
     unsigned char subtype; // ECHO REQUEST, ECHO REPLY, TRACEROUTE...
@@ -37,8 +72,15 @@ typedef struct {
     unsigned char dst_id;
     unsigned char ttl;
     unsigned char msg_seq;
+    unsigned short len; // payload bytes
     unsigned long time_sec;
     unsigned long time_nsec;
 } packet_data_t;
 
+// Size of a data packet carrying n payload bytes
+#define DATA_SIZE(n) (sizeof(packet_data_t) + (n))
+
+int parse_packet(const char *buf, int size);
+const char *packet_strerror(int err);
+
 #endif
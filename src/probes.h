@@ -0,0 +1,84 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+// Static tracepoints (USDT, provider "router") on the packet and DV paths,
+// for bpftrace, perf or SystemTap on a running router (see tools/trace):
+// each one is a nop in the code and an ELF note (.note.stapsdt) giving its
+// address and where its arguments are (registers, stack or constants).
+// Tracers patch the nop while they are attached: when nobody traces, a
+// probe costs one nop and keeping its arguments in registers.
+// The notes come from <sys/sdt.h> when it is installed, or are written
+// here (x86_64, the same format). -DNO_PROBES or another target removes
+// them. Arguments are integers of at most 8 bytes. 'readelf -n router'
+// (or make probes) lists the probes.
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PROBES_SDT
+#endif
+#endif
+
+#if defined(PROBES_SDT)
+
+#include <sys/sdt.h>
+#define PROBE0(name) DTRACE_PROBE(router, name)
+#define PROBE1(name, a) DTRACE_PROBE1(router, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(router, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(router, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(router, name, a, b, c, d)
+
+#elif !defined(NO_PROBES) && defined(__x86_64__) && defined(__GNUC__)
+
+// Note of the probe at label 990 (see the SystemTap SDT format), and the
+// .stapsdt.base section the tracers use to relocate the addresses
+#define PROBE_NOTE(name, args)                                              \
+    "990: nop\n"                                                            \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                           \
+    ".balign 4\n"                                                           \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                      \
+    "991: .asciz \"stapsdt\"\n"                                             \
+    "992: .balign 4\n"                                                      \
+    "993: .8byte 990b\n"                                                    \
+    ".8byte _.stapsdt.base\n"                                               \
+    ".8byte 0\n"                                                            \
+    ".asciz \"router\"\n"                                                   \
+    ".asciz \"" #name "\"\n"                                                \
+    ".asciz \"" args "\"\n"                                                 \
+    "994: .balign 4\n"                                                      \
+    ".popsection\n"                                                         \
+    ".ifndef _.stapsdt.base\n"                                              \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                                \
+    ".hidden _.stapsdt.base\n"                                              \
+    "_.stapsdt.base: .space 1\n"                                            \
+    ".size _.stapsdt.base, 1\n"                                             \
+    ".popsection\n"                                                         \
+    ".endif\n"
+
+// "<size>@<operand>" of an argument, the size is negative if it is signed
+#define PROBE_SIZE(x) (((__typeof__(x)) -1 < 1 ? -1 : 1) * (int) sizeof(x))
+#define PROBE_ARG(x) "n" (PROBE_SIZE(x)), "nor" (x)
+
+#define PROBE0(name) __asm__ __volatile__ (PROBE_NOTE(name, ""))
+#define PROBE1(name, a)                                                     \
+    __asm__ __volatile__ (PROBE_NOTE(name, "%c0@%1") :: PROBE_ARG(a))
+#define PROBE2(name, a, b)                                                  \
+    __asm__ __volatile__ (PROBE_NOTE(name, "%c0@%1 %c2@%3")                 \
+                          :: PROBE_ARG(a), PROBE_ARG(b))
+#define PROBE3(name, a, b, c)                                               \
+    __asm__ __volatile__ (PROBE_NOTE(name, "%c0@%1 %c2@%3 %c4@%5")          \
+                          :: PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c))
+#define PROBE4(name, a, b, c, d)                                            \
+    __asm__ __volatile__ (PROBE_NOTE(name, "%c0@%1 %c2@%3 %c4@%5 %c6@%7")   \
+                          :: PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c), PROBE_ARG(d))
+
+#else
+
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE4(name, a, b, c, d) do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ratelimit.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+unsigned long rl_src_drops[RL_MAX_IDS];
+static rl_config_t config;                      // all zero => rate limiting off
+static token_bucket_t src_tb[RL_MAX_IDS];       // indexed by src_id
+static token_bucket_t neigh_tb[RL_MAX_IDS];     // indexed by next hop id
+static pthread_mutex_t rl_lock = PTHREAD_MUTEX_INITIALIZER;
+/* ============================= */
+
+// Egress queues (only used by the input packets thread)
+typedef struct {
+    int size;
+    short next;                 // next slot in the same queue (-1: none)
+    unsigned char held;         // already held back by its next hop bucket (counted)
+    char data[BUF_SIZE];
+} rl_slot_t;
+
+typedef struct {
+    short head, tail;           // FIFO of slots
+    int count;
+    int deficit;                // DRR deficit counter (bytes)
+    int blocked;                // blocked by its next hop bucket on last visit
+} rl_flow_t;
+
+static rl_slot_t slots[RL_QUEUE_SLOTS];
+static short free_slots = -1;
+static int slots_init = 0;
+static rl_flow_t flows[RL_MAX_IDS];
+static node_id_t active[RL_MAX_IDS];            // round robin list of backlogged sources
+static int act_head = 0, act_count = 0;
+
+/* ==================================================================== */
+/* ========================== TOKEN BUCKETS =========================== */
+/* ==================================================================== */
+
+static void tb_init(token_bucket_t *tb, double rate, double burst) {
+    tb -> rate = rate;
+    tb -> burst = burst < 1 ? 1 : burst;
+    tb -> tokens = tb -> burst;
+    clock_gettime(CLOCK_MONOTONIC, &tb -> last);
+}
+
+static void tb_refill(token_bucket_t *tb, const struct timespec *now) {
+    double dt = (now -> tv_sec - tb -> last.tv_sec)
+                + 1.0e-9 * (now -> tv_nsec - tb -> last.tv_nsec);
+    tb -> tokens += dt * tb -> rate;
+    if (tb -> tokens > tb -> burst)
+        tb -> tokens = tb -> burst;
+    tb -> last = *now;
+}
+
+// Take one token, return 0 if the bucket is empty
+static int tb_take(token_bucket_t *tb, const struct timespec *now) {
+    if (tb -> rate <= 0)    // unlimited
+        return 1;
+    tb_refill(tb, now);
+    if (tb -> tokens < 1)
+        return 0;
+    tb -> tokens -= 1;
+    return 1;
+}
+
+// Time (in ms) until the bucket holds one token
+static int tb_wait_ms(const token_bucket_t *tb) {
+    if (tb -> rate <= 0 || tb -> tokens >= 1)
+        return 0;
+    return (int) (1000.0 * (1 - tb -> tokens) / tb -> rate) + 1;
+}
+
+/* ==================================================================== */
+/* ========================== CONFIGURATION =========================== */
+/* ==================================================================== */
+
+void rl_set_src(double rate, double burst) {
+
+    pthread_mutex_lock(&rl_lock);
+    config.src_rate = rate;
+    config.src_burst = burst;
+    for (int i = 0; i < RL_MAX_IDS; i++)
+        tb_init(&src_tb[i], rate, burst);
+    pthread_mutex_unlock(&rl_lock);
+}
+
+void rl_set_neigh(double rate, double burst) {
+
+    pthread_mutex_lock(&rl_lock);
+    config.neigh_rate = rate;
+    config.neigh_burst = burst;
+    for (int i = 0; i < RL_MAX_IDS; i++)
+        tb_init(&neigh_tb[i], rate, burst);
+    pthread_mutex_unlock(&rl_lock);
+}
+
+void rl_disable() {
+    rl_set_src(0, 0);
+    rl_set_neigh(0, 0);
+}
+
+void rl_get_config(rl_config_t *cfg) {
+    pthread_mutex_lock(&rl_lock);
+    *cfg = config;
+    pthread_mutex_unlock(&rl_lock);
+}
+
+// Parse "ratelimit src|neigh <pps> [burst]" or "ratelimit off",
+// return 0 on syntax error
+int rl_command(const char *cmd) {
+
+    char temp[16], which[16];
+    double rate = 0, burst = 0;
+    int n = sscanf(cmd, "%15s%15s%lf%lf", temp, which, &rate, &burst);
+    if (n == 2 && !strcmp(which, "off"))
+        rl_disable();
+    else if (n >= 3 && rate >= 0 && !strcmp(which, "src"))
+        rl_set_src(rate, n == 4 ? burst : rate);
+    else if (n >= 3 && rate >= 0 && !strcmp(which, "neigh"))
+        rl_set_neigh(rate, n == 4 ? burst : rate);
+    else
+        return 0;
+    return 1;
+}
+
+// Packets go through the egress scheduler as soon as a limit is set
+int rl_enabled() {
+    return config.src_rate > 0 || config.neigh_rate > 0;
+}
+
+/* ==================================================================== */
+/* ======================== INGRESS POLICING ========================== */
+/* ==================================================================== */
+
+// Per-source token bucket, return 0 if the packet must be dropped
+int rl_admit(node_id_t src) {
+
+    struct timespec now;
+    int ok;
+
+    if (config.src_rate <= 0)
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&rl_lock);
+    ok = tb_take(&src_tb[src], &now);
+    pthread_mutex_unlock(&rl_lock);
+    if (!ok) {
+        __atomic_add_fetch(&rl_src_drops[src], 1, __ATOMIC_RELAXED);
+        STAT_INC(rl_src_drop);
+    }
+    return ok;
+}
+
+/* ==================================================================== */
+/* =================== EGRESS DEFICIT ROUND ROBIN ===================== */
+/* ==================================================================== */
+
+static void init_slots() {
+    for (int i = 0; i < RL_QUEUE_SLOTS; i++)
+        slots[i].next = i + 1 < RL_QUEUE_SLOTS ? i + 1 : -1;
+    free_slots = 0;
+    for (int i = 0; i < RL_MAX_IDS; i++)
+        flows[i].head = flows[i].tail = -1;
+    slots_init = 1;
+}
+
+// Queue a DATA packet to be forwarded, return 0 if it is dropped
+int rl_enqueue(const char *packet, int psize) {
+
+    node_id_t src = ((const packet_data_t *) packet) -> src_id;
+    rl_flow_t *f = &flows[src];
+
+    if (!slots_init)
+        init_slots();
+    if (free_slots < 0 || f -> count >= RL_QUEUE_PER_SRC) {
+        STAT_INC(rl_queue_drop);
+        return 0;
+    }
+    short s = free_slots;
+    free_slots = slots[s].next;
+    memcpy(slots[s].data, packet, psize);
+    slots[s].size = psize;
+    slots[s].next = -1;
+    slots[s].held = 0;
+
+    if (f -> count == 0) {      // new backlogged source
+        f -> head = s;
+        f -> deficit = 0;
+        f -> blocked = 0;
+        active[(act_head + act_count) % RL_MAX_IDS] = src;
+        act_count++;
+    } else {
+        slots[f -> tail].next = s;
+    }
+    f -> tail = s;
+    f -> count++;
+    return 1;
+}
+
+int rl_pending() {
+    return act_count > 0;
+}
+
+// Serve the backlogged sources in DRR order.
+// Return the time (ms) to wait before a blocked packet can be sent,
+// or -1 if the queues are empty.
+int rl_schedule(routing_table_t *rt) {
+
+    struct timespec now;
+    int blocked = 0;            // consecutive blocked sources
+    int wait = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&rl_lock);
+    while (act_count > 0 && blocked < act_count) {
+        node_id_t src = active[act_head];
+        rl_flow_t *f = &flows[src];
+
+        if (!f -> blocked)
+            f -> deficit += RL_QUANTUM;
+        f -> blocked = 0;
+        while (f -> count > 0 && slots[f -> head].size <= f -> deficit) {
+            rl_slot_t *s = &slots[f -> head];
+            packet_data_t *p = (packet_data_t *) s -> data;
+            int nh = rt -> fib[p -> dst_id];
+
+            if (nh != FIB_NONE && !tb_take(&neigh_tb[nh], &now)) {
+                int w = tb_wait_ms(&neigh_tb[nh]);
+                if (wait < 0 || w < wait)
+                    wait = w;
+                if (!s -> held)         // once per packet, not per visit
+                    STAT_INC(rl_neigh_delay);
+                s -> held = 1;
+                f -> blocked = 1;
+                break;
+            }
+            if (forward_packet(p, s -> size, rt))
+                STAT_INC(fwd);
+            else
+                STAT_INC(no_route);
+            f -> deficit -= s -> size;
+            // release slot
+            short next = s -> next;
+            s -> next = free_slots;
+            free_slots = f -> head;
+            f -> head = next;
+            f -> count--;
+        }
+        act_head = (act_head + 1) % RL_MAX_IDS;
+        if (f -> count == 0) {  // source no longer backlogged
+            f -> head = f -> tail = -1;
+            f -> deficit = 0;
+            act_count--;
+            blocked = 0;
+        } else {                // move it to the end of the round
+            active[(act_head + act_count - 1) % RL_MAX_IDS] = src;
+            blocked = f -> blocked ? blocked + 1 : 0;
+        }
+    }
+    pthread_mutex_unlock(&rl_lock);
+    if (act_count == 0)
+        return -1;
+    return wait < 1 ? 1 : wait;
+}
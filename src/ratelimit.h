@@ -0,0 +1,47 @@
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <time.h>
+#include "router.h"
+
+#define RL_MAX_IDS 256          // one bucket/queue per possible node id
+#define RL_QUEUE_SLOTS 256      // packets waiting in the egress scheduler (all sources)
+#define RL_QUEUE_PER_SRC 32     // max packets queued for one source
+#define RL_QUANTUM BUF_SIZE     // DRR quantum (bytes), >= any packet size
+#define RL_RX_BATCH 32          // max packets read before serving the queues
+
+// Token bucket (rate in packets/s, burst in packets)
+typedef struct {
+    double rate;                // 0 => unlimited
+    double burst;
+    double tokens;
+    struct timespec last;       // last refill
+} token_bucket_t;
+
+// Rate limiter configuration
+typedef struct {
+    double src_rate;            // per-source bucket (packets/s), 0 => off
+    double src_burst;
+    double neigh_rate;          // per-egress-neighbor bucket (packets/s), 0 => off
+    double neigh_burst;
+} rl_config_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+extern unsigned long rl_src_drops[RL_MAX_IDS];   // packets policed, per source (atomic updates)
+/* ============================= */
+
+/* ==================================================================== */
+void rl_set_src(double rate, double burst);
+void rl_set_neigh(double rate, double burst);
+void rl_disable();
+void rl_get_config(rl_config_t *cfg);
+int rl_command(const char *cmd);
+int rl_enabled();
+
+int rl_admit(node_id_t src);
+int rl_enqueue(const char *packet, int psize);
+int rl_pending();
+int rl_schedule(routing_table_t *rt);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "reliable.h"
+#include "capture.h"
+#include "netem.h"
+#include "sockio.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+int rel_enabled = 0;
+static rel_peer_t peers[MAX_ROUTES];    // updated under the router lock
+/* ============================= */
+
+/* ==================================================================== */
+/* ============================== SENDER ============================== */
+/* ==================================================================== */
+
+double rel_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+static rel_peer_t *peer(node_id_t id) {
+    rel_peer_t *p = &peers[id];
+    if (p -> rto == 0) {            // first use
+        p -> srtt = -1;
+        p -> rto = REL_RTO_INIT;
+    }
+    return p;
+}
+
+// Append a trailer with a new sequence number to the DV of 'size' bytes in
+// 'buf' (room for a rel_trailer_t after it) sent to 'neigh', return the new size.
+// The DV is pending until acknowledged.
+int rel_stamp(char *buf, int size, node_id_t neigh) {
+    rel_peer_t *p = peer(neigh);
+    rel_trailer_t t = {REL_MAGIC, 0, ++p -> seq};
+    memcpy(buf + size, &t, sizeof(t));
+    p -> pending = 1;
+    p -> sent = rel_now();
+    p -> deadline = p -> sent + p -> rto;
+    p -> tx++;
+    return size + sizeof(t);
+}
+
+// ACK received from 'neigh': RTT sample and new RTO (RFC 6298 2.2, 2.3).
+// Every transmission has its own sequence number, so retransmitted DVs
+// give valid samples too.
+void rel_ack(node_id_t neigh, unsigned short seq) {
+    rel_peer_t *p = peer(neigh);
+    if (!p -> pending || seq != p -> seq)
+        return;                     // late ACK of a superseded DV
+    double r = rel_now() - p -> sent;
+    if (p -> srtt < 0) {
+        p -> srtt = r;
+        p -> rttvar = r / 2;
+    } else {
+        p -> rttvar = 0.75 * p -> rttvar + 0.25 * (p -> srtt > r ? p -> srtt - r : r - p -> srtt);
+        p -> srtt = 0.875 * p -> srtt + 0.125 * r;
+    }
+    p -> rto = p -> srtt + (4 * p -> rttvar > REL_CLOCK_G ? 4 * p -> rttvar : REL_CLOCK_G);
+    if (p -> rto < REL_RTO_MIN)
+        p -> rto = REL_RTO_MIN;
+    if (p -> rto > REL_RTO_MAX)
+        p -> rto = REL_RTO_MAX;
+    p -> pending = 0;
+    p -> retries = 0;
+    p -> acks++;
+}
+
+// Retransmission time of the DV pending for 'neigh' (0: none)
+double rel_deadline(node_id_t neigh) {
+    return peers[neigh].pending ? peers[neigh].deadline : 0;
+}
+
+// Return 1 if the DV sent to 'neigh' timed out and must be sent again
+// (the timer is backed off, RFC 6298 5.5), 0 otherwise
+int rel_due(node_id_t neigh, double now) {
+    rel_peer_t *p = peer(neigh);
+    if (!p -> pending || now < p -> deadline)
+        return 0;
+    p -> rto = 2 * p -> rto < REL_RTO_MAX ? 2 * p -> rto : REL_RTO_MAX;
+    if (p -> retries == REL_MAX_RETRIES) {      // neighbor down? wait for the next period
+        p -> pending = 0;
+        p -> retries = 0;
+        p -> lost++;
+        return 0;
+    }
+    p -> retries++;
+    p -> rtx++;
+    return 1;
+}
+
+/* ==================================================================== */
+/* ============================= RECEIVER ============================= */
+/* ==================================================================== */
+
+// Sequence number of a DV datagram (checked by parse_packet),
+// return 0 if it has no trailer
+int rel_find(const char *buf, int size, unsigned short *seq) {
+    const packet_ctrl_t *p = (const packet_ctrl_t *) buf;
+    rel_trailer_t t;
+    if (size < (int) (CTRL_SIZE(p -> dv_size) + sizeof(t)))
+        return 0;
+    memcpy(&t, buf + CTRL_SIZE(p -> dv_size), sizeof(t));
+    if (t.magic != REL_MAGIC)
+        return 0;
+    *seq = t.seq;
+    return 1;
+}
+
+// Acknowledge DV 'seq' of 'neigh' (called by the input thread)
+void rel_send_ack(const overlay_addr_t *neigh, unsigned short seq) {
+
+    sock_addr_t adr;
+    packet_ack_t ack = {ACK, MY_ID, seq};
+
+    node_sockaddr(neigh -> ip, neigh -> port, &adr);
+    if (io_send(iface_sock(neigh -> iface), &ack, sizeof(ack), neigh -> id, &adr) < 0)
+        return;
+    CAP_PACKET(CAP_TX, neigh -> id, &ack, sizeof(ack));
+    STAT_INC(tx_ctrl);
+    STAT_ADD(tx_ctrl_bytes, sizeof(ack));
+}
+
+/* ==================================================================== */
+/* ============================= COMMAND ============================== */
+/* ==================================================================== */
+
+void print_reliable(FILE *out, neighbors_table_t *nt) {
+
+    fprintf(out, "Reliable DVs %s.\n", rel_enabled ? "on" : "off");
+    fprintf(out, "Neigh. | Seq   | SRTT (ms) | RTO (ms) | Sent  | Retrans. | ACKs  | Lost\n");
+    pthread_mutex_lock(&cur_router -> lock);
+    for (int i = 0; i < nt -> size; i++) {
+        rel_peer_t *p = peer(nt -> tab[i].id);
+        fprintf(out, "R%-5d | %5u | ", nt -> tab[i].id, p -> seq);
+        if (p -> srtt < 0)
+            fprintf(out, "        - | ");
+        else
+            fprintf(out, "%9.2f | ", p -> srtt * 1000);
+        fprintf(out, "%8.1f | %5lu | %8lu | %5lu | %lu%s\n", p -> rto * 1000, p -> tx,
+                p -> rtx, p -> acks, p -> lost, p -> pending ? " (pending)" : "");
+    }
+    pthread_mutex_unlock(&cur_router -> lock);
+}
+
+// Parse "reliable on|off" or "reliable", return 0 on syntax error
+int reliable_command(const char *cmd, neighbors_table_t *nt, FILE *out) {
+
+    char temp[16], arg[16];
+    int n = sscanf(cmd, "%15s%15s", temp, arg);
+
+    if (n == 2 && !strcmp(arg, "on"))
+        rel_enabled = 1;
+    else if (n == 2 && !strcmp(arg, "off"))
+        rel_enabled = 0;
+    else if (n != 1)
+        return 0;
+    print_reliable(out, nt);
+    return 1;
+}
@@ -0,0 +1,53 @@
+#ifndef __RELIABLE_H__
+#define __RELIABLE_H__
+
+#include <stdio.h>
+#include "router.h"
+
+// Reliable DV delivery: each DV carries a sequence number in a trailer
+// (ignored by the routers that do not know it), the neighbor answers with
+// an ACK packet. A DV that is not acknowledged within the retransmission
+// timeout (RFC 6298, from the measured RTT) is built again and resent.
+#define REL_MAGIC 0xa5
+#define REL_RTO_INIT 1.0            // s, before the first RTT sample
+#define REL_RTO_MIN 0.05            // s (1 s in RFC 6298, too long for local links)
+#define REL_RTO_MAX 4.0             // s, < BROADCAST_PERIOD: the next DV supersedes
+#define REL_CLOCK_G 0.001           // s, clock granularity
+#define REL_MAX_RETRIES 5           // per DV
+
+// Trailer after the DV entries (CTRL_SIZE(dv_size)), unaligned
+typedef struct {
+    unsigned char magic;            // REL_MAGIC
+    unsigned char pad;
+    unsigned short seq;
+} rel_trailer_t;
+
+// Per neighbor state (indexed by node id)
+typedef struct {
+    unsigned short seq;             // last DV sent
+    int pending;                    // last DV not acknowledged yet
+    int retries;                    // retransmissions of the pending DV
+    double sent;                    // monotonic time the pending DV was sent
+    double deadline;                // retransmission time of the pending DV
+    double srtt, rttvar, rto;       // s (srtt < 0: no sample yet)
+    unsigned long tx, rtx, acks, lost;
+} rel_peer_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int rel_enabled;             // stamp our DVs and retransmit them
+/* ============================= */
+
+/* ==================================================================== */
+double rel_now();
+int rel_stamp(char *buf, int size, node_id_t neigh);
+int rel_find(const char *buf, int size, unsigned short *seq);
+void rel_send_ack(const overlay_addr_t *neigh, unsigned short seq);
+void rel_ack(node_id_t neigh, unsigned short seq);
+double rel_deadline(node_id_t neigh);
+int rel_due(node_id_t neigh, double now);
+
+void print_reliable(FILE *out, neighbors_table_t *nt);
+int reliable_command(const char *cmd, neighbors_table_t *nt, FILE *out);
+
+#endif
@@ -8,27 +8,54 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <arpa/inet.h> // inet_addr, htons
+#include <arpa/inet.h> // inet_pton, htons
+#include <net/if.h>     // if_nametoindex
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 
 #include "router.h"
 #include "console.h"
 #include "packet.h"
 #include "test_forwarding.h"
+#include "ratelimit.h"
+#include "control.h"
+#include "capture.h"
+#include "latency.h"
+#include "reliable.h"
+#include "netem.h"
+#include "shm.h"
+#include "dvsimd.h"
+#include "sockio.h"
+#include "vrouter.h"
+#include "bulk.h"
+#include "stability.h"
+#include "adaptive.h"
+#include "probes.h"
 
-#define BUF_SIZE 1024
-#define RTR_BASE_PORT 5555
-#define BROADCAST_PERIOD 10
 #define FWD_DELAY_IN_MS 10
 #define LOG_MSG_MAX_SIZE 256
-#define MAX_METRIC 16       // example for RIPv2
 
 #define SPLIT_HRZ       // if define, use the split-horizon method to broadcast the distance vector
 
-#define PORT(x) (x+RTR_BASE_PORT)
-
-static void overlay_addr_from_nt(const neighbors_table_t *nt, node_id_t id,overlay_addr_t *addr);
+static int overlay_addr_from_nt(const neighbors_table_t *nt, node_id_t id,overlay_addr_t *addr);
+static void fwd_sock_init();
+
+/* ============================= */
+/*  Shared data between threads  */
+int log_enabled = 1;
+static router_t main_router = {   // instance of a single router process
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .probe_lock = PTHREAD_MUTEX_INITIALIZER,
+    .args = {&main_router.rt, &main_router.nt, NULL},
+};
+__thread router_t *cur_router = &main_router;
+int multi_router = 0;
+int area_bits = 0;
+static int fwd_sock = -1;   // sends before the interfaces are open (see iface_sock)
+static pthread_once_t fwd_once = PTHREAD_ONCE_INIT;
+/* ============================= */
 
 /* ==================================================================== */
 /* ========================= LOG FUNCTIONS ============================ */
@@ -42,12 +69,16 @@ void logger(const char *tag, const char *message, ...) {
     char buf[256], file_name[32];
     va_list params;
 
+    if (!log_enabled)
+        return;
     time(&now);
-    strncpy(buf, ctime(&now), sizeof(buf));
+    snprintf(buf, sizeof(buf), "%s", ctime(&now));
     buf[strlen(buf)-1]='\0'; // remove new line from ctime function
 
     sprintf(file_name, "%s%d%s", "log/R", MY_ID, ".txt");
     FILE *f = fopen(file_name, "at");
+    if (f == NULL)
+        return;
 
     fprintf(f, "%s [%s]: ", buf, tag);
     va_start(params, message);
@@ -61,11 +92,19 @@ void logger(const char *tag, const char *message, ...) {
 // if output then the DV is sent to neigh, else it is received from neigh
 void log_dv(packet_ctrl_t *p, node_id_t neigh, int output) {
 
-    char buf_dv[256];
+    char buf_dv[32 + 32 * MAX_DV_SIZE];
     char buf_dve[32];
+    if (!log_enabled)
+        return;
     strcpy(buf_dv, "\t DEST | METRIC \n");
     for (int i=0; i<p->dv_size; i++) {
-        sprintf(buf_dve, "\t   %d  |  %d\n", p->dv[i].dest, p->dv[i].metric);
+        unsigned char m = p->dv[i].metric;
+        if (m & DV_DEFAULT)
+            sprintf(buf_dve, "\t   0/0  |  %d\n", DV_METRIC(m));
+        else if (m & DV_SUMMARY)
+            sprintf(buf_dve, "\t   %d/%d  |  %d\n", p->dv[i].dest, area_bits, DV_METRIC(m));
+        else
+            sprintf(buf_dve, "\t   %d  |  %d\n", p->dv[i].dest, m);
         strcat(buf_dv, buf_dve);
     }
     if (output)
@@ -78,12 +117,119 @@ void log_dv(packet_ctrl_t *p, node_id_t neigh, int output) {
 /* =============== INIT NEIGHBORS AND ROUTING TABLE =================== */
 /* ==================================================================== */
 
+// Router instance 'id' with empty tables (its thread must point cur_router to it)
+void router_init(router_t *r, int id) {
+    memset(r, 0, sizeof(*r));
+    r -> id = id;
+    r -> args.rt = &r -> rt;
+    r -> args.nt = &r -> nt;
+    pthread_mutex_init(&r -> lock, NULL);
+    pthread_mutex_init(&r -> probe_lock, NULL);
+}
+
 // Init node's overlay address
 void init_node(overlay_addr_t *addr, node_id_t id, char *ip) {
 
     addr->id = id;
     addr->port = PORT(id);
-    strcpy(addr->ipv4, ip);
+    addr->iface = 0;
+    strcpy(addr->ip, ip);
+}
+
+// Socket address of 'ip' (IPv4, or IPv6 with an optional %<device> scope)
+// and 'port', return 0 if 'ip' is not a valid address
+int node_sockaddr(const char *ip, unsigned short port, sock_addr_t *adr) {
+
+    char buf[IP_ADR_STRLEN];
+    memset(adr, 0, sizeof(*adr));
+    if (inet_pton(AF_INET, ip, &adr -> in.sin_addr) == 1) {
+        adr -> in.sin_family = AF_INET;
+        adr -> in.sin_port = htons(port);
+        return 1;
+    }
+    snprintf(buf, sizeof(buf), "%s", ip);
+    char *scope = strchr(buf, '%');
+    if (scope != NULL)
+        *scope++ = '\0';
+    if (inet_pton(AF_INET6, buf, &adr -> in6.sin6_addr) != 1
+            || (scope != NULL && (adr -> in6.sin6_scope_id = if_nametoindex(scope)) == 0))
+        return 0;
+    adr -> in6.sin6_family = AF_INET6;
+    adr -> in6.sin6_port = htons(port);
+    return 1;
+}
+
+// Address family of a valid address string ("": any IPv4 address)
+static int ip_family(const char *ip) {
+    return strchr(ip, ':') != NULL ? AF_INET6 : AF_INET;
+}
+
+// Interface of a router without 'node' line: any IPv4 address, PORT(id)
+static void default_iface(iface_t *i, int id) {
+    memset(i, 0, sizeof(*i));       // compared with memcmp (reload)
+    i -> port = PORT(id);
+}
+
+// Open the UDP socket of interface 'i', bound to its address (and device),
+// with kernel receive timestamps; return -1 on error (errno set)
+static int iface_open(const iface_t *i) {
+
+    sock_addr_t adr;
+    int sock, on = 1;
+
+    if (i -> ip[0] == '\0') {
+        memset(&adr, 0, sizeof(adr));
+        adr.in.sin_family = AF_INET;
+        adr.in.sin_port = htons(i -> port);
+        adr.in.sin_addr.s_addr = htonl(INADDR_ANY);
+    } else if (!node_sockaddr(i -> ip, i -> port, &adr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((sock = socket(adr.sa.sa_family, SOCK_DGRAM, 0)) < 0)
+        return -1;
+    if (adr.sa.sa_family == AF_INET6)
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    if ((i -> dev[0] && setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, i -> dev, strlen(i -> dev) + 1) < 0)
+            || bind(sock, &adr.sa, SOCK_ADDR_LEN(&adr)) < 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    // kernel receive timestamps (latency histograms and hop timestamps)
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    return sock;
+}
+
+// Open the sockets of the interfaces of router 'r' (the default one if it
+// has none: --test-forwarding), exit on error
+void open_ifaces(router_t *r) {
+    if (r -> nt.nb_ifaces == 0) {
+        default_iface(&r -> nt.ifaces[0], r -> id);
+        r -> nt.nb_ifaces = 1;
+    }
+    for (int i = 0; i < r -> nt.nb_ifaces; i++) {
+        iface_t *a = &r -> nt.ifaces[i];
+        if ((r -> if_sock[i] = iface_open(a)) < 0) {
+            fprintf(stderr, "R%d: bind %s port %d%s%s: %s\n", r -> id, a -> ip[0] ? a -> ip : "*",
+                    a -> port, a -> dev[0] ? " dev " : "", a -> dev, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    r -> nb_socks = r -> nt.nb_ifaces;
+}
+
+// Socket that sends through local interface 'iface': its own, so that the
+// datagrams leave from its address and device (the first one if it is not
+// open, an unbound socket before the interfaces are: benchmarks, fuzzing)
+int iface_sock(int iface) {
+    router_t *r = cur_router;
+    if (r -> nb_socks == 0) {
+        pthread_once(&fwd_once, fwd_sock_init);
+        return fwd_sock;
+    }
+    return r -> if_sock[iface < r -> nb_socks ? iface : 0];
 }
 
 // Add node to neighbor's table
@@ -91,119 +237,434 @@ void add_neighbor(neighbors_table_t *nt, const overlay_addr_t *node) {
 
     assert(nt->size < MAX_NEIGHBORS);
     nt->tab[nt->size] = *node;
+    nt->stub[nt->size] = 0;
     nt->size++;
 }
 
-// Read topo from conf file
-void read_neighbors(char *file, int rid, neighbors_table_t *nt) {
+// Index of neighbor 'id' in the neighbors table (-1 if none)
+static int neighbor_index(const neighbors_table_t *nt, node_id_t id) {
+    for (int i = 0; i < nt -> size; i++) {
+        if (nt -> tab[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+// Parse the end of a 'node' line, "<id> <address> [<port>] [dev <device>]"
+// (port PORT(id) by default), return 0 if it is invalid
+static int parse_iface(char *line, int *id, iface_t *a) {
+
+    sock_addr_t adr;
+    char *token = strtok(line, " \t");
+    memset(a, 0, sizeof(*a));       // compared with memcmp (reload)
+    *id = token != NULL ? atoi(token) : 0;
+    token = strtok(NULL, " \t");
+    if (*id <= 0 || *id >= MAX_ROUTES || token == NULL || strlen(token) >= IP_ADR_STRLEN)
+        return 0;
+    strcpy(a -> ip, token);
+    a -> port = PORT(*id);
+    while ((token = strtok(NULL, " \t")) != NULL) {
+        int port = atoi(token);
+        if (!strcmp(token, "dev") && (token = strtok(NULL, " \t")) != NULL
+                && strlen(token) < sizeof(a -> dev))
+            strcpy(a -> dev, token);
+        else if (port > 0 && port < 65536)
+            a -> port = port;
+        else
+            return 0;
+    }
+    return node_sockaddr(a -> ip, a -> port, &adr);
+}
+
+// Second pass on the topology file: our interfaces and the addresses of
+// the neighbors ('node' lines, the k-th line of a node gives its
+// interface k). Neighbor i is reached at its interface link_if[i] (its
+// first one if it has less), through our interface link_if[i] if it has
+// the same address family, or else our first one of that family (left
+// out if we have none).
+static void read_ifaces(FILE *fichier, int rid, neighbors_table_t *nt, const unsigned char *link_if) {
+
+    char ligne[TOPO_LINE_MAX];
+    unsigned char count[MAX_ROUTES] = {0};      // 'node' lines of each id
+    iface_t a;
+    int id, n = 0;
+
+    rewind(fichier);
+    nt -> nb_ifaces = 0;
+    while (fgets(ligne, sizeof(ligne), fichier) != NULL) {
+        ligne[strcspn(ligne, "\r\n")]='\0';
+        if (strncmp(ligne, "node", 4))
+            continue;
+        if (!parse_iface(ligne + 4, &id, &a)) {
+            logger("CONFIG", "invalid node line ignored");
+            continue;
+        }
+        int k = count[id]++;
+        if (k >= MAX_IFACES)
+            logger("CONFIG", "too many interfaces, %s of R%d ignored", a.ip, id);
+        else if (id == rid)
+            nt -> ifaces[nt -> nb_ifaces++] = a;
+        for (int i = 0; k < MAX_IFACES && id != rid && i < nt -> size; i++) {
+            if (nt -> tab[i].id == id && (k == 0 || k == link_if[i])) {
+                strcpy(nt -> tab[i].ip, a.ip);
+                nt -> tab[i].port = a.port;
+            }
+        }
+    }
+    if (nt -> nb_ifaces == 0) {
+        default_iface(&nt -> ifaces[0], rid);
+        nt -> nb_ifaces = 1;
+    }
+    for (int i = 0; i < nt -> size; i++) {
+        int family = ip_family(nt -> tab[i].ip), k = link_if[i];
+        if (k >= nt -> nb_ifaces || ip_family(nt -> ifaces[k].ip) != family) {
+            for (k = 0; k < nt -> nb_ifaces && ip_family(nt -> ifaces[k].ip) != family; k++)
+                ;
+        }
+        if (k == nt -> nb_ifaces) {
+            logger("CONFIG", "no IPv%d interface to reach R%d, neighbor ignored",
+                   family == AF_INET6 ? 6 : 4, nt -> tab[i].id);
+            n++;
+            continue;
+        }
+        nt -> tab[i].iface = k;
+        nt -> tab[i - n] = nt -> tab[i];
+    }
+    nt -> size -= n;
+}
+
+// Read topo from conf file, return 0 if the file cannot be opened.
+// Besides the "RID Nb1 Nb2 ..." lines (a neighbor 'id@k' is reached on
+// the interfaces k of both routers, see read_ifaces), the file may hold:
+//   node <id> <address> [<port>] [dev <device>]
+//                      an interface of a router: IPv4 or IPv6 address
+//                      (127.0.0.1 and PORT(id) without 'node' line)
+//   areabits <n>       the n high bits of a node id give its area
+//   stub <id> ...      routers that only need a default route
+//   reliable           DVs are acknowledged and retransmitted
+//   netem <file>       emulate the links with the parameters of <file>
+//   shm                shared memory links with the co-located neighbors
+//   poison             poison reverse (see stability.h)
+//   holddown [<s>]     hold-down of the lost routes (STAB_HOLDDOWN s)
+//   damping [<s>]      route flap damping, penalty half-life (STAB_HALF_LIFE s)
+//   adaptive [<min> [<max>]]  adaptive DV interval (ADAPT_MIN..ADAPT_MAX s)
+int parse_neighbors(const char *file, int rid, neighbors_table_t *nt) {
 
     FILE *fichier = NULL;
-    char ligne[80];
-    int id = 0;
+    char ligne[TOPO_LINE_MAX];
+    int id = 0, k, found = 0;
+    unsigned char stubs[MAX_ROUTES] = {0};
+    unsigned char link_if[MAX_NEIGHBORS];       // interface of each link ('@k')
     overlay_addr_t node;
     char *token;
 
+    nt -> size = 0;
+    nt -> area_bits = 0;
+    nt -> reliable = 0;
+    nt -> netem[0] = '\0';
+    nt -> shm = 0;
+    nt -> poison = 0;
+    nt -> holddown = 0;
+    nt -> half_life = 0;
+    nt -> dv_min = nt -> dv_max = 0;
    	fichier = fopen(file, "rt");
-   	if (fichier == NULL) {
-   		perror("[Config] Error opening configuration file.\n");
-   		exit(EXIT_FAILURE);
-   	}
+   	if (fichier == NULL)
+   		return 0;
 
-    while (!feof(fichier)) {
+    while (fgets(ligne, sizeof(ligne), fichier) != NULL) {
         // read line
-        fgets(ligne, sizeof(ligne), fichier);
-        ligne[strlen(ligne)-1]='\0'; // remove '\n'
+        ligne[strcspn(ligne, "\r\n")]='\0'; // remove '\n'
         // printf("%s\n", ligne);
         if (ligne[0]!='#') {
-            sscanf(ligne, "%d", &id);
-            if (id == rid) {
+            if (!strncmp(ligne, "areabits", 8)) {
+                if (sscanf(ligne + 8, "%d", &id) == 1 && id >= 0 && id < ID_BITS)
+                    nt -> area_bits = id;
+                else
+                    logger("CONFIG", "invalid line '%s' ignored", ligne);
+            }
+            else if (!strncmp(ligne, "reliable", 8)) {
+                nt -> reliable = 1;
+            }
+            else if (!strncmp(ligne, "shm", 3)) {
+                nt -> shm = 1;
+            }
+            else if (!strncmp(ligne, "poison", 6)) {
+                nt -> poison = 1;
+            }
+            else if (!strncmp(ligne, "holddown", 8)) {
+                nt -> holddown = STAB_HOLDDOWN;
+                if (sscanf(ligne + 8, "%d", &nt -> holddown) == 1 && nt -> holddown < 0)
+                    nt -> holddown = 0;
+            }
+            else if (!strncmp(ligne, "damping", 7)) {
+                nt -> half_life = STAB_HALF_LIFE;
+                if (sscanf(ligne + 7, "%d", &nt -> half_life) == 1 && nt -> half_life < 0)
+                    nt -> half_life = 0;
+            }
+            else if (!strncmp(ligne, "adaptive", 8)) {
+                nt -> dv_min = ADAPT_MIN;
+                nt -> dv_max = ADAPT_MAX;
+                int n = sscanf(ligne + 8, "%d %d", &nt -> dv_min, &nt -> dv_max);
+                if (n == 1)
+                    nt -> dv_max = nt -> dv_min > ADAPT_MAX ? nt -> dv_min : ADAPT_MAX;
+                if (nt -> dv_min < 1 || nt -> dv_max < nt -> dv_min || nt -> dv_max > ADAPT_LIMIT) {
+                    logger("CONFIG", "invalid line '%s' ignored", ligne);
+                    nt -> dv_min = nt -> dv_max = 0;
+                }
+            }
+            else if (!strncmp(ligne, "netem", 5)) {
+                if (sscanf(ligne + 5, "%127s", nt -> netem) != 1)
+                    logger("CONFIG", "invalid line '%s' ignored", ligne);
+            }
+            else if (!strncmp(ligne, "stub", 4)) {
+                token = strtok(ligne + 4, " \t");
+                while (token != NULL) {
+                    id = atoi(token);
+                    if (id > 0 && id < MAX_ROUTES)
+                        stubs[id] = 1;
+                    token = strtok(NULL, " \t");
+                }
+            }
+            else if (!found && sscanf(ligne, "%d", &id) == 1 && id == rid) {
+                found = 1;
                 // read neighbors
-                token = strtok(ligne, " ");
-                token = strtok(NULL, " "); // discard first number (rid)
+                token = strtok(ligne, " \t");
+                token = strtok(NULL, " \t"); // discard first number (rid)
                 while (token != NULL) {
                     // printf( "|%s|", token );
+                    k = 0;
                     id = atoi(token);
-                    init_node(&node, id, "127.0.0.1");
-                    add_neighbor(nt, &node);
-                    token = strtok(NULL, " ");
+                    if (strchr(token, '@') != NULL)
+                        k = atoi(strchr(token, '@') + 1);
+                    if (id <= 0 || id >= MAX_ROUTES || id == rid || neighbor_index(nt, id) >= 0
+                            || k < 0 || k >= MAX_IFACES)
+                        logger("CONFIG", "neighbor '%s' of R%d ignored", token, rid);
+                    else if (nt -> size == MAX_NEIGHBORS)
+                        logger("CONFIG", "too many neighbors, R%d ignored", id);
+                    else {
+                        init_node(&node, id, LOCALHOST);
+                        link_if[nt -> size] = k;
+                        add_neighbor(nt, &node);
+                    }
+                    token = strtok(NULL, " \t");
                 }
-                fclose(fichier);
-                return ;
             }
         }
     }
+    read_ifaces(fichier, rid, nt, link_if);
     fclose(fichier);
+    for (int i = 0; i < nt -> size; i++)
+        nt -> stub[i] = stubs[nt -> tab[i].id];
+    return 1;
 }
 
-// Add route to routing table
-void add_route(routing_table_t *rt, node_id_t dest, const overlay_addr_t *next, short metric) {
+void read_neighbors(char *file, int rid, neighbors_table_t *nt) {
+    if (!parse_neighbors(file, rid, nt)) {
+   		perror("[Config] Error opening configuration file.\n");
+   		exit(EXIT_FAILURE);
+    }
+    area_bits = nt -> area_bits;
+    stab_config(nt);
+    if (multi_router)
+        return;                 // per process features (see vrouter.h)
+    rel_enabled = nt -> reliable;
+    if (nt -> netem[0] && !netem_load(nt -> netem))
+        exit(EXIT_FAILURE);
+    if (nt -> shm && !shm_start(nt))
+        exit(EXIT_FAILURE);
+    shm_enabled = nt -> shm;
+}
+
+// DV flags of a route (see update_rt)
+static unsigned char dv_flags(const routing_table_entry_t *r) {
+    return r -> plen == 0 ? DV_DEFAULT : (r -> plen < ID_BITS ? DV_SUMMARY : 0);
+}
+
+// Copy entry 'i' to the columns read by the DV kernels (see dvsimd.h)
+static void rt_sync(routing_table_t *rt, int i) {
+    rt -> col_dest[i] = rt -> tab[i].dest;
+    rt -> col_metric[i] = rt -> tab[i].metric > MAX_METRIC ? MAX_METRIC + 1 : rt -> tab[i].metric;
+    rt -> col_nh[i] = rt -> tab[i].nexthop.id;
+    rt -> col_flags[i] = dv_flags(&rt -> tab[i]);
+}
+
+// Socket address and local interface of the next hop 'next' for the FIB
+static void fib_set_adr(routing_table_t *rt, const overlay_addr_t *next) {
+    node_sockaddr(next -> ip, next -> port, &rt -> fib_adr[next -> id]);
+    rt -> fib_if[next -> id] = next -> iface;
+}
+
+// Rebuild the FIB from tab (after a prefix route changed or a route was
+// removed or lost): prefixes by increasing length, then node routes over
+// them, the first route of a given length wins, unreachable routes are
+// left out (same result as find_route)
+static void fib_rebuild(routing_table_t *rt) {
+    signed char plen[MAX_ROUTES];
+    for (int d = 0; d < MAX_ROUTES; d++) {
+        rt -> fib[d] = FIB_NONE;
+        plen[d] = -1;
+    }
+    for (int i = 0; i < rt -> size; i++) {
+        routing_table_entry_t *r = &rt -> tab[i];
+        if (r -> plen == ID_BITS || r -> metric > MAX_METRIC)
+            continue;
+        int first = r -> dest & PREFIX_MASK(r -> plen);
+        for (int d = first; d < first + (1 << (ID_BITS - r -> plen)); d++) {
+            if (r -> plen > plen[d]) {
+                rt -> fib[d] = r -> nexthop.id;
+                plen[d] = r -> plen;
+            }
+        }
+    }
+    for (int i = 0; i < rt -> size; i++) {
+        if (rt -> tab[i].plen == ID_BITS && rt -> tab[i].metric <= MAX_METRIC)
+            rt -> fib[rt -> tab[i].dest] = rt -> tab[i].nexthop.id;
+    }
+}
+
+// Route 'i' was added, got a new next hop, or was lost or found again:
+// update the FIB
+static void fib_update(routing_table_t *rt, int i) {
+    fib_set_adr(rt, &rt -> tab[i].nexthop);
+    if (rt -> tab[i].plen == ID_BITS && rt -> tab[i].metric <= MAX_METRIC)
+        rt -> fib[rt -> tab[i].dest] = rt -> tab[i].nexthop.id;
+    else
+        fib_rebuild(rt);
+}
+
+static void append_route(routing_table_t *rt, node_id_t dest, int plen,
+                         const overlay_addr_t *next, short metric, time_t now) {
 
     assert(rt->size < MAX_ROUTES);
     rt->tab[rt->size].dest    = dest;
+    rt->tab[rt->size].plen    = plen;
     rt->tab[rt->size].nexthop = *next;
     rt->tab[rt->size].metric  = metric;
-    rt->tab[rt->size].time    = time(NULL);
+    rt->tab[rt->size].time    = now;
+    rt->tab[rt->size].hold    = 0;
+    rt->tab[rt->size].hold_metric = 0;
+    if (plen == ID_BITS)
+        rt->idx[dest] = rt->size;
+    rt_sync(rt, rt->size);
     rt->size++;
+    fib_update(rt, rt->size - 1);
+}
+
+// Add route to routing table
+void add_route(routing_table_t *rt, node_id_t dest, const overlay_addr_t *next, short metric) {
+    append_route(rt, dest, ID_BITS, next, metric, time(NULL));
+}
+
+// Add a route to the 'plen' bits prefix of 'dest' (area summary, default route)
+void add_prefix_route(routing_table_t *rt, node_id_t dest, int plen, const overlay_addr_t *next, short metric) {
+    append_route(rt, dest, plen, next, metric, time(NULL));
 }
 
 // Init routing table with one entry (myself)
 void init_routing_table(routing_table_t *rt) {
 
     overlay_addr_t me;
+    memset(rt -> idx, 0xff, sizeof(rt -> idx));     // -1: no route
+    memset(rt -> fib, 0xff, sizeof(rt -> fib));     // FIB_NONE
+    memset(rt -> damp, 0, sizeof(rt -> damp));
+    memset(rt -> nh_period, 0, sizeof(rt -> nh_period));
     init_node(&me, MY_ID, LOCALHOST);
     add_route(rt, MY_ID, &me, 0);
 }
 
+// Route to the 'plen' bits prefix 'dest' (NULL if none)
+static routing_table_entry_t *find_prefix(routing_table_t *rt, node_id_t dest, int plen) {
+    if (plen == ID_BITS)
+        return rt -> idx[dest] < 0 ? NULL : &rt -> tab[rt -> idx[dest]];
+    for (int i = 0; i < rt -> size; i++) {
+        if (rt -> tab[i].dest == dest && rt -> tab[i].plen == plen)
+            return &rt -> tab[i];
+    }
+    return NULL;
+}
+
+// Keep the entries for which 'keep' returns 1 (in order), return the number
+// of entries removed. The first entry (this router) is always kept.
+static int filter_rt(routing_table_t *rt, int (*keep)(routing_table_entry_t *, void *), void *arg) {
+    int n = 1;
+    for (int i = 1; i < rt -> size; i++) {
+        routing_table_entry_t *r = &rt -> tab[i];
+        if (!keep(r, arg)) {
+            if (r -> plen == ID_BITS)
+                rt -> idx[r -> dest] = -1;
+            continue;
+        }
+        if (n != i) {
+            rt -> tab[n] = *r;
+            rt_sync(rt, n);
+        }
+        if (rt -> tab[n].plen == ID_BITS)
+            rt -> idx[rt -> tab[n].dest] = n;
+        n++;
+    }
+    int removed = rt -> size - n;
+    rt -> size = n;
+    if (removed > 0)
+        fib_rebuild(rt);
+    return removed;
+}
+
 
 /* ========================================= */
 /* ========== FORWARD DATA PACKET ========== */
 /* ========================================= */
 
-int forward_packet(packet_data_t *packet, int psize, routing_table_t *rt) {
-    node_id_t packet_dst = packet -> dst_id;
-    routing_table_entry_t *rt_table = rt -> tab;
-
+// Find the route to 'dest' in the routing table (NULL if none):
+// longest prefix match (node route, then area summary, then default route)
+// among the reachable routes
+routing_table_entry_t *find_route(routing_table_t *rt, node_id_t dest) {
+    if (rt -> idx[dest] >= 0 && rt -> tab[rt -> idx[dest]].metric <= MAX_METRIC)
+        return &rt -> tab[rt -> idx[dest]];
+    routing_table_entry_t *best = NULL;
     for (int i = 0; i < rt -> size; i++) {
-        node_id_t tabledst = rt_table[i].dest;
-
-        if (tabledst == packet_dst) {                            // dest found in table
-            int sock_id;
-            struct sockaddr_in server_adr;
-            unsigned short int port = rt_table[i].nexthop.port;  // port next router
-            char *ip = rt_table[i].nexthop.ipv4;                 // ip@ next router
-            
-            // Create UDP socket (client)
-            sock_id = socket(AF_INET, SOCK_DGRAM, 0);
-            if ( sock_id < 0 ) {
-                perror("socket error");
-                exit(EXIT_FAILURE);
-            }
-
-            // initialize server address (next router)
-            memset(&server_adr, 0, sizeof(server_adr));
-            server_adr.sin_family = AF_INET;
-            server_adr.sin_port = htons(port); // htons: host to net byte order (short int)
-            server_adr.sin_addr.s_addr = inet_addr(ip);
-
-            /* Send packet to the server (next hop/gateway) */
-            /*-----------------------------*/
-            if ((sendto(sock_id, packet, psize, 0, (struct sockaddr *)&server_adr, sizeof(server_adr))) < 0) {
-                perror("sendto error");
-                exit(EXIT_FAILURE);
-            }
-            // printf("--> Packet sent.\n");
-
-            /* Réception de la réponse */
-            /*-------------------------*/
+        routing_table_entry_t *r = &rt -> tab[i];
+        if (((r -> dest ^ dest) & PREFIX_MASK(r -> plen)) == 0 && r -> metric <= MAX_METRIC
+                && (best == NULL || r -> plen > best -> plen)) {
+            best = r;
+            if (r -> plen == ID_BITS)
+                break;
+        }
+    }
+    return best;
+}
 
-            /* --> A COMPLETER <-- */
+// UDP socket shared by the threads that send before the interfaces are open
+static void fwd_sock_init() {
+    fwd_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fwd_sock < 0) {
+        perror("socket error");
+        exit(EXIT_FAILURE);
+    }
+}
 
-            // close the socket
-            close(sock_id);
-            return 1;  
-        } 
+// Send a packet to the next hop given by the FIB (no RIB access, the next
+// hop address is already parsed), return 0 if there is no route.
+// On the input thread the packet is queued in its send batch (sockio.h).
+int forward_packet(packet_data_t *packet, int psize, routing_table_t *rt) {
+    long t_lookup = LAT_NOW();
+    int nh = rt -> fib[packet -> dst_id];
+    long t_send = LAT_NOW();
+    LAT_STAGE(LAT_LOOKUP, t_lookup, t_send);
+    PROBE2(fib_lookup, packet -> dst_id, nh);
+
+    if (nh == FIB_NONE)
+        return 0;   // cannot find the dest in routing table
+
+    /* Send packet to the server (next hop/gateway) */
+    /*-----------------------------*/
+    if ((io_send(iface_sock(rt -> fib_if[nh]), packet, psize, nh, &rt -> fib_adr[nh])) < 0) {
+        perror("sendto error");
+        exit(EXIT_FAILURE);
     }
-    return 0;   // cannot find the dest in routing table
+    CAP_PACKET(CAP_TX, nh, packet, psize);
+    LAT_STAGE(LAT_SEND, t_send, LAT_NOW());
+    PROBE3(packet_forward, packet -> dst_id, nh, psize);
+    return 1;
 }
 /* ========================================================================= */
 /* *************************** END FORWARD PACKET ************************** */
@@ -215,65 +676,178 @@ int forward_packet(packet_data_t *packet, int psize, routing_table_t *rt) {
 /* ==================================================================== */
 
 #ifndef SPLIT_HRZ
-// Build distance vector packet
+// Build distance vector packet (default routes are not advertised)
 void build_dv_packet(packet_ctrl_t *p, routing_table_t *rt) {
     p -> type = CTRL;
     p -> src_id = MY_ID;
-    p -> dv_size = rt -> size;
+    p -> dv_size = 0;
+    p -> period = cur_router -> dv_period;      // see adaptive.h
 
     for (int i = 0; i < rt -> size; i++) {
-        p -> dv[i].dest = rt -> tab[i].dest;
-        p -> dv[i].metric = rt -> tab[i].metric;
+        if (rt -> tab[i].plen == 0)
+            continue;
+        p -> dv[p -> dv_size].dest = rt -> tab[i].dest;
+        p -> dv[p -> dv_size].metric = rt -> tab[i].metric | dv_flags(&rt -> tab[i]);
+        p -> dv_size++;
     }
 }
 #else
 // DV to prevent (partially) count to infinity problem
 // Build a DV that contains the routes that have not been learned via
-// this neighbour
-void build_dv_specific(packet_ctrl_t *p, routing_table_t *rt, node_id_t neigh) {
+// this neighbour.
+// A stub neighbor only gets a default route through us. A neighbor in
+// another area gets one summary of our area (with the metric of its
+// farthest node) instead of the routes to the nodes of our area.
+// Default routes are never advertised. With poison reverse, the routes
+// learnt from the neighbor and the unreachable ones are advertised with
+// an infinite metric instead (see stability.h).
+void build_dv_specific(packet_ctrl_t *p, routing_table_t *rt, node_id_t neigh, int stub) {
     p -> type = CTRL;
     p -> src_id = MY_ID;
-    p -> dv_size = rt -> size;
+    p -> dv_size = 0;
+    p -> period = cur_router -> dv_period;      // see adaptive.h
 
-    int den = 0;    // number of discarded entries
+    if (stub) {
+        p -> dv[0].dest = 0;
+        p -> dv[0].metric = DV_DEFAULT;
+        p -> dv_size = 1;
+        return;
+    }
+    int summarize = area_bits > 0 && AREA(neigh) != AREA(MY_ID);
+    if (!summarize) {
+        p -> dv_size = dv_filter(rt, neigh, stab_poison, p -> dv);  // SIMD split horizon
+        return;
+    }
+    int summary = -1;   // metric of our area summary (-1: none)
     // the route was learnt from router A if and only if the gateway is A
     for (int i = 0; i < rt -> size; i++) {
-        if (rt -> tab[i].nexthop.id != neigh             // this route was not learned from neigh
-                && rt -> tab[i].metric <= MAX_METRIC) {  // and its metric is less than MAX_METRIC
-            p -> dv[i - den].dest = rt -> tab[i].dest;
-            p -> dv[i - den].metric = rt -> tab[i].metric;
-        } else {                                         // route learned from neigh => discard it
-            den++;                                       // or route metric exceeded MAX_METRIC
+        routing_table_entry_t *r = &rt -> tab[i];
+        int lost = r -> nexthop.id == neigh             // route learned from neigh
+                   || r -> metric > MAX_METRIC;         // or route metric exceeded MAX_METRIC
+        if ((lost && !stab_poison) || r -> plen == 0)   // => discard it, and default route
+            continue;
+        if (summarize && r -> plen == ID_BITS && AREA(r -> dest) == AREA(MY_ID)) {
+            if (!lost && r -> metric > summary)
+                summary = r -> metric;
+            continue;
         }
+        p -> dv[p -> dv_size].dest = r -> dest;
+        p -> dv[p -> dv_size].metric = (lost ? STAB_INFINITY : r -> metric) | dv_flags(r);
+        p -> dv_size++;
+    }
+    if (summary >= 0) {
+        p -> dv[p -> dv_size].dest = AREA(MY_ID);
+        p -> dv[p -> dv_size].metric = summary | DV_SUMMARY;
+        p -> dv_size++;
     }
-    p -> dv_size -= den;
 }
 #endif
 
-// Remove old RT entries
+// Keep a route while its metric is below MAX_METRIC, or while it is held
+// down or to be poisoned (see stability.h)
+static int route_alive(routing_table_entry_t *r, void *now) {
+    return r -> metric <= MAX_METRIC || stab_keep(r, *(time_t *) now);
+}
+
+// Has route 'r' not been refreshed for the current DV interval of its next
+// hop + ROUTE_GRACE? (when the next hop goes back to a short interval, the
+// routes that its DVs no longer carry expire sooner)
+static int route_expired(const routing_table_t *rt, const routing_table_entry_t *r, time_t now) {
+    int period = rt -> nh_period[r -> nexthop.id];
+    return difftime(now, r -> time) > (period ? period : BROADCAST_PERIOD) + ROUTE_GRACE;
+}
+
+// Expired routes are lost, remove them with the other unreachable routes
+// (the first entry, 'this' router, is kept)
 void remove_obsolete_entries(routing_table_t *rt) {
-    // go through the routing table, starting after the first 
-    // entry always equal to 'this' router
-    int i = 1;
-    while (i < rt -> size - 1) {
-        int r_lifetime = difftime(time(NULL), rt -> tab[i].time);
-        if (r_lifetime > BROADCAST_PERIOD + 5 
-                || rt -> tab[i].metric > MAX_METRIC) {
-            // this will remove the entry i form the table rt when its lifetime
-            // exceeds BROADCAST_PERIOD (+ 5) or if its metric is greater than MAX_METRIC
-            memmove(rt + i, rt + i + 1, (rt -> size - i - 1) 
-                                        * sizeof(routing_table_entry_t));
-        
-            rt -> size--;
-        } else i++;     // only increment when we don't remove an entry
+    time_t now = time(NULL);
+    int lost = 0;
+    for (int i = 1; i < rt -> size; i++) {
+        routing_table_entry_t *r = &rt -> tab[i];
+        if (r -> metric <= MAX_METRIC && route_expired(rt, r, now)) {
+            STAT_INC(routes_expired);
+            PROBE2(route_expire, r -> dest, r -> nexthop.id);
+            stab_worse(rt, r, MAX_METRIC + 1, now);
+            r -> metric = MAX_METRIC + 1;
+            r -> time = now;
+            rt_sync(rt, i);
+            lost++;
+        }
     }
-    // manage the last entry
-    if (difftime(time(NULL), rt -> tab[rt -> size - 1].time) > BROADCAST_PERIOD + 5) {
-        memset(rt + rt -> size - 1, 0, sizeof(routing_table_entry_t));
-        rt -> size--;
+    if (!filter_rt(rt, route_alive, &now) && lost)
+        fib_rebuild(rt);            // lost routes kept in the table
+    if (lost)
+        adapt_changed();
+}
+
+
+// Send a distance vector to a neighbor through its interface, return 0 on
+// error (with a sequence number when the reliable DVs are enabled)
+static int send_dv(packet_ctrl_t *p, const overlay_addr_t *neigh) {
+
+    sock_addr_t server_adr;
+    char buf[sizeof(packet_ctrl_t) + sizeof(rel_trailer_t)];
+    int size = CTRL_SIZE(p -> dv_size);
+
+    // recover socket address of neighbor:
+    node_sockaddr(neigh -> ip, neigh -> port, &server_adr);
+
+    memcpy(buf, p, size);
+    if (rel_enabled)
+        size = rel_stamp(buf, size, neigh -> id);
+    if ((io_send(iface_sock(neigh -> iface), buf, size, neigh -> id, &server_adr)) < 0)
+        return 0;
+    CAP_PACKET(CAP_TX, neigh -> id, buf, size);
+    STAT_INC(tx_ctrl);
+    STAT_ADD(tx_ctrl_bytes, size);
+    log_dv(p, neigh -> id, 1);                  // log results
+    PROBE3(dv_send, neigh -> id, p -> dv_size, size);
+    return 1;
+}
+
+// Build our DV for neighbor i and send it, return 0 on error
+static int advertise(routing_table_t *rt, neighbors_table_t *nt, int i) {
+
+    packet_ctrl_t dv_packet;
+#ifdef SPLIT_HRZ
+    // build specific dist vector for node i (ignore routes learnt from i)
+    build_dv_specific(&dv_packet, rt, nt -> tab[i].id, nt -> stub[i]);
+#else
+    build_dv_packet(&dv_packet, rt);            // initialize the packet with the dist vect
+#endif
+    return send_dv(&dv_packet, &nt -> tab[i]);
+}
+
+// Periodic DVs: expire the old routes (unless 'first'), schedule the next
+// ones, then send our DV to all the neighbors, return 0 on error (called
+// with the router lock)
+int broadcast_dv(routing_table_t *rt, neighbors_table_t *nt, int first) {
+    if (!first)
+        remove_obsolete_entries(rt);
+    adapt_schedule(rel_now());
+    cur_router -> lost = 0;
+    for (int i = 0; i < nt -> size; i++) {      // go through the neighbors table
+        // Send dv packet to the neighbor
+        if (!advertise(rt, nt, i))
+            return 0;
     }
+    return 1;
 }
 
+// Triggered DVs: with poison reverse, advertise the routes lost by a DV
+// right away (at most every STAB_TRIGGER_GAP s, see stability.h)
+static void trigger_dv(routing_table_t *rt, neighbors_table_t *nt) {
+    time_t now = time(NULL);
+    if (!stab_poison || cur_router -> lost == 0 || now < cur_router -> trigger_next)
+        return;
+    logger("SERVER TH", "%d routes lost, triggered DVs", cur_router -> lost);
+    cur_router -> lost = 0;
+    cur_router -> trigger_next = now + STAB_TRIGGER_GAP;
+    for (int i = 0; i < nt -> size; i++) {
+        if (!advertise(rt, nt, i))
+            logger("ERROR", "triggered DV to R%d: %s", nt -> tab[i].id, strerror(errno));
+    }
+}
 
 // Hello thread to broadcast state to neighbors
 void *hello(void *args) {
@@ -283,49 +857,43 @@ void *hello(void *args) {
 
     routing_table_t *rt = pargs -> rt;
     neighbors_table_t *nt = pargs -> nt;
-    int sock_id;
-    struct sockaddr_in server_adr;
-    packet_ctrl_t dv_packet;
 
+    // the DVs leave through the sockets of the interfaces (iface_sock)
+    io_tx_open();               // the DVs to all the neighbors in one batch
 
-    // Create client socket (UDP)
-    sock_id = socket(AF_INET, SOCK_DGRAM, 0);
-    if ( sock_id < 0 ) {
-        perror("dv socket error");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Periodically send the distance vector to all the neighbors
+    // Periodically send the distance vector to all the neighbors (every
+    // BROADCAST_PERIOD secs, or see adaptive.h), resend the unacknowledged
+    // ones in between (reliable DVs)
     while (1) {
-#ifndef SPLIT_HRZ
-        build_dv_packet(&dv_packet, rt);                // initialize the packet with the dist vect
-#endif
-        // TODO split horizon => call build_dv_specific
-        for (int i = 0; i < nt -> size; i++) {          // go through the neighbors table
-#ifdef SPLIT_HRZ
-            // build specific dist vector for node i (ignore routes learnt from i)
-            build_dv_specific(&dv_packet, rt, nt -> tab[i].id);
-#endif
-            memset(&server_adr, 0, sizeof(server_adr)); 
-            // recover socket address of neighbor:
-            server_adr.sin_family = AF_INET;
-            server_adr.sin_port = htons(nt -> tab[i].port); 
-            server_adr.sin_addr.s_addr = inet_addr(nt -> tab[i].ipv4);
-
-            // Send dv packet to the neighbor
-            if ((sendto(sock_id, &dv_packet, sizeof(dv_packet), 0, (struct sockaddr *)&server_adr, sizeof(server_adr))) < 0) {
+        double now = rel_now();
+        pthread_mutex_lock(&cur_router -> lock);
+        if (adapt_due(now)) {
+            if (!broadcast_dv(rt, nt, cur_router -> dv_next == 0)) {
                 perror("send dist vector error");
                 logger("ERROR", "sendto %s", strerror(errno));
                 exit(EXIT_FAILURE);
             }
-            log_dv(&dv_packet, nt -> tab[i].id, 1);     // log results
+            shm_poll(nt);           // shared memory links to (re)negotiate
+        } else {
+            if (adapt_enabled())    // long intervals: expire the routes in between
+                remove_obsolete_entries(rt);
+            for (int i = 0; rel_enabled && i < nt -> size; i++) {
+                if (rel_due(nt -> tab[i].id, now) && !advertise(rt, nt, i))
+                    logger("ERROR", "DV retransmission to R%d: %s", nt -> tab[i].id, strerror(errno));
+            }
         }
-
-        // send the vector every BROADCAST_PERIOD secs
-        sleep(BROADCAST_PERIOD);
-        remove_obsolete_entries(pargs->rt);
+        io_flush();                 // errors are logged by io_flush
+        double wake = cur_router -> dv_next;
+        if (adapt_enabled() && wake > now + ADAPT_TICK)
+            wake = now + ADAPT_TICK;    // the next DVs may be brought forward
+        for (int i = 0; rel_enabled && i < nt -> size; i++) {
+            double deadline = rel_deadline(nt -> tab[i].id);
+            if (deadline > 0 && deadline < wake)
+                wake = deadline;
+        }
+        pthread_mutex_unlock(&cur_router -> lock);
+        poll(NULL, 0, (int) ((wake - rel_now()) * 1000) + 1);
     }
-    close(sock_id);     // close the socket
 }
 
 
@@ -333,138 +901,408 @@ void *hello(void *args) {
 /* ======================== UDP SERVER THREAD ========================= */
 /* ==================================================================== */
 
-// Update routing table from received distance vector
-int update_rt(routing_table_t *rt, overlay_addr_t *src, dv_entry_t *dv, int dv_size) {
+// Mark the route to 'dest'/'plen' as changed, return 1 if it was not yet
+static int mark_dirty(rt_dirty_t *dirty, node_id_t dest, int plen) {
+    unsigned long *bits = plen == ID_BITS ? dirty -> host : dirty -> prefix;
+    if (RT_DIRTY_TEST(bits, dest))
+        return 0;
+    bits[dest / 64] |= 1UL << (dest % 64);
+    dirty -> count++;
+    return 1;
+}
+
+// Update routing table from received distance vector, in one pass: the
+// node routes are found through rt -> idx, the clock is read at most once.
+// 'period' is the DV interval of 'src' (0: unchanged), which sets the
+// lifetime of all the routes learned from it (see route_expired).
+// Return the number of routes added or changed (metric or next hop),
+// also marked in 'dirty' if not NULL (not cleared first).
+int update_rt(routing_table_t *rt, const overlay_addr_t *src, const dv_entry_t *dv, int dv_size,
+              int period, rt_dirty_t *dirty) {
+    time_t now = 0;                                     // read on first use
+    rt_dirty_t local;
+    int changed = 0;
+
+    if (period > 0)
+        rt -> nh_period[src -> id] = period;
+    if (dirty == NULL) {
+        memset(&local, 0, sizeof(local));
+        dirty = &local;
+    }
     for (int i = 0; i < dv_size; i++) {
         dv_entry_t dve = dv[i];
-        for (int j = 0; j < rt -> size; j++) {
-            if (dve.dest == rt -> tab[j].dest) {    // route already in table
-                if (rt -> tab[j].metric > dve.metric + 1
-                        || rt -> tab[j].nexthop.id == src -> id) {
-                    rt -> tab[j].metric     = dve.metric + 1;   // update metric
-                    rt -> tab[j].nexthop    = *src;             // update gateway
-                    rt -> tab[j].time       = time(NULL);       // refresh route lifetime
+        int plen = ID_BITS;
+        if (dve.metric & DV_DEFAULT) {
+            plen = 0;
+            dve.dest = 0;
+        } else if (dve.metric & DV_SUMMARY) {
+            // no areas, or summary of our own area (we know its nodes)
+            if (area_bits == 0 || AREA(dve.dest) == AREA(MY_ID))
+                continue;
+            plen = area_bits;
+            dve.dest = AREA(dve.dest);
+        }
+        int metric = DV_METRIC(dve.metric) + 1;
+        if (metric > MAX_METRIC)
+            metric = MAX_METRIC + 1;                    // unreachable
+        routing_table_entry_t *r = find_prefix(rt, dve.dest, plen);
+        if (r != NULL) {                                // route already in table
+            int old = r -> metric;
+            if (r -> nexthop.id == src -> id) {
+                if (old > MAX_METRIC && (metric > MAX_METRIC    // still lost: lifetime not refreshed
+                        || !stab_accept(rt, r, dve.dest, plen, metric, now ? now : (now = time(NULL)))))
+                    continue;
+                r -> time = now ? now : (now = time(NULL));     // refresh route lifetime
+                if (old == metric)
+                    continue;
+                if (metric > old)                       // hold-down, flap damping
+                    stab_worse(rt, r, metric, now);
+                r -> metric = metric;                   // update metric
+                if ((old > MAX_METRIC) != (metric > MAX_METRIC))
+                    fib_update(rt, r - rt -> tab);      // route lost or found again
+            } else if (old > metric
+                       && stab_accept(rt, r, dve.dest, plen, metric, now ? now : (now = time(NULL)))) {
+                r -> nexthop = *src;                    // update gateway
+                r -> time = now;
+                r -> metric = metric;
+                fib_update(rt, r - rt -> tab);
+            } else
+                continue;
+            rt_sync(rt, r - rt -> tab);
+            changed += mark_dirty(dirty, dve.dest, plen);
+        }
+        // if the route is not already in the table (ignore unreachable and
+        // suppressed routes)
+        else if (metric <= MAX_METRIC
+                 && stab_accept(rt, NULL, dve.dest, plen, metric, now ? now : (now = time(NULL)))) {
+            if (rt -> size < MAX_ROUTES) {
+                append_route(rt, dve.dest, plen, src, metric, now);
+                changed += mark_dirty(dirty, dve.dest, plen);
+            } else
+                logger("SERVER TH", "routing table full, route to R%d/%d ignored", dve.dest, plen);
+        }
+    }
+    return changed;
+}
+
+// Process one datagram received by the server thread
+void handle_packet(char *buffer_in, int size, struct th_args *pargs) {
+
+    long t_read = LAT_NOW();
+    LAT_STAGE(LAT_RECV, lat_rx_ns, t_read);
+    PROBE2(packet_rx, size, lat_rx_ns);
+    int type = parse_packet(buffer_in, size);
+    PROBE2(packet_classify, type, size);
+    if (type < 0) {     // drop malformed packets
+        STAT_INC(rx_malformed);
+        logger("SERVER TH","malformed packet dropped (%s, %d bytes)", packet_strerror(type), size);
+        return;
+    }
+
+    switch (type) {
+
+        case DATA:
+            STAT_INC(rx_data);
+            logger("SERVER TH","DATA packet received");
+            packet_data_t *pdata = (packet_data_t *) buffer_in;
+            if (!rl_admit(pdata -> src_id)) {   // source exceeded its rate
+                logger("SERVER TH","DATA packet from R%d dropped (rate limit)", pdata -> src_id);
+                break;
+            }
+            if (pdata->dst_id == MY_ID) {
+                switch (pdata->subtype) {
+                    case ECHO_REQUEST:
+                        send_ping_reply(pdata, size, pargs->rt);
+                        break;
+                    case ECHO_REPLY:
+                        if (!ctl_reply(buffer_in, size))    // not a control socket probe
+                            print_ping_reply(pdata, size);
+                        break;
+                    case TR_REQUEST:
+                        send_traceroute_reply(pdata, size, pargs->rt);
+                        break;
+                    case TR_TIME_EXCEEDED:
+                        if (!ctl_reply(buffer_in, size))
+                            print_traceroute_path(pdata, size);
+                        break;
+                    case TR_ARRIVED:
+                        if (!ctl_reply(buffer_in, size))
+                            print_traceroute_last(pdata, size);
+                        break;
+                    case BULK_DATA:
+                        bulk_receive(pdata);
+                        break;
+                    case BULK_END:
+                        bulk_end(pdata, pargs -> rt);
+                        break;
+                    case BULK_REPORT:
+                        if (!ctl_reply(buffer_in, size))
+                            print_bulk_reply(pdata);
+                        break;
+                    default:
+                        logger("SERVER TH","unidentified data packet received");
                 }
-                goto dst_found;
             }
-        }
-        // if the route is not already in the table
-        add_route(rt, dve.dest, src, dve.metric + 1);
-        dst_found:;
+            else {      // this router is not the packet destination => forward packet
+                if (pdata -> ttl <= 1) {        // null ttl
+                    STAT_INC(ttl_expired);
+                    PROBE2(ttl_expired, pdata -> src_id, pdata -> dst_id);
+                    send_time_exceeded(pdata, size, pargs -> rt);
+                } else {                        // non-zero ttl => forward packet
+                    pdata -> ttl--;
+                    size = hopts_append(buffer_in, size, lat_rx_ns);
+                    long t_fwd = LAT_NOW();
+                    LAT_STAGE(LAT_CLASSIFY, t_read, t_fwd);
+                    if (rl_enabled())           // through the fair scheduler
+                        rl_enqueue(buffer_in, size);
+                    else if (forward_packet(pdata, size, pargs -> rt)) {
+                        STAT_INC(fwd);
+                        LAT_STAGE(LAT_TOTAL, lat_rx_ns, LAT_NOW());
+                    } else
+                        STAT_INC(no_route);
+                }
+            }
+            break;
+
+        case CTRL:
+            STAT_INC(rx_ctrl);
+            logger("SERVER TH","CTRL packet received");
+            packet_ctrl_t *pctrl = (packet_ctrl_t *) buffer_in;
+            log_dv(pctrl, pctrl -> src_id, 0);
+            PROBE3(dv_recv, pctrl -> src_id, pctrl -> dv_size, pctrl -> period);
+            overlay_addr_t src;
+            if (!overlay_addr_from_nt(pargs -> nt, pctrl -> src_id, &src)) {
+                STAT_INC(rx_malformed);
+                logger("SERVER TH","DV from R%d dropped (not a neighbor)", pctrl -> src_id);
+                break;
+            }
+            /* other way to do it:
+            
+            src.port = (unsigned short) ntohs(neigh_adr.sin_port);
+            strcpy(src.ip, inet_ntoa((struct in_addr) {neigh_adr.sin_addr.s_addr}));
+            src.id = pctrl -> src_id; */
+            
+            int changed = update_rt(pargs -> rt, &src, pctrl -> dv, pctrl -> dv_size,
+                                    pctrl -> period, NULL);
+            PROBE3(dv_merge, src.id, pctrl -> dv_size, changed);
+            if (changed) {
+                STAT_ADD(routes_changed, changed);
+                logger("SERVER TH", "%d routes changed by the DV of R%d", changed, src.id);
+                adapt_changed();
+                trigger_dv(pargs -> rt, pargs -> nt);
+            }
+            unsigned short seq;
+            if (rel_find(buffer_in, size, &seq))    // reliable DV => acknowledge it
+                rel_send_ack(&src, seq);
+            break;
+
+        case ACK:
+            STAT_INC(rx_ctrl);
+            packet_ack_t *pack = (packet_ack_t *) buffer_in;
+            if (neighbor_index(pargs -> nt, pack -> src_id) < 0) {
+                STAT_INC(rx_malformed);
+                logger("SERVER TH","ACK from R%d dropped (not a neighbor)", pack -> src_id);
+                break;
+            }
+            rel_ack(pack -> src_id, pack -> seq);
+            break;
     }
-    return 1;
 }
 
-// Server thread waiting for input packets
+// Server thread waiting for input packets on the sockets of the
+// interfaces (open_ifaces)
 void *process_input_packets(void *args) {
 
-    int sock;
-    struct sockaddr_in my_adr, neigh_adr;
-    socklen_t adr_len = sizeof(struct sockaddr_in);
-    char buffer_in[BUF_SIZE];
+    io_pkt_t pkt;               // packets are cast in place (aligned buffers)
     /* Cast the pointer to the right type */
     struct th_args *pargs = (struct th_args *) args;
 
-    // routing_table_t *rt = (routing_table_t *) arg;
-    int port = PORT(MY_ID);
-    int size = 0;
-
-    /* Create (server) socket */
-    /* ---------------------- */
-    if ( (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
-        perror("socket error");
+    if (!io_rx_open(cur_router -> if_sock, cur_router -> nb_socks)) {
+        logger("ERROR", "io_uring for the input: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
-
-    /* Bind address and port */
-    /*-----------------------*/
-    /* Init server adr  */
-    memset(&my_adr, 0, sizeof(my_adr));
-    my_adr.sin_family = AF_INET;
-    my_adr.sin_port = htons(port);
-    my_adr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-    if (bind(sock, (struct sockaddr *) &my_adr, sizeof(my_adr)) < 0) {
-        perror("bind error");
-        close(sock);
-        exit(EXIT_FAILURE);
-    }
-
-    logger("SERVER TH","waiting for incoming messages");
+    io_tx_open();               // forwarded packets and ACKs sent in batches
+    logger("SERVER TH","waiting for incoming messages on %d interfaces (%s I/O)",
+           cur_router -> nb_socks, io_backend_name(io_backend));
+    int batch = 0;      // packets read since the egress queues were last served
     while (1) {
 
-        if ((size = recvfrom(sock, buffer_in, BUF_SIZE, 0, (struct sockaddr *)&neigh_adr, &adr_len)) < 0 ) {
+        int dontwait = 0;
+        if (rl_pending()) {
+            if (batch < RL_RX_BATCH) {
+                dontwait = 1;           // keep filling the queues while input is available
+            } else {
+                pthread_mutex_lock(&cur_router -> lock);
+                rl_schedule(pargs -> rt);
+                pthread_mutex_unlock(&cur_router -> lock);
+                batch = 0;
+                continue;
+            }
+        }
+        int got = io_recv(&pkt, dontwait);
+        if (got == 0) {
+            // input drained => serve the queues, then wait for a token or a new packet
+            pthread_mutex_lock(&cur_router -> lock);
+            int wait = rl_schedule(pargs -> rt);
+            pthread_mutex_unlock(&cur_router -> lock);
+            batch = 0;
+            if (wait > 0)
+                io_wait(wait);
+            continue;
+        }
+        if (got < 0) {
             perror("recvfrom error");
             logger("ERROR", "rcvfrom %s", strerror(errno));
             exit(EXIT_FAILURE);
         }
-
-        switch (buffer_in[0]) {
-
-            case DATA:
-                logger("SERVER TH","DATA packet received");
-                packet_data_t *pdata = (packet_data_t *) buffer_in;
-                if (pdata->dst_id == MY_ID) {
-                    switch (pdata->subtype) {
-                        case ECHO_REQUEST:
-                            send_ping_reply(pdata, pargs->rt);
-                            break;
-                        case ECHO_REPLY:
-                            print_ping_reply(pdata);
-                            break;
-                        case TR_REQUEST:
-                            send_traceroute_reply(pdata, pargs->rt);
-                            break;
-                        case TR_TIME_EXCEEDED:
-                            print_traceroute_path(pdata);
-                            break;
-                        case TR_ARRIVED:
-                            print_traceroute_last(pdata);
-                            break;
-                        default:
-                            logger("SERVER TH","unidentified data packet received");
-                    }
-                }
-                else {      // this router is not the packet destination => forward packet
-                    if (--pdata -> ttl == 0) {      // null ttl
-                        send_time_exceeded(pdata, pargs -> rt);
-                    } else {                        // non-zero ttl => forward packet
-                        forward_packet(pdata, size, pargs -> rt);
-                    }
-                }
-                break;
-
-            case CTRL:
-                logger("SERVER TH","CTRL packet received");
-                packet_ctrl_t *pctrl = (packet_ctrl_t *) buffer_in;
-                log_dv(pctrl, pctrl -> src_id, 0);
-                overlay_addr_t src;
-                overlay_addr_from_nt(pargs -> nt, pctrl -> src_id, &src);
-                /* other way to do it:
-                
-                src.port = (unsigned short) ntohs(neigh_adr.sin_port);
-                strcpy(src.ipv4, inet_ntoa((struct in_addr) {neigh_adr.sin_addr.s_addr}));
-                src.id = pctrl -> src_id; */
-                
-                update_rt(pargs -> rt, &src, pctrl -> dv, pctrl -> dv_size);
-                break;
-
-            default:
-                // drop
-                logger("SERVER TH","unidentified packet received.");
-                break;
-        }
+        batch++;
+        lat_rx_ns = pkt.ts;
+        CAP_PACKET(CAP_RX, 0, pkt.buf, pkt.size);
+        pthread_mutex_lock(&cur_router -> lock);
+        handle_packet(pkt.buf, pkt.size, pargs);
+        pthread_mutex_unlock(&cur_router -> lock);
     }
 }
 
 // recover overlay address of a node of id 'id' from a neighbor table
-static void overlay_addr_from_nt(const neighbors_table_t *nt, node_id_t id,overlay_addr_t *addr) {
+// return 0 if 'id' is not a neighbor
+static int overlay_addr_from_nt(const neighbors_table_t *nt, node_id_t id,overlay_addr_t *addr) {
     addr -> id = id;
     for (int i = 0; i < nt -> size; i++) {
         if (nt -> tab[i].id == id) {
-            addr -> port = nt -> tab[i].port;
-            strcpy(addr -> ipv4, nt -> tab[i].ipv4);
-            return;
+            *addr = nt -> tab[i];       // address and local interface
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/* ==================================================================== */
+/* ========================= NEIGHBORS RELOAD ========================= */
+/* ==================================================================== */
+
+struct withdraw_args {
+    node_id_t neigh;
+    packet_ctrl_t *withdrawn;
+};
+
+// Drop a route through the removed neighbor, add its destination
+// to the withdrawn DV
+static int route_kept(routing_table_entry_t *r, void *arg) {
+    struct withdraw_args *w = arg;
+    if (r -> nexthop.id != w -> neigh)
+        return 1;
+    w -> withdrawn -> dv[w -> withdrawn -> dv_size].dest = r -> dest;
+    w -> withdrawn -> dv[w -> withdrawn -> dv_size].metric = MAX_METRIC | dv_flags(r);
+    w -> withdrawn -> dv_size++;
+    return 0;
+}
+
+// Remove the routes through 'neigh' and add their destinations to the
+// 'withdrawn' DV with an infinite metric
+static int withdraw_routes(routing_table_t *rt, node_id_t neigh, packet_ctrl_t *withdrawn) {
+    struct withdraw_args w = {neigh, withdrawn};
+    return filter_rt(rt, route_kept, &w);
+}
+
+// Read the topology file again and apply the neighbors changes:
+// routes through the removed neighbors are withdrawn (and advertised as
+// unreachable), the new neighbors get our DV right away. Our interfaces
+// keep the sockets opened at startup.
+// Return 0 if the file cannot be read (nothing changed).
+int reload_neighbors(struct th_args *pargs, FILE *out) {
+
+    routing_table_t *rt = pargs -> rt;
+    neighbors_table_t *nt = pargs -> nt;
+    neighbors_table_t new_nt;
+    packet_ctrl_t withdrawn, dv_packet;
+    int added[MAX_NEIGHBORS] = {0};         // indexed as new_nt
+    int nb_added = 0, nb_removed = 0, nb_changed = 0, nb_routes = 0;
+
+    if (pargs -> topo == NULL || !parse_neighbors(pargs -> topo, MY_ID, &new_nt)) {
+        fprintf(out, "--> Cannot read the topology file.\n");
+        return 0;
+    }
+    withdrawn.type = CTRL;
+    withdrawn.src_id = MY_ID;
+    withdrawn.dv_size = 0;
+    withdrawn.period = cur_router -> dv_period;
+
+    pthread_mutex_lock(&cur_router -> lock);
+    for (int i = 0; i < nt -> size; i++) {
+        if (neighbor_index(&new_nt, nt -> tab[i].id) < 0) {
+            nb_removed++;
+            nb_routes += withdraw_routes(rt, nt -> tab[i].id, &withdrawn);
+        }
+    }
+    for (int i = 0; i < new_nt.size; i++) {
+        overlay_addr_t *neigh = &new_nt.tab[i];
+        int j = neighbor_index(nt, neigh -> id);
+        if (j < 0) {
+            added[i] = 1;
+            nb_added++;
+        } else if (nt -> tab[j].port != neigh -> port || strcmp(nt -> tab[j].ip, neigh -> ip)
+                   || nt -> tab[j].iface != neigh -> iface) {
+            nb_changed++;           // new address: update the routes through it
+            for (int k = 0; k < rt -> size; k++) {
+                if (rt -> tab[k].nexthop.id == neigh -> id)
+                    rt -> tab[k].nexthop = *neigh;      // same id: columns and fib unchanged
+            }
+            fib_set_adr(rt, neigh);
+        }
+    }
+    if (new_nt.nb_ifaces != nt -> nb_ifaces
+            || memcmp(new_nt.ifaces, nt -> ifaces, nt -> nb_ifaces * sizeof(iface_t)))
+        fprintf(out, "--> Interfaces changed, restart the router to bind them.\n");
+    *nt = new_nt;
+    area_bits = nt -> area_bits;
+    stab_config(nt);
+    if (nb_added + nb_removed + nb_changed > 0)
+        adapt_changed();
+    if (!multi_router) {
+        rel_enabled = nt -> reliable;
+        if (nt -> netem[0] && !netem_load(nt -> netem))
+            fprintf(out, "--> Cannot load %s, links emulation unchanged.\n", nt -> netem);
+        if (nt -> shm && !shm_start(nt))
+            fprintf(out, "--> Cannot open the shared memory links.\n");
+        shm_enabled = nt -> shm && shm_efd >= 0;
+    }
+
+#ifndef SPLIT_HRZ
+    build_dv_packet(&dv_packet, rt);
+#endif
+    for (int i = 0; i < nt -> size; i++) {
+        if (withdrawn.dv_size > 0)
+            send_dv(&withdrawn, &nt -> tab[i]);
+        if (added[i]) {
+#ifdef SPLIT_HRZ
+            build_dv_specific(&dv_packet, rt, nt -> tab[i].id, nt -> stub[i]);
+#endif
+            send_dv(&dv_packet, &nt -> tab[i]);
+        }
+    }
+    pthread_mutex_unlock(&cur_router -> lock);
+
+    logger("RELOAD", "%d neighbors added, %d removed, %d changed, %d routes withdrawn",
+           nb_added, nb_removed, nb_changed, nb_routes);
+    fprintf(out, "--> Neighbors reloaded: %d added, %d removed, %d changed, %d routes withdrawn.\n",
+            nb_added, nb_removed, nb_changed, nb_routes);
+    return 1;
+}
+
+// Signal thread: SIGHUP reloads the neighbors (blocked in the other threads)
+void *signal_handler(void *args) {
+
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    while (1) {
+        if (sigwait(&set, &sig) == 0 && sig == SIGHUP) {
+            logger("SIGNAL TH", "SIGHUP received");
+            reload_neighbors((struct th_args *) args, stdout);
         }
     }
 }
@@ -474,9 +1312,11 @@ static void overlay_addr_from_nt(const neighbors_table_t *nt, node_id_t id,overl
 /* ========================== MAIN PROGRAM ============================ */
 /* ==================================================================== */
 
-void process_command(char *cmd, routing_table_t *rt, neighbors_table_t *nt) {
+void process_command(char *cmd, struct th_args *pargs) {
 
     pthread_t th_id;
+    routing_table_t *rt = pargs -> rt;
+    neighbors_table_t *nt = pargs -> nt;
 
     if (!strcmp(cmd, HELP)) {
         print_help();
@@ -487,11 +1327,83 @@ void process_command(char *cmd, routing_table_t *rt, neighbors_table_t *nt) {
         return;
     }
     if (!strcmp(cmd, SH_IP_ROUTE) || !strcmp(cmd, SH_IP_ROUTE_2)) {
-        print_rt(rt);
+        print_rt(stdout, rt);
         return;
     }
     if (!strcmp(cmd, SH_IP_NEIGH) || !strcmp(cmd, SH_IP_NEIGH_2)) {
-        print_neighbors(nt);
+        print_neighbors(stdout, nt);
+        return;
+    }
+    if (!strcmp(cmd, SH_STATS) || !strcmp(cmd, SH_STATS_2)) {
+        print_stats(stdout);
+        return;
+    }
+    if (!strcmp(cmd, RELOAD)) {
+        reload_neighbors(pargs, stdout);
+        return;
+    }
+    if (!strncmp(cmd, RATELIMIT, strlen(RATELIMIT))) {
+        if (!rl_command(cmd))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strcmp(cmd, SH_LATENCY)) {
+        print_latency(stdout);
+        return;
+    }
+    if (!strcmp(cmd, SH_IO)) {
+        print_io(stdout);
+        return;
+    }
+    if (!strncmp(cmd, LATENCY, strlen(LATENCY))) {
+        if (!latency_command(cmd, stdout))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strncmp(cmd, RELIABLE, strlen(RELIABLE))) {
+        if (!reliable_command(cmd, pargs -> nt, stdout))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strncmp(cmd, NETEM, strlen(NETEM))) {
+        if (!netem_command(cmd, stdout))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strncmp(cmd, SHM, strlen(SHM))) {
+        if (!shm_command(cmd, pargs -> nt, stdout))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strncmp(cmd, CAPTURE, strlen(CAPTURE))) {
+        if (!capture_command(cmd, stdout))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strncmp(cmd, STABILITY, strlen(STABILITY))) {
+        if (!stability_command(cmd, rt, stdout))
+            print_unknown_command(stdout);
+        return;
+    }
+    if (!strcmp(cmd, SH_FLOWS)) {
+        pthread_mutex_lock(&cur_router -> lock);
+        print_flows(stdout);
+        pthread_mutex_unlock(&cur_router -> lock);
+        return;
+    }
+    if (!strncmp(cmd, BULK, strlen(BULK)) && cmd[strlen(BULK)]==' ') {
+        int did, size;
+        long bytes;
+        double rate;
+        bulk_report_t res;
+        if (!bulk_parse(cmd, &did, &bytes, &size, &rate))
+            print_unknown_command(stdout);
+        else if (!bulk_send(did, bytes, size, rate, bulk_new_flow(), 0, rt, &res))
+            print_no_route();
+        else {
+            print_bulk(stdout, &res, did);
+            usleep(BULK_WAIT * 1000);     // wait for the report
+        }
         return;
     }
     if (!strncmp(cmd, PING, strlen(PING)) && cmd[strlen(PING)]==' ') {
@@ -522,28 +1434,55 @@ void process_command(char *cmd, routing_table_t *rt, neighbors_table_t *nt) {
         return;
     }
     if (strlen(cmd)!=0)
-        print_unknown_command();
+        print_unknown_command(stdout);
 }
 
-// 1 router <-> 1 process (via xterm)
+#ifndef NO_MAIN
+// 1 router <-> 1 process (via xterm), or several routers per process
 int main(int argc, char **argv) {
 
-    routing_table_t myrt;
-    neighbors_table_t mynt;
-    pthread_t th1_id, th2_id;
-    struct th_args args;
+    pthread_t th1_id, th2_id, th3_id, th4_id;
+    struct th_args *pargs = &main_router.args;
+    router_t *self = &main_router;
+    ctl_routers_t ctl_routers = {&self, 1};
+    sigset_t set;
     int test_forwarding = 0;
-
-    if (argc!=3) {
-        printf("Usage: %s <id> <net_topo_conf>\n", argv[0]);
+    int headless = 0;
+    int workers = 0, first, last;
+    const char *io = io_backend_name(IO_DEFAULT);
+    int multi = argc < 2 ? 0 : vr_parse_ids(argv[1], &first, &last);
+    int usage = argc < 3 || multi < 0;
+
+    for (int i = 3; i < argc && !usage; i++) {
+        if (!strcmp(argv[i], "--headless"))
+            headless = 1;   // no console, commands through the control socket only
+        else if (!strcmp(argv[i], "--quiet"))
+            log_enabled = 0;    // no log/R<id>.txt (benchmarks)
+        else if (!strcmp(argv[i], "--io") && i + 1 < argc)
+            io = argv[++i];
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc && multi)
+            workers = atoi(argv[++i]);
+        else
+            usage = 1;
+    }
+    if (usage || !io_set_backend(io)) {
+        printf("Usage: %s <id> <net_topo_conf> [--headless] [--quiet] [--io plain|mmsg|uring]\n", argv[0]);
         printf("or\n");
-        printf("Usage: %s <id> --test-forwarding\n", argv[0]);
+        printf("Usage: %s <id> --test-forwarding [--headless] [--quiet] [--io plain|mmsg|uring]\n", argv[0]);
+        printf("or\n");
+        printf("Usage: %s <first>-<last>|all <net_topo_conf> [--workers n] [--quiet] [--io plain|mmsg|uring]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    if (multi) {        // daemon: headless, one control socket per router
+        if (!vr_main(argv[2], first, last, workers)) {
+            fprintf(stderr, "No router %d .. %d in %s\n", first, last, argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        return EXIT_SUCCESS;
+    }
+
     // ==== Init ROUTER ====
-    myrt.size = 0;
-    mynt.size = 0;
     int rid = atoi(argv[1]);
     MY_ID = rid; // shared ID between threads
     printf("**************\n");
@@ -551,42 +1490,69 @@ int main(int argc, char **argv) {
     printf("**************\n");
 
     if (strcmp(argv[2], "--test-forwarding") == 0) {
-        init_full_routing_table(&myrt);
+        init_full_routing_table(pargs -> rt);
         test_forwarding = 1;
     }
     else {
-        read_neighbors(argv[2], rid, &mynt);
-        init_routing_table(&myrt);
+        read_neighbors(argv[2], rid, pargs -> nt);
+        init_routing_table(pargs -> rt);
     }
     // ====================
-    // print_neighbors(&mynt);
-    // print_rt(&myrt);
-    args.rt = &myrt;
-    args.nt = &mynt;
+    // print_neighbors(pargs -> nt);
+    // print_rt(pargs -> rt);
+    pargs -> topo = test_forwarding ? NULL : argv[2];
+    open_ifaces(self);          // before the threads that send
+
+    // SIGHUP is only received by the signal thread
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
 
     /* Create a new thread th1 (process input packets) */
-    pthread_create(&th1_id, NULL, &process_input_packets, &args);
+    pthread_create(&th1_id, NULL, &process_input_packets, pargs);
     logger("MAIN TH","process input packets thread created with ID %u", (int) th1_id);
 
     if ( !test_forwarding ) {
         /* Create a new thread th2 (hello broadcast) */
-        pthread_create(&th2_id, NULL, &hello, &args);
+        pthread_create(&th2_id, NULL, &hello, pargs);
         logger("MAIN TH","hello thread created with ID %u", (int) th2_id);
     }
 
+    /* Create a new thread th3 (control socket) */
+    pthread_create(&th3_id, NULL, &control_server, &ctl_routers);
+    logger("MAIN TH","control thread created with ID %u", (int) th3_id);
+
+    /* Create a new thread th4 (SIGHUP => reload neighbors) */
+    pthread_create(&th4_id, NULL, &signal_handler, pargs);
+    logger("MAIN TH","signal thread created with ID %u", (int) th4_id);
+
+    if (headless) {
+        pthread_join(th1_id, NULL);     // runs until killed
+        return EXIT_SUCCESS;
+    }
+
     int quit=0, len;
     char *command = NULL;
     size_t size;
     while (!quit) {
         print_prompt();
         len = getline(&command, &size, stdin);
-        command[len-1] = '\0'; // remove newline
+        if (len <= 0)           // end of input
+            break;
+        if (command[len-1] == '\n')
+            command[len-1] = '\0'; // remove newline
         quit = !strcmp("quit", command) || !strcmp("exit", command);
         if (!quit)
-            process_command(command, &myrt, &mynt);
+            process_command(command, pargs);
         free(command);
         command = NULL;
     }
+    free(command);
 
+    char path[108];
+    ctl_path(path, sizeof(path), MY_ID);
+    unlink(path);
+    shm_close();
     return EXIT_SUCCESS;
 }
+#endif
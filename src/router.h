@@ -2,66 +2,241 @@
 #define __ROUTER_H__
 
 #include <time.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <netinet/in.h>
 #include "packet.h"
 
 // #define MAX_DATA 251
-#define MAX_NEIGHBORS 5
-#define MAX_ROUTES 20
-#define IPV4_ADR_STRLEN 16  // == INET_ADDRSTRLEN
-#define LOCALHOST "127.0.0.1"
+#define BUF_SIZE 1472      // largest datagram: 1500 bytes MTU - IPv4 and UDP headers
+                           // (IPv6 headers are 20 bytes longer: 1452, see README.md)
+#define MAX_NEIGHBORS 32
+#define MAX_IFACES 8        // local interfaces of a router ('node' lines)
+#define MAX_ROUTES 256      // one route per node id
+#define ID_BITS 8           // node_id_t
+#define TOPO_LINE_MAX 1024
+#define IP_ADR_STRLEN 64    // >= INET6_ADDRSTRLEN, room for a %<device> scope
+#define LOCALHOST "127.0.0.1"   // address of a node without 'node' line
+#define RTR_BASE_PORT 5555
+#define PORT(x) (x+RTR_BASE_PORT)
+#define FIB_NONE -1         // no route in rt -> fib
+#define BROADCAST_PERIOD 10 // seconds between the periodic DVs (see adaptive.h)
+#define ROUTE_GRACE 5       // s a route outlives the DV interval of its next hop (since its last refresh)
 
 /* ============================= */
 /*  Shared data between threads  */
-int MY_ID;
+extern int log_enabled;     // 0 => logger() does nothing
+extern int area_bits;       // high bits of a node id that give its area (0: no areas)
+extern int multi_router;    // several routers in the process (see vrouter.h)
 /* ============================= */
 
 // Small unsigned integer as node ID
 typedef unsigned char node_id_t;
 
+// Prefix of 'plen' bits of node ids (ID_BITS: a node, 0: default route)
+#define PREFIX_MASK(plen) ((0xff00 >> (plen)) & 0xff)
+#define AREA(id) ((id) & PREFIX_MASK(area_bits))
+
 // Overlay address
 // ===============
 typedef struct {
     node_id_t id;
-    char ipv4[IPV4_ADR_STRLEN]; // string (e.g., "127.0.0.1")
+    char ip[IP_ADR_STRLEN];     // string, IPv4 or IPv6 (e.g., "127.0.0.1", "::1")
     unsigned short int port;
+    unsigned char iface;        // local interface that reaches it (index in nt -> ifaces)
 } overlay_addr_t;
 
+// Local interface: address and port bound by one UDP socket of the router
+// ('node <id> <address> [<port>] [dev <device>]' lines of the topology file)
+typedef struct {
+    char ip[IP_ADR_STRLEN];     // "": any IPv4 address (no 'node' line)
+    unsigned short int port;
+    char dev[16];               // device bound with SO_BINDTODEVICE ("": none)
+} iface_t;
+
+// IPv4 or IPv6 socket address
+typedef union {
+    struct sockaddr     sa;
+    struct sockaddr_in  in;
+    struct sockaddr_in6 in6;
+} sock_addr_t;
+
+#define SOCK_ADDR_LEN(a) ((a) -> sa.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) \
+                                                          : sizeof(struct sockaddr_in))
+
 // Neighbors Table
 // ===============
 typedef struct {
     unsigned short int  size;
     overlay_addr_t      tab[MAX_NEIGHBORS];
+    unsigned char       stub[MAX_NEIGHBORS];    // tab[i] only gets a default route
+    unsigned short int  nb_ifaces;
+    iface_t             ifaces[MAX_IFACES];     // our interfaces ('node' lines, at least one)
+    int                 area_bits;              // 'areabits' line of the topology file
+    int                 reliable;               // 'reliable' line of the topology file
+    char                netem[128];             // 'netem' line: link emulation config ("": none)
+    int                 shm;                    // 'shm' line of the topology file
+    int                 poison;                 // 'poison' line (see stability.h)
+    int                 holddown;               // 'holddown' line: s (0: none)
+    int                 half_life;              // 'damping' line: s (0: none)
+    int                 dv_min, dv_max;         // 'adaptive' line: DV interval range (s, 0: fixed)
 } neighbors_table_t;
 
 // Routing Table
 // ===============
 typedef struct {
     node_id_t       dest;
+    unsigned char   plen;       // prefix length of dest (ID_BITS, area_bits or 0)
     overlay_addr_t  nexthop;
     unsigned char   metric;
+    unsigned char   hold_metric; // metric before the hold-down
     time_t          time;
+    time_t          hold;       // end of the hold-down (see stability.h)
 } routing_table_entry_t;
 
+// Flap history of the route to a node (see stability.h)
+typedef struct {
+    unsigned int    penalty;    // at 'time'
+    unsigned char   suppressed;
+    time_t          time;
+} route_damp_t;
+
+// tab is the RIB: every route with its metric, lifetime and next hop
+// address. fib is the forwarding state derived from it, the only part read
+// per packet: the next hop id of the longest prefix match for each dest,
+// and the socket address of each next hop (parsed when a route changes).
 typedef struct {
     unsigned short int     size;
     routing_table_entry_t  tab[MAX_ROUTES];
+    short                  fib[MAX_ROUTES];    // next hop id for each dest (FIB_NONE: no route)
+    sock_addr_t            fib_adr[MAX_ROUTES]; // address of each next hop id
+    unsigned char          fib_if[MAX_ROUTES];  // local interface of each next hop id
+    short                  idx[MAX_ROUTES];    // node route to each id: index in tab (-1: none)
+    // columns of tab for the DV kernels (see dvsimd.h), updated with it
+    unsigned char          col_dest[MAX_ROUTES];
+    unsigned char          col_metric[MAX_ROUTES];
+    unsigned char          col_nh[MAX_ROUTES];         // next hop id
+    unsigned char          col_flags[MAX_ROUTES];      // DV_SUMMARY/DV_DEFAULT
+    route_damp_t           damp[MAX_ROUTES];   // flap history of each node id, kept when its route is removed
+    unsigned char          nh_period[MAX_ROUTES]; // DV interval of each neighbor id (s, 0: BROADCAST_PERIOD)
 } routing_table_t;
 
+// Routes added or changed by a DV merge: one bit per dest id,
+// node routes and prefixes (area summaries, default route) apart
+typedef struct {
+    unsigned long host[MAX_ROUTES / 64];
+    unsigned long prefix[MAX_ROUTES / 64];
+    int count;                  // bits set
+} rt_dirty_t;
+
+#define RT_DIRTY_TEST(bits, id) (((bits)[(id) / 64] >> ((id) % 64)) & 1)
+
+// Router counters (see 'show stats')
+// =================================
+typedef struct {
+    unsigned long rx_data;          // DATA packets received
+    unsigned long rx_ctrl;          // CTRL (and ACK) packets received
+    unsigned long rx_malformed;     // malformed packets (dropped)
+    unsigned long fwd;              // DATA packets forwarded
+    unsigned long no_route;         // DATA packets dropped (no route)
+    unsigned long ttl_expired;      // DATA packets dropped (null ttl)
+    unsigned long tx_ctrl;          // CTRL (and ACK) packets sent
+    unsigned long tx_ctrl_bytes;
+    unsigned long rl_src_drop;      // dropped by the per-source token bucket
+    unsigned long rl_queue_drop;    // dropped because the egress queue was full
+    unsigned long rl_neigh_delay;   // packets held back by a next hop token bucket
+    unsigned long routes_expired;   // routes removed because no DV refreshed them
+    unsigned long routes_changed;   // routes added or changed by the DVs
+} router_stats_t;
+
+#define STAT_INC(field) __atomic_add_fetch(&cur_router -> stats.field, 1, __ATOMIC_RELAXED)
+#define STAT_ADD(field, n) __atomic_add_fetch(&cur_router -> stats.field, n, __ATOMIC_RELAXED)
+
 /* ==================================================================== */
 // Thread parameters
 struct th_args {
     routing_table_t *rt;
     neighbors_table_t *nt;
+    char *topo;                 // topology file (NULL: none)
 };
 
+// Router instance
+// ===============
+// A process runs one router with its own threads, or many of them on a
+// shared pool of workers (see vrouter.h). A thread working for a router
+// points cur_router to it first; the threads of a single router process
+// use the default instance.
+typedef struct router {
+    int             id;
+    routing_table_t rt;
+    neighbors_table_t nt;
+    struct th_args  args;       // &rt, &nt and the topology file
+    pthread_mutex_t lock;       // routing and neighbors tables updates
+    router_stats_t  stats;
+    // console probes
+    pthread_mutex_t probe_lock;
+    int             end_traceroute;
+    int             end_pingforce;
+    // control socket probes in progress (control.c, NULL: no control thread)
+    struct ctl_probes *probes;
+    // forwarding latency (latency.c)
+    struct lat_hist *lat_hists; // LAT_STAGES histograms (NULL: none recorded yet)
+    // bulk transfers (bulk.c)
+    struct bulk_flow *flows;    // last flow of each source (NULL: none yet)
+    unsigned int    bulk_last;  // last transfer sent, until its report
+    // triggered DVs (see stability.h)
+    int             lost;       // routes lost since our last DVs
+    time_t          trigger_next; // earliest next triggered DVs
+    // DV interval (see adaptive.h)
+    int             dv_period;  // s, advertised in our DVs (0: none sent yet)
+    double          dv_next;    // time of our next periodic DVs (rel_now, 0: now)
+    int             dv_changed; // routing table changed since our last periodic DVs
+    unsigned int    dv_seed;    // jitter
+    // UDP sockets of the interfaces (nt.ifaces), input and output
+    int             if_sock[MAX_IFACES];
+    int             nb_socks;   // open (0: none yet, see iface_sock)
+    // shared pool (vrouter.c)
+    int             periods;    // periodic DVs sent
+    struct router   *wheel_next; // next instance in the same timer wheel slot
+} router_t;
+
+extern __thread router_t *cur_router;
+
+#define MY_ID (cur_router -> id)
+
+void router_init(router_t *r, int id);
+
 /* ==================================================================== */
 
+routing_table_entry_t *find_route(routing_table_t *rt, node_id_t dest);
+
 int forward_packet(packet_data_t *packet, int psize, routing_table_t *rt);
 
 void init_node(overlay_addr_t *addr, node_id_t id, char *ip);
+int node_sockaddr(const char *ip, unsigned short port, sock_addr_t *adr);
+void open_ifaces(router_t *r);
+int iface_sock(int iface);
 
 void add_route(routing_table_t *rt, node_id_t dest, const overlay_addr_t *next, short metric);
+void add_prefix_route(routing_table_t *rt, node_id_t dest, int plen, const overlay_addr_t *next, short metric);
 
 void init_routing_table(routing_table_t *rt);
 
+void logger(const char *tag, const char *message, ...);
+void log_dv(packet_ctrl_t *p, node_id_t neigh, int output);
+
+int parse_neighbors(const char *file, int rid, neighbors_table_t *nt);
+void read_neighbors(char *file, int rid, neighbors_table_t *nt);
+int reload_neighbors(struct th_args *pargs, FILE *out);
+
+void build_dv_specific(packet_ctrl_t *p, routing_table_t *rt, node_id_t neigh, int stub);
+
+int update_rt(routing_table_t *rt, const overlay_addr_t *src, const dv_entry_t *dv, int dv_size,
+              int period, rt_dirty_t *dirty);
+
+void remove_obsolete_entries(routing_table_t *rt);
+int broadcast_dv(routing_table_t *rt, neighbors_table_t *nt, int first);
+
+void handle_packet(char *buffer_in, int size, struct th_args *pargs);
+
 #endif
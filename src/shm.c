@@ -0,0 +1,512 @@
+#define _GNU_SOURCE         // memfd_create
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+#include "shm.h"
+#include "latency.h"
+
+// Offer and acceptance of a ring (SHM_PATH datagrams)
+#define SHM_OFFER 1                 // memfd of the ring from 'from' to the receiver
+#define SHM_ACCEPT 2                // eventfd of the reader of the ring 'cookie'
+
+typedef struct {
+    int type;
+    int from;
+    pid_t pid;
+    unsigned long cookie;           // ring offered (SHM_OFFER) or accepted
+} shm_msg_t;
+
+typedef struct {
+    int len;
+    long ts;                        // LAT_NOW() of the sender (receive timestamp)
+    char data[BUF_SIZE] __attribute__((aligned(8)));
+} shm_slot_t;
+
+// Mapped by the two routers. The indexes only increase; the producer and
+// the consumer lines are apart so that they do not bounce together.
+typedef struct {
+    unsigned magic;                 // SHM_MAGIC
+    unsigned slots;                 // SHM_SLOTS
+    unsigned long cookie;
+    int from, to;
+    unsigned long tail __attribute__((aligned(64)));    // written by the sender
+    unsigned long head __attribute__((aligned(64)));    // released by the reader
+    int sleeping __attribute__((aligned(64)));          // reader waits on its eventfd
+    shm_slot_t slot[SHM_SLOTS] __attribute__((aligned(64)));
+} shm_ring_t;
+
+// Sending side of a link (any thread, under lock)
+typedef struct {
+    pthread_mutex_t lock;
+    shm_ring_t *ring;               // NULL: through UDP
+    int efd;                        // eventfd of the reader
+    pid_t pid;                      // reader process
+    unsigned long tail, head;       // local copies of the ring indexes
+    shm_ring_t *offer;              // offered, not accepted yet
+    int offer_fd;
+    shm_stats_t st;
+} shm_tx_t;
+
+// Receiving side of a link (input thread)
+typedef struct {
+    node_id_t from;
+    shm_ring_t *ring;
+    unsigned long next, tail;       // next datagram to read, last tail read
+} shm_rx_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+int shm_enabled = 0;
+int shm_efd = -1;
+static shm_tx_t tx[MAX_ROUTES];
+static shm_ring_t *rx_offer[MAX_ROUTES];    // accepted rings, adopted by the input thread
+static int rx_offered = 0;
+static unsigned long rx_count[MAX_ROUTES];  // datagrams read from each neighbor
+static unsigned char rx_linked[MAX_ROUTES]; // a ring from the neighbor was accepted
+static neighbors_table_t *shm_nt = NULL;    // read under the router lock
+static int shm_sock = -1;
+static pthread_t shm_th;
+/* ============================= */
+
+// input thread only
+static shm_rx_t rx[MAX_NEIGHBORS];
+static int rx_n = 0, rx_cur = 0;
+static shm_rx_t *rx_held = NULL;    // link of the last datagram returned
+
+/* ==================================================================== */
+/* ============================== SENDER ============================== */
+/* ==================================================================== */
+
+// Write a datagram to the ring of 'neigh', return 0 if it must go through UDP
+int shm_send(node_id_t neigh, const void *buf, int len) {
+    shm_tx_t *t = &tx[neigh];
+    if (__atomic_load_n(&t -> ring, __ATOMIC_RELAXED) == NULL || !shm_enabled || len > BUF_SIZE)
+        return 0;
+    pthread_mutex_lock(&t -> lock);
+    shm_ring_t *r = t -> ring;
+    if (r == NULL || (t -> tail - t -> head == SHM_SLOTS
+            && t -> tail - (t -> head = __atomic_load_n(&r -> head, __ATOMIC_ACQUIRE)) >= SHM_SLOTS)) {
+        if (r != NULL)
+            t -> st.full++;
+        pthread_mutex_unlock(&t -> lock);
+        return 0;
+    }
+    shm_slot_t *s = &r -> slot[t -> tail & (SHM_SLOTS - 1)];
+    memcpy(s -> data, buf, len);
+    s -> len = len;
+    s -> ts = LAT_NOW();
+    __atomic_store_n(&r -> tail, ++t -> tail, __ATOMIC_RELEASE);
+    t -> st.sent++;
+    // the reader sets 'sleeping' then checks the tail (see shm_sleep)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r -> sleeping, __ATOMIC_RELAXED)
+            && __atomic_exchange_n(&r -> sleeping, 0, __ATOMIC_RELAXED)) {
+        eventfd_write(t -> efd, 1);
+        t -> st.wakeups++;
+    }
+    pthread_mutex_unlock(&t -> lock);
+    return 1;
+}
+
+static void unmap(shm_ring_t *r) {
+    munmap(r, sizeof(shm_ring_t));
+}
+
+// Back to UDP for 'neigh' (its router is gone or restarted)
+static void tx_detach(node_id_t neigh) {
+    shm_tx_t *t = &tx[neigh];
+    pthread_mutex_lock(&t -> lock);
+    if (t -> ring != NULL) {
+        unmap(t -> ring);
+        close(t -> efd);
+        __atomic_store_n(&t -> ring, NULL, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&t -> lock);
+    logger("SHM", "R%d is gone, datagrams to R%d through UDP", neigh, neigh);
+}
+
+static int send_msg(int id, const shm_msg_t *m, int fd) {
+    struct sockaddr_un adr;
+    struct iovec iov = {(void *) m, sizeof(*m)};
+    struct msghdr msg;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+
+    memset(&adr, 0, sizeof(adr));
+    adr.sun_family = AF_UNIX;
+    snprintf(adr.sun_path, sizeof(adr.sun_path), SHM_PATH, id);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &adr;
+    msg.msg_namelen = sizeof(adr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c -> cmsg_level = SOL_SOCKET;
+    c -> cmsg_type = SCM_RIGHTS;
+    c -> cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    return sendmsg(shm_sock, &msg, MSG_DONTWAIT);
+}
+
+// Offer a ring to 'neigh' (a new one unless one is already pending)
+static void tx_offer(node_id_t neigh) {
+    static unsigned long counter = 0;
+    shm_tx_t *t = &tx[neigh];
+
+    pthread_mutex_lock(&t -> lock);
+    if (t -> ring == NULL && t -> offer == NULL) {
+        char name[32];
+        snprintf(name, sizeof(name), "router-R%d-R%d", MY_ID, neigh);
+        int fd = memfd_create(name, MFD_CLOEXEC);
+        shm_ring_t *r = MAP_FAILED;
+        if (fd >= 0 && ftruncate(fd, sizeof(shm_ring_t)) == 0)
+            r = mmap(NULL, sizeof(shm_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (r == MAP_FAILED) {
+            logger("SHM", "ring for R%d: %s", neigh, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            pthread_mutex_unlock(&t -> lock);
+            return;
+        }
+        r -> magic = SHM_MAGIC;
+        r -> slots = SHM_SLOTS;
+        r -> cookie = ((unsigned long) getpid() << 32) | ++counter;
+        r -> from = MY_ID;
+        r -> to = neigh;
+        t -> offer = r;
+        t -> offer_fd = fd;
+    }
+    if (t -> offer != NULL) {
+        shm_msg_t m = {SHM_OFFER, MY_ID, getpid(), t -> offer -> cookie};
+        // ENOENT, ECONNREFUSED: no shared memory links at 'neigh' (yet)
+        if (send_msg(neigh, &m, t -> offer_fd) < 0 && errno != ENOENT && errno != ECONNREFUSED)
+            logger("SHM", "offer to R%d: %s", neigh, strerror(errno));
+    }
+    pthread_mutex_unlock(&t -> lock);
+}
+
+// The reader of the ring offered to 'neigh' accepted it
+static void tx_accepted(node_id_t neigh, const shm_msg_t *m, int efd) {
+    shm_tx_t *t = &tx[neigh];
+    pthread_mutex_lock(&t -> lock);
+    if (t -> offer == NULL || t -> offer -> cookie != m -> cookie) {
+        pthread_mutex_unlock(&t -> lock);
+        close(efd);
+        return;
+    }
+    if (t -> ring != NULL) {
+        unmap(t -> ring);
+        close(t -> efd);
+    }
+    close(t -> offer_fd);
+    t -> efd = efd;
+    t -> pid = m -> pid;
+    t -> tail = t -> head = 0;
+    __atomic_store_n(&t -> ring, t -> offer, __ATOMIC_RELEASE);
+    t -> offer = NULL;
+    pthread_mutex_unlock(&t -> lock);
+    logger("SHM", "datagrams to R%d through shared memory", neigh);
+}
+
+/* ==================================================================== */
+/* ============================= RECEIVER ============================= */
+/* ==================================================================== */
+
+// Take the rings accepted by the shm thread (input thread)
+static void rx_adopt() {
+    __atomic_store_n(&rx_offered, 0, __ATOMIC_RELAXED);
+    for (int id = 1; id < MAX_ROUTES; id++) {
+        shm_ring_t *r = __atomic_exchange_n(&rx_offer[id], NULL, __ATOMIC_ACQUIRE);
+        if (r == NULL)
+            continue;
+        int i = 0;
+        while (i < rx_n && rx[i].from != id)
+            i++;
+        if (i < rx_n)
+            unmap(rx[i].ring);      // the neighbor restarted
+        else if (rx_n < MAX_NEIGHBORS)
+            rx_n++;
+        else {
+            unmap(r);
+            continue;
+        }
+        rx[i].from = id;
+        rx[i].ring = r;
+        rx[i].next = rx[i].tail = __atomic_load_n(&r -> head, __ATOMIC_RELAXED);
+    }
+}
+
+// Next datagram of the rings, in turn (0: none). The slot is released at
+// the next call.
+int shm_recv(io_pkt_t *pkt) {
+    if (rx_held != NULL) {
+        __atomic_store_n(&rx_held -> ring -> head, rx_held -> next, __ATOMIC_RELEASE);
+        rx_held = NULL;
+    }
+    if (__atomic_load_n(&rx_offered, __ATOMIC_ACQUIRE))
+        rx_adopt();
+    for (int k = 0; k < rx_n; k++) {
+        int i = (rx_cur + k) % rx_n;
+        shm_rx_t *l = &rx[i];
+        if (l -> next == l -> tail) {
+            l -> tail = __atomic_load_n(&l -> ring -> tail, __ATOMIC_ACQUIRE);
+            if (l -> next == l -> tail)
+                continue;
+            if (l -> tail - l -> next > SHM_SLOTS) {    // not written by a router
+                logger("SHM", "invalid ring from R%d dropped", l -> from);
+                unmap(l -> ring);
+                rx[i] = rx[--rx_n];
+                return shm_recv(pkt);
+            }
+        }
+        shm_slot_t *s = &l -> ring -> slot[l -> next & (SHM_SLOTS - 1)];
+        pkt -> buf = s -> data;
+        pkt -> size = s -> len < 0 || s -> len > BUF_SIZE ? 0 : s -> len;
+        pkt -> ts = s -> ts;
+        l -> next++;
+        rx_count[l -> from]++;
+        rx_held = l;
+        rx_cur = i + 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Before waiting on shm_efd: ask the senders for a wakeup, return 0 if a
+// datagram arrived meanwhile (no wait)
+int shm_sleep() {
+    if (__atomic_load_n(&rx_offered, __ATOMIC_RELAXED))
+        return 0;
+    for (int i = 0; i < rx_n; i++)
+        __atomic_store_n(&rx[i].ring -> sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < rx_n; i++) {
+        if (__atomic_load_n(&rx[i].ring -> tail, __ATOMIC_RELAXED) != rx[i].next)
+            return 0;
+    }
+    return 1;
+}
+
+// After the wait (or shm_sleep)
+void shm_wake() {
+    eventfd_t v;
+    for (int i = 0; i < rx_n; i++)
+        __atomic_store_n(&rx[i].ring -> sleeping, 0, __ATOMIC_RELAXED);
+    eventfd_read(shm_efd, &v);          // non blocking
+}
+
+/* ==================================================================== */
+/* =========================== NEGOTIATION ============================ */
+/* ==================================================================== */
+
+// 'id' is a neighbor of this host (loopback address, IPv4 or IPv6)
+static int colocated(const neighbors_table_t *nt, int id) {
+    sock_addr_t adr;
+    for (int i = 0; i < nt -> size; i++) {
+        if (nt -> tab[i].id != id || !node_sockaddr(nt -> tab[i].ip, 0, &adr))
+            continue;
+        if (adr.sa.sa_family == AF_INET6)
+            return IN6_IS_ADDR_LOOPBACK(&adr.in6.sin6_addr);
+        return (ntohl(adr.in.sin_addr.s_addr) >> 24) == 127;
+    }
+    return 0;
+}
+
+// Map the ring offered by 'm -> from' and accept it
+static void rx_accept(const shm_msg_t *m, int fd, const struct sockaddr_un *peer, socklen_t len) {
+    struct stat st;
+    pthread_mutex_lock(&cur_router -> lock);
+    int ok = shm_enabled && m -> from > 0 && m -> from < MAX_ROUTES && colocated(shm_nt, m -> from);
+    pthread_mutex_unlock(&cur_router -> lock);
+    if (!ok || fstat(fd, &st) < 0 || st.st_size != sizeof(shm_ring_t)) {
+        close(fd);
+        return;
+    }
+    shm_ring_t *r = mmap(NULL, sizeof(shm_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED)
+        return;
+    if (r -> magic != SHM_MAGIC || r -> slots != SHM_SLOTS || r -> cookie != m -> cookie
+            || r -> from != m -> from || r -> to != MY_ID) {
+        logger("SHM", "invalid ring offered by R%d", m -> from);
+        unmap(r);
+        return;
+    }
+    shm_ring_t *old = __atomic_exchange_n(&rx_offer[m -> from], r, __ATOMIC_RELEASE);
+    if (old != NULL)
+        unmap(old);                 // offered again before the input thread took it
+    __atomic_store_n(&rx_offered, 1, __ATOMIC_RELEASE);
+    rx_linked[m -> from] = 1;
+    eventfd_write(shm_efd, 1);
+
+    shm_msg_t a = {SHM_ACCEPT, MY_ID, getpid(), m -> cookie};
+    struct iovec iov = {&a, sizeof(a)};
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *) peer;
+    msg.msg_namelen = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c -> cmsg_level = SOL_SOCKET;
+    c -> cmsg_type = SCM_RIGHTS;
+    c -> cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &shm_efd, sizeof(int));
+    if (sendmsg(shm_sock, &msg, MSG_DONTWAIT) < 0)
+        logger("SHM", "accept to R%d: %s", m -> from, strerror(errno));
+    else
+        logger("SHM", "datagrams from R%d through shared memory", m -> from);
+    // the neighbor has shared memory links (maybe restarted): offer ours at once
+    shm_tx_t *t = &tx[m -> from];
+    if (__atomic_load_n(&t -> ring, __ATOMIC_RELAXED) != NULL && t -> pid != m -> pid)
+        tx_detach(m -> from);
+    if (__atomic_load_n(&t -> ring, __ATOMIC_RELAXED) == NULL)
+        tx_offer(m -> from);
+}
+
+// Shm thread: offers and acceptances of the neighbors
+static void *shm_thread(void *unused) {
+    shm_msg_t m;
+    struct sockaddr_un peer;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+
+    while (1) {
+        struct iovec iov = {&m, sizeof(m)};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &peer;
+        msg.msg_namelen = sizeof(peer);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        int n = recvmsg(shm_sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            if (errno != EINTR)
+                logger("SHM TH", "recvmsg %s", strerror(errno));
+            continue;
+        }
+        int fd = -1;
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        if (c != NULL && c -> cmsg_level == SOL_SOCKET && c -> cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(c), sizeof(int));
+        if (fd < 0)
+            continue;
+        if (n == sizeof(m) && m.type == SHM_OFFER)
+            rx_accept(&m, fd, &peer, msg.msg_namelen);
+        else if (n == sizeof(m) && m.type == SHM_ACCEPT && m.from > 0 && m.from < MAX_ROUTES)
+            tx_accepted(m.from, &m, fd);
+        else
+            close(fd);
+    }
+    return NULL;
+}
+
+// Open SHM_PATH and start the shm thread (once), return 0 on error
+int shm_start(neighbors_table_t *nt) {
+    static int started = 0;
+    struct sockaddr_un adr;
+
+    shm_nt = nt;
+    if (started)
+        return 1;
+    for (int i = 0; i < MAX_ROUTES; i++)
+        pthread_mutex_init(&tx[i].lock, NULL);
+    memset(&adr, 0, sizeof(adr));
+    adr.sun_family = AF_UNIX;
+    snprintf(adr.sun_path, sizeof(adr.sun_path), SHM_PATH, MY_ID);
+    unlink(adr.sun_path);           // left by a previous run
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (efd < 0 || shm_sock < 0 || bind(shm_sock, (struct sockaddr *) &adr, sizeof(adr)) < 0) {
+        logger("SHM", "%s: %s", adr.sun_path, strerror(errno));
+        if (efd >= 0)
+            close(efd);
+        if (shm_sock >= 0)
+            close(shm_sock);
+        return 0;
+    }
+    __atomic_store_n(&shm_efd, efd, __ATOMIC_RELEASE);
+    pthread_create(&shm_th, NULL, &shm_thread, NULL);
+    started = 1;
+    return 1;
+}
+
+void shm_close() {
+    char path[108];
+    if (shm_sock < 0)
+        return;
+    snprintf(path, sizeof(path), SHM_PATH, MY_ID);
+    unlink(path);
+}
+
+// Periodic (hello thread, under the router lock): offer rings to the co-located
+// neighbors without one, give up the links to the routers that are gone
+void shm_poll(const neighbors_table_t *nt) {
+    if (!shm_enabled || shm_sock < 0)
+        return;
+    for (int i = 0; i < nt -> size; i++) {
+        node_id_t id = nt -> tab[i].id;
+        if (!colocated(nt, id))
+            continue;
+        if (__atomic_load_n(&tx[id].ring, __ATOMIC_RELAXED) == NULL)
+            tx_offer(id);
+        else if (kill(tx[id].pid, 0) < 0 && errno == ESRCH)
+            tx_detach(id);
+    }
+}
+
+/* ==================================================================== */
+/* ============================= COMMAND ============================== */
+/* ==================================================================== */
+
+void print_shm(FILE *out, const neighbors_table_t *nt) {
+    fprintf(out, "Shared memory links %s.\n", shm_enabled ? "on" : "off");
+    if (shm_sock < 0)
+        return;
+    fprintf(out, "Neigh | Out  | Sent     | Full   | Wakeups | In  | Received\n");
+    for (int i = 0; i < nt -> size; i++) {
+        node_id_t id = nt -> tab[i].id;
+        shm_tx_t *t = &tx[id];
+        pthread_mutex_lock(&t -> lock);
+        shm_stats_t s = t -> st;
+        int out_shm = t -> ring != NULL;
+        pthread_mutex_unlock(&t -> lock);
+        fprintf(out, "R%-4d | %-4s | %8lu | %6lu | %7lu | %-3s | %lu\n", id, out_shm ? "shm" : "udp",
+                s.sent, s.full, s.wakeups, rx_linked[id] ? "shm" : "udp", rx_count[id]);
+    }
+}
+
+// Parse "shm on", "shm off" or "shm", return 0 on error
+int shm_command(const char *cmd, neighbors_table_t *nt, FILE *out) {
+
+    char temp[16], arg[16];
+    int n = sscanf(cmd, "%15s%15s", temp, arg);
+
+    if (n == 2 && !strcmp(arg, "on")) {
+        if (!shm_start(nt)) {
+            fprintf(out, "--> Cannot open " SHM_PATH " (see the log).\n", MY_ID);
+            return 0;
+        }
+        shm_enabled = 1;
+    } else if (n == 2 && !strcmp(arg, "off"))
+        shm_enabled = 0;
+    else if (n != 1)
+        return 0;
+    print_shm(out, nt);
+    return 1;
+}
@@ -0,0 +1,49 @@
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include <stdio.h>
+#include "router.h"
+#include "sockio.h"
+
+// Shared memory links between routers of the same host: the datagrams to
+// a co-located neighbor are written to a single producer single consumer
+// ring in a memfd mapped by both routers, read by the input thread of the
+// neighbor, which sleeps on an eventfd only when its rings are empty.
+// Each direction of a link is negotiated apart through the UNIX datagram
+// socket SHM_PATH of the routers: the sender offers its ring (memfd passed
+// with SCM_RIGHTS), the receiver maps it and accepts with its eventfd.
+// The datagrams go through UDP until then, when the ring is full, when
+// the links are emulated (netem) or when the neighbor is gone.
+#define SHM_PATH "/tmp/router_R%d.shm"
+#define SHM_SLOTS 256               // datagrams per ring (power of 2)
+#define SHM_MAGIC 0x52534d31        // "RSM1"
+
+// Counters of the link with a neighbor (see 'shm')
+typedef struct {
+    unsigned long sent;             // datagrams written to the ring
+    unsigned long full;             // sent through UDP: ring full
+    unsigned long wakeups;          // eventfd writes (receiver asleep)
+    unsigned long received;         // datagrams read from its ring
+} shm_stats_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int shm_enabled;             // 'shm' line of the topology file or 'shm on'
+extern int shm_efd;                 // eventfd of the input thread (-1: not started)
+/* ============================= */
+
+/* ==================================================================== */
+int shm_start(neighbors_table_t *nt);
+void shm_close();
+void shm_poll(const neighbors_table_t *nt);
+
+int shm_send(node_id_t neigh, const void *buf, int len);
+
+int shm_recv(io_pkt_t *pkt);
+int shm_sleep();
+void shm_wake();
+
+void print_shm(FILE *out, const neighbors_table_t *nt);
+int shm_command(const char *cmd, neighbors_table_t *nt, FILE *out);
+
+#endif
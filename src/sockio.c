@@ -0,0 +1,640 @@
+#define _GNU_SOURCE         // recvmmsg, sendmmsg
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifndef NO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "sockio.h"
+#include "netem.h"
+#include "shm.h"
+
+#define IO_CBUF_SIZE CMSG_SPACE(sizeof(struct timespec))   // SO_TIMESTAMPNS
+#define IO_TX_SIZE BUF_SIZE
+
+/* ============================= */
+/*  Shared data between threads  */
+int io_backend = IO_PLAIN;
+__thread io_tx_t *io_tx = NULL;
+static io_stats_t io_stats;         // atomic updates
+static int rx_socks[MAX_IFACES];    // input thread only
+static int rx_nsocks = 0;
+static int rx_turn = 0;             // next socket to read (several interfaces)
+/* ============================= */
+
+/* ==================================================================== */
+/* ============================= IO_URING ============================= */
+/* ==================================================================== */
+
+#ifndef NO_URING
+// Ring mapped from the kernel, used by a single thread (no liburing)
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned tail;                  // local SQ tail (published by ring_enter)
+} io_ring_t;
+
+// Ring for the calling thread only: the completions are processed when it
+// waits for them (IORING_SETUP_DEFER_TASKRUN, 6.1), not as they arrive
+static int ring_open(io_ring_t *r, unsigned entries, unsigned cq_entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = cq_entries;
+    if ((r -> fd = syscall(__NR_io_uring_setup, entries, &p)) < 0 && errno == EINVAL) {
+        p.flags = IORING_SETUP_CQSIZE;      // older kernel
+        r -> fd = syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (r -> fd < 0)
+        return 0;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {      // timed waits (5.11)
+        close(r -> fd);
+        errno = ENOSYS;
+        return 0;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    r -> fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP))
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  r -> fd, IORING_OFF_CQ_RING);
+    r -> sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r -> fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || r -> sqes == MAP_FAILED) {
+        close(r -> fd);
+        return 0;
+    }
+    r -> sq_head = (unsigned *) (sq + p.sq_off.head);
+    r -> sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r -> sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r -> sq_array = (unsigned *) (sq + p.sq_off.array);
+    r -> cq_head = (unsigned *) (cq + p.cq_off.head);
+    r -> cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r -> cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r -> cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    r -> tail = *r -> sq_tail;
+    return 1;
+}
+
+// Next free submission entry, cleared (NULL: SQ full)
+static struct io_uring_sqe *ring_sqe(io_ring_t *r) {
+    if (r -> tail - __atomic_load_n(r -> sq_head, __ATOMIC_ACQUIRE) > *r -> sq_mask)
+        return NULL;
+    unsigned i = r -> tail++ & *r -> sq_mask;
+    r -> sq_array[i] = i;
+    memset(&r -> sqes[i], 0, sizeof(struct io_uring_sqe));
+    return &r -> sqes[i];
+}
+
+// Submit the new entries and wait for 'wait' completions (timeout 'ms' if >= 0)
+static int ring_enter(io_ring_t *r, unsigned wait, int ms) {
+    unsigned submit = r -> tail - *r -> sq_tail;
+    unsigned flags = wait > 0 || submit == 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (unsigned long) &ts;
+    if (ms >= 0)
+        flags |= IORING_ENTER_EXT_ARG;
+    __atomic_store_n(r -> sq_tail, r -> tail, __ATOMIC_RELEASE);
+    return syscall(__NR_io_uring_enter, r -> fd, submit, wait, flags,
+                   ms >= 0 ? (void *) &arg : NULL, ms >= 0 ? sizeof(arg) : 0);
+}
+
+// Oldest completion (NULL: none), consumed by ring_seen
+static struct io_uring_cqe *ring_cqe(io_ring_t *r) {
+    unsigned head = *r -> cq_head;
+    if (head == __atomic_load_n(r -> cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r -> cqes[head & *r -> cq_mask];
+}
+
+static void ring_seen(io_ring_t *r) {
+    __atomic_store_n(r -> cq_head, *r -> cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Receive buffers: header filled by the kernel (recvmsg_out, address,
+// control), then the datagram at an 8-byte aligned offset
+#define IO_RX_BGID 1
+#define IO_EFD_TAG MAX_IFACES       // user_data of the poll on shm_efd (recvmsg: socket index)
+#define IO_RX_HDR (sizeof(struct io_uring_recvmsg_out) + sizeof(sock_addr_t) + IO_CBUF_SIZE)
+#define IO_RX_SIZE (IO_RX_HDR + BUF_SIZE)
+
+static io_ring_t rx_ring;
+static struct io_uring_buf_ring *rx_br;    // provided buffers ring (page aligned)
+static char *rx_bufs;                       // IO_RX_BUFS x IO_RX_SIZE
+static struct msghdr rx_msg;                // address and control sizes of the recvmsg
+static unsigned rx_armed = 0;               // multishot recvmsg in flight (bit of each socket)
+static int rx_bid = -1;                     // buffer of the last datagram returned
+static int efd_armed = 0;                   // multishot poll on shm_efd in flight
+
+// Give buffer 'bid' back to the kernel
+static void rx_buf_add(int bid) {
+    unsigned short tail = rx_br -> tail;
+    struct io_uring_buf *b = &rx_br -> bufs[tail & (IO_RX_BUFS - 1)];
+    b -> addr = (unsigned long) (rx_bufs + bid * IO_RX_SIZE);
+    b -> len = IO_RX_SIZE;
+    b -> bid = bid;
+    __atomic_store_n(&rx_br -> tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Receive ring of the calling thread with its provided buffers ('probe':
+// check that the kernel supports them and close the ring)
+static int uring_rx_init(int probe) {
+    struct io_uring_buf_reg reg;
+
+    if (!ring_open(&rx_ring, 2 * MAX_IFACES, 2 * IO_RX_BUFS))
+        return 0;
+    if (rx_br == NULL) {
+        rx_br = mmap(NULL, IO_RX_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        rx_bufs = aligned_alloc(64, IO_RX_BUFS * IO_RX_SIZE);
+    }
+    if (rx_br == MAP_FAILED || rx_bufs == NULL) {
+        close(rx_ring.fd);
+        return 0;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) rx_br;
+    reg.ring_entries = IO_RX_BUFS;
+    reg.bgid = IO_RX_BGID;
+    int ret = syscall(__NR_io_uring_register, rx_ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    if (ret < 0 || probe) {
+        int err = errno;
+        close(rx_ring.fd);          // unmapping the ring is not worth it
+        errno = err;
+        return ret >= 0;
+    }
+    for (int i = 0; i < IO_RX_BUFS; i++)
+        rx_buf_add(i);
+    rx_msg.msg_namelen = sizeof(sock_addr_t);
+    rx_msg.msg_controllen = IO_CBUF_SIZE;
+    return 1;
+}
+
+// Queue the multishot recvmsg of the sockets that have none (submitted by
+// the next ring_enter)
+static void uring_rx_arm() {
+    for (int i = 0; i < rx_nsocks; i++) {
+        if (rx_armed & (1u << i))
+            continue;
+        struct io_uring_sqe *sqe = ring_sqe(&rx_ring);
+        if (sqe == NULL)
+            return;
+        sqe -> opcode = IORING_OP_RECVMSG;
+        sqe -> fd = rx_socks[i];
+        sqe -> addr = (unsigned long) &rx_msg;
+        sqe -> len = 1;
+        sqe -> ioprio = IORING_RECV_MULTISHOT;
+        sqe -> flags = IOSQE_BUFFER_SELECT;
+        sqe -> buf_group = IO_RX_BGID;
+        sqe -> user_data = i;
+        rx_armed |= 1u << i;
+    }
+}
+
+// Queue a multishot poll of the shm eventfd (see io_wait)
+static void uring_efd_arm(int efd) {
+    struct io_uring_sqe *sqe = ring_sqe(&rx_ring);
+    if (sqe == NULL)
+        return;
+    sqe -> opcode = IORING_OP_POLL_ADD;
+    sqe -> fd = efd;
+    sqe -> poll32_events = POLLIN;
+    sqe -> len = IORING_POLL_ADD_MULTI;
+    sqe -> user_data = IO_EFD_TAG;
+    efd_armed = 1;
+}
+#endif
+
+/* ==================================================================== */
+/* ============================= RECEIVE ============================== */
+/* ==================================================================== */
+
+// plain and mmsg backends: the datagrams of the last recvmmsg
+static char rx_buf[IO_BATCH][BUF_SIZE] __attribute__((aligned(8)));
+static char rx_cbuf[IO_BATCH][IO_CBUF_SIZE];
+static struct iovec rx_iov[IO_BATCH];
+static struct mmsghdr rx_msgs[IO_BATCH];
+static int rx_count = 0, rx_next = 0;
+
+// Kernel receive timestamp of a datagram (ns, 0: none)
+static long rx_timestamp(struct msghdr *msg) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)) {
+        if (c -> cmsg_level == SOL_SOCKET && c -> cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return ts.tv_sec * 1000000000L + ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+// Receive through the 'n' sockets 'socks' with the selected backend (input
+// thread), return 0 on error
+int io_rx_open(const int *socks, int n) {
+    memcpy(rx_socks, socks, n * sizeof(int));
+    rx_nsocks = n;
+#ifndef NO_URING
+    if (io_backend == IO_URING && !uring_rx_init(0))
+        return 0;
+#endif
+    for (int i = 0; i < IO_BATCH; i++) {
+        rx_iov[i].iov_base = rx_buf[i];
+        rx_iov[i].iov_len = BUF_SIZE;
+    }
+    return 1;
+}
+
+// One recvmsg (recvmmsg) on the input sockets, starting from the one
+// after the last read so that none is starved; only a single socket is
+// waited for in the call. Return the number of datagrams (0: none ready)
+static int sock_fill(int dontwait) {
+    int n = 0;
+    if (rx_nsocks > 1)
+        dontwait = 1;               // see sock_recv
+    for (int k = 0; k < rx_nsocks && n == 0; k++) {
+        int sock = rx_socks[rx_turn];
+        rx_turn = (rx_turn + 1) % rx_nsocks;
+        n = io_backend == IO_MMSG ? IO_BATCH : 1;
+        for (int i = 0; i < n; i++) {
+            memset(&rx_msgs[i], 0, sizeof(rx_msgs[i]));
+            rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+            rx_msgs[i].msg_hdr.msg_iovlen = 1;
+            rx_msgs[i].msg_hdr.msg_control = rx_cbuf[i];
+            rx_msgs[i].msg_hdr.msg_controllen = IO_CBUF_SIZE;
+        }
+        if (io_backend == IO_MMSG)
+            n = recvmmsg(sock, rx_msgs, IO_BATCH, dontwait ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+        else if ((n = recvmsg(sock, &rx_msgs[0].msg_hdr, dontwait ? MSG_DONTWAIT : 0)) >= 0) {
+            rx_msgs[0].msg_len = n;
+            n = 1;
+        }
+        __atomic_add_fetch(&io_stats.rx_calls, 1, __ATOMIC_RELAXED);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (n < 0)
+            n = 0;
+    }
+    return n;
+}
+
+static int sock_recv(io_pkt_t *pkt, int dontwait) {
+    if (rx_next == rx_count) {
+        int n;
+        if (!dontwait)
+            io_flush();
+        // several sockets: none is read in a blocking call, poll them all
+        while ((n = sock_fill(dontwait)) == 0 && !dontwait)
+            io_wait(-1);
+        if (n <= 0)
+            return n;
+        rx_count = n;
+        rx_next = 0;
+    }
+    struct mmsghdr *m = &rx_msgs[rx_next];
+    pkt -> buf = rx_buf[rx_next++];
+    pkt -> size = m -> msg_len;
+    pkt -> ts = rx_timestamp(&m -> msg_hdr);
+    return 1;
+}
+
+// Receive up to 'n' datagrams of 'sock' into 'bufs' without waiting,
+// whatever the backend (workers of vrouter.c: one socket per router),
+// return their number (0: none, -1: error)
+int io_recv_batch(int sock, char (*bufs)[BUF_SIZE], io_pkt_t *pkts, int n) {
+    struct mmsghdr msgs[IO_BATCH];
+    struct iovec iov[IO_BATCH];
+    char cbuf[IO_BATCH][IO_CBUF_SIZE];
+    if (n > IO_BATCH)
+        n = IO_BATCH;
+    for (int i = 0; i < n; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = BUF_SIZE;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = cbuf[i];
+        msgs[i].msg_hdr.msg_controllen = IO_CBUF_SIZE;
+    }
+    n = recvmmsg(sock, msgs, n, MSG_DONTWAIT, NULL);
+    __atomic_add_fetch(&io_stats.rx_calls, 1, __ATOMIC_RELAXED);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    for (int i = 0; i < n; i++) {
+        pkts[i].buf = bufs[i];
+        pkts[i].size = msgs[i].msg_len;
+        pkts[i].ts = rx_timestamp(&msgs[i].msg_hdr);
+    }
+    __atomic_add_fetch(&io_stats.rx, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+#ifndef NO_URING
+static int uring_recv(io_pkt_t *pkt, int dontwait) {
+    int waited = 0;
+    if (rx_bid >= 0) {
+        rx_buf_add(rx_bid);
+        rx_bid = -1;
+    }
+    while (1) {
+        struct io_uring_cqe *cqe = ring_cqe(&rx_ring);
+        if (cqe == NULL) {
+            uring_rx_arm();
+            if (dontwait && waited)
+                return 0;
+            if (!dontwait)
+                io_flush();
+            // a non blocking call also runs the pending completions
+            if (ring_enter(&rx_ring, dontwait ? 0 : 1, -1) < 0 && errno != EINTR)
+                return -1;
+            __atomic_add_fetch(&io_stats.rx_calls, 1, __ATOMIC_RELAXED);
+            waited = 1;
+            continue;
+        }
+        int res = cqe -> res;
+        unsigned flags = cqe -> flags;
+        unsigned tag = cqe -> user_data;
+        int efd = tag == IO_EFD_TAG;
+        ring_seen(&rx_ring);
+        if (efd) {                  // shm_efd readable: io_recv reads the rings
+            efd_armed = flags & IORING_CQE_F_MORE;
+            continue;
+        }
+        if (!(flags & IORING_CQE_F_MORE))
+            rx_armed &= ~(1u << tag);   // multishot ended (no buffer left, error)
+        if (res < 0 && res != -ENOBUFS) {
+            errno = -res;
+            return -1;
+        }
+        if (res < 0 || !(flags & IORING_CQE_F_BUFFER))
+            continue;
+        int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) (rx_bufs + bid * IO_RX_SIZE);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = (char *) (out + 1) + rx_msg.msg_namelen;
+        msg.msg_controllen = out -> controllen;
+        pkt -> buf = (char *) (out + 1) + rx_msg.msg_namelen + rx_msg.msg_controllen;
+        pkt -> size = out -> payloadlen < BUF_SIZE ? out -> payloadlen : BUF_SIZE;
+        pkt -> ts = rx_timestamp(&msg);
+        rx_bid = bid;
+        return 1;
+    }
+}
+#endif
+
+static int backend_recv(io_pkt_t *pkt, int dontwait) {
+    int ret;
+#ifndef NO_URING
+    if (io_backend == IO_URING)
+        ret = uring_recv(pkt, dontwait);
+    else
+#endif
+    ret = sock_recv(pkt, dontwait);
+    if (ret > 0)
+        __atomic_add_fetch(&io_stats.rx, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+// Shared memory rings (at most IO_BATCH datagrams in a row), then the socket
+static int shm_or_backend(io_pkt_t *pkt) {
+    static int streak = 0;
+    if (streak < IO_BATCH && shm_recv(pkt)) {
+        streak++;
+        return 1;
+    }
+    streak = 0;
+    int ret = backend_recv(pkt, 1);
+    return ret != 0 ? ret : shm_recv(pkt);
+}
+
+// Next datagram (the sends queued by this thread are flushed before
+// waiting): return 1, 0 if none is ready and 'dontwait', -1 on error
+int io_recv(io_pkt_t *pkt, int dontwait) {
+    if (__atomic_load_n(&shm_efd, __ATOMIC_ACQUIRE) < 0)
+        return backend_recv(pkt, dontwait);
+    int ret;
+    while ((ret = shm_or_backend(pkt)) == 0 && !dontwait)
+        io_wait(-1);
+    return ret;
+}
+
+// Wait up to 'ms' (-1: no timeout) for input on the socket or on the
+// shared memory rings (after flushing the queued sends)
+void io_wait(int ms) {
+    int efd = __atomic_load_n(&shm_efd, __ATOMIC_ACQUIRE);
+    io_flush();
+    if (efd >= 0 && !shm_sleep()) {
+        shm_wake();
+        return;
+    }
+#ifndef NO_URING
+    if (io_backend == IO_URING) {
+        if (ring_cqe(&rx_ring) == NULL) {
+            uring_rx_arm();
+            if (efd >= 0 && !efd_armed)
+                uring_efd_arm(efd);
+            ring_enter(&rx_ring, 1, ms);
+        }
+    } else
+#endif
+    if (rx_next == rx_count) {
+        struct pollfd pfd[MAX_IFACES + 1];
+        for (int i = 0; i < rx_nsocks; i++)
+            pfd[i] = (struct pollfd) {rx_socks[i], POLLIN, 0};
+        pfd[rx_nsocks] = (struct pollfd) {efd, POLLIN, 0};
+        poll(pfd, rx_nsocks + (efd >= 0), ms);
+    }
+    if (efd >= 0)
+        shm_wake();
+}
+
+/* ==================================================================== */
+/* =============================== SEND =============================== */
+/* ==================================================================== */
+
+struct io_tx {
+    int n;                          // queued datagrams
+    int sock[IO_BATCH];
+    char buf[IO_BATCH][IO_TX_SIZE];
+    sock_addr_t adr[IO_BATCH];
+    struct iovec iov[IO_BATCH];
+    struct mmsghdr msgs[IO_BATCH];
+#ifndef NO_URING
+    io_ring_t ring;                 // IO_URING
+#endif
+};
+
+// Open a send batch for the calling thread (none with IO_PLAIN)
+io_tx_t *io_tx_open() {
+    if (io_backend == IO_PLAIN)
+        return NULL;
+    io_tx_t *tx = calloc(1, sizeof(io_tx_t));
+    if (tx == NULL)
+        return NULL;
+#ifndef NO_URING
+    if (io_backend == IO_URING && !ring_open(&tx -> ring, IO_BATCH, 2 * IO_BATCH)) {
+        logger("ERROR", "io_uring for the sends: %s", strerror(errno));
+        free(tx);
+        return NULL;
+    }
+#endif
+    io_tx = tx;
+    return tx;
+}
+
+// Send a datagram to neighbor 'neigh', queued if the thread has a batch
+// (through its ring if it is co-located, see shm.h, through netem when
+// the links are emulated), return -1 on error. A queued datagram is not
+// an error: the batch errors are counted and logged by io_flush.
+int io_send(int sock, const void *buf, int len, node_id_t neigh, const sock_addr_t *adr) {
+    io_tx_t *tx = io_tx;
+    if (!netem_on && shm_send(neigh, buf, len))     // co-located neighbor
+        return len;
+    if (tx == NULL || netem_on || len > IO_TX_SIZE)
+        return netem_sendto(sock, buf, len, neigh, adr);
+    if (tx -> n == IO_BATCH)
+        io_flush();                 // earlier datagrams, to other neighbors
+    int i = tx -> n++;
+    memcpy(tx -> buf[i], buf, len);
+    tx -> sock[i] = sock;
+    tx -> adr[i] = *adr;
+    tx -> iov[i].iov_base = tx -> buf[i];
+    tx -> iov[i].iov_len = len;
+    memset(&tx -> msgs[i], 0, sizeof(tx -> msgs[i]));
+    tx -> msgs[i].msg_hdr.msg_name = &tx -> adr[i];
+    tx -> msgs[i].msg_hdr.msg_namelen = SOCK_ADDR_LEN(adr);
+    tx -> msgs[i].msg_hdr.msg_iov = &tx -> iov[i];
+    tx -> msgs[i].msg_hdr.msg_iovlen = 1;
+    return len;
+}
+
+#ifndef NO_URING
+// Return the number of datagrams not sent (errno: the last error)
+static int uring_flush(io_tx_t *tx) {
+    int err = 0, failed = 0, done = 0;
+    for (int i = 0; i < tx -> n; i++) {
+        struct io_uring_sqe *sqe = ring_sqe(&tx -> ring);
+        sqe -> opcode = IORING_OP_SENDMSG;
+        sqe -> fd = tx -> sock[i];
+        sqe -> addr = (unsigned long) &tx -> msgs[i].msg_hdr;
+        sqe -> len = 1;
+        sqe -> user_data = i;
+    }
+    while (done < tx -> n) {
+        if (ring_enter(&tx -> ring, tx -> n - done, -1) < 0 && errno != EINTR)
+            return tx -> n - done + failed;
+        __atomic_add_fetch(&io_stats.tx_calls, 1, __ATOMIC_RELAXED);
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring_cqe(&tx -> ring)) != NULL) {
+            if (cqe -> res < 0) {
+                err = -cqe -> res;
+                failed++;
+            }
+            ring_seen(&tx -> ring);
+            done++;
+        }
+    }
+    errno = err;
+    return failed;
+}
+#endif
+
+// Return the number of datagrams not sent (errno: the last error)
+static int mmsg_flush(io_tx_t *tx) {
+    int err = 0, failed = 0;
+    for (int i = 0; i < tx -> n; ) {
+        int j = i + 1;              // same socket: one sendmmsg
+        while (j < tx -> n && tx -> sock[j] == tx -> sock[i])
+            j++;
+        int sent = sendmmsg(tx -> sock[i], tx -> msgs + i, j - i, 0);
+        __atomic_add_fetch(&io_stats.tx_calls, 1, __ATOMIC_RELAXED);
+        if (sent < 0) {
+            err = errno;
+            failed++;
+            sent = 1;               // skip the failed datagram
+        }
+        i += sent;
+    }
+    errno = err;
+    return failed;
+}
+
+// Send the datagrams queued by the calling thread. The datagrams that
+// fail (e.g. an unreachable neighbor) are counted and logged, the others
+// are still sent; return -1 if one failed.
+int io_flush() {
+    io_tx_t *tx = io_tx;
+    if (tx == NULL || tx -> n == 0)
+        return 0;
+    int failed;
+#ifndef NO_URING
+    if (io_backend == IO_URING)
+        failed = uring_flush(tx);
+    else
+#endif
+    failed = mmsg_flush(tx);
+    __atomic_add_fetch(&io_stats.tx, tx -> n, __ATOMIC_RELAXED);
+    tx -> n = 0;
+    if (failed == 0)
+        return 0;
+    __atomic_add_fetch(&io_stats.tx_errors, failed, __ATOMIC_RELAXED);
+    logger("ERROR", "send batch: %d datagrams not sent (%s)", failed, strerror(errno));
+    return -1;
+}
+
+/* ==================================================================== */
+/* ============================= SETTINGS ============================= */
+/* ==================================================================== */
+
+// Select the backend (before the threads start), return 0 if unknown;
+// uring falls back to mmsg if the kernel does not support it
+int io_set_backend(const char *name) {
+    if (!strcmp(name, "plain"))
+        io_backend = IO_PLAIN;
+    else if (!strcmp(name, "mmsg"))
+        io_backend = IO_MMSG;
+    else if (!strcmp(name, "uring")) {
+        io_backend = IO_MMSG;
+#ifndef NO_URING
+        if (uring_rx_init(1))
+            io_backend = IO_URING;
+        else
+            fprintf(stderr, "io_uring unavailable (%s), using recvmmsg/sendmmsg\n", strerror(errno));
+#else
+        fprintf(stderr, "built without io_uring, using recvmmsg/sendmmsg\n");
+#endif
+    } else
+        return 0;
+    return 1;
+}
+
+const char *io_backend_name(int backend) {
+    static const char *names[] = {"plain", "mmsg", "uring"};
+    return backend >= 0 && backend <= IO_URING ? names[backend] : "?";
+}
+
+void print_io(FILE *out) {
+    io_stats_t s = io_stats;
+    fprintf(out, "I/O backend %s\n", io_backend_name(io_backend));
+    fprintf(out, "Received\t %lu datagrams, %lu syscalls (%.1f per call)\n", s.rx, s.rx_calls,
+            s.rx_calls ? (double) s.rx / s.rx_calls : 0);
+    fprintf(out, "Batched sends\t %lu datagrams, %lu syscalls (%.1f per call)\n", s.tx, s.tx_calls,
+            s.tx_calls ? (double) s.tx / s.tx_calls : 0);
+    fprintf(out, "Send errors\t %lu datagrams\n", s.tx_errors);
+}
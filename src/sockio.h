@@ -0,0 +1,70 @@
+#ifndef __SOCKIO_H__
+#define __SOCKIO_H__
+
+#include <stdio.h>
+#include <netinet/in.h>
+#include "router.h"
+
+// I/O backends of the input thread (receive, forward) and of the hello
+// thread (DV broadcasts), chosen at build time (IO_DEFAULT) or at startup
+// with --io <name>:
+//   plain   recvmsg/sendto, one syscall per datagram
+//   mmsg    recvmmsg/sendmmsg, up to IO_BATCH datagrams per syscall
+//   uring   io_uring: multishot recvmsg into a ring of provided buffers,
+//           sends queued and submitted IO_BATCH at a time
+// The input thread receives on the sockets of all the interfaces of the
+// router (one multishot recvmsg each with io_uring, in turn otherwise).
+// Sends are queued by io_send on the threads that opened a batch
+// (io_tx_open), and flushed before the thread waits. Built without
+// io_uring with -DNO_URING; uring falls back to mmsg if the kernel
+// refuses it.
+#define IO_PLAIN 0
+#define IO_MMSG 1
+#define IO_URING 2
+
+#ifndef IO_DEFAULT
+#define IO_DEFAULT IO_PLAIN         // without --io (e.g. -DIO_DEFAULT=IO_URING)
+#endif
+
+#define IO_BATCH 32                 // datagrams per recvmmsg/sendmmsg/submission
+#define IO_RX_BUFS 64               // io_uring provided buffers (power of 2)
+
+// Datagram returned by io_recv (valid until the next call)
+typedef struct {
+    char *buf;                      // aligned on 8 bytes, BUF_SIZE bytes of room
+    int size;
+    long ts;                        // kernel receive timestamp (ns, 0: none)
+} io_pkt_t;
+
+typedef struct {
+    unsigned long rx_calls;         // syscalls of the receive path
+    unsigned long rx;               // datagrams received
+    unsigned long tx_calls;         // syscalls of the batched sends
+    unsigned long tx;               // datagrams sent through a batch
+    unsigned long tx_errors;        // datagrams of a batch the kernel refused
+} io_stats_t;
+
+typedef struct io_tx io_tx_t;
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int io_backend;              // IO_xxx, set before the threads start
+extern __thread io_tx_t *io_tx;     // send batch of the thread (NULL: direct sends)
+/* ============================= */
+
+/* ==================================================================== */
+int io_set_backend(const char *name);
+const char *io_backend_name(int backend);
+
+int io_rx_open(const int *socks, int n);
+int io_recv(io_pkt_t *pkt, int dontwait);
+int io_recv_batch(int sock, char (*bufs)[BUF_SIZE], io_pkt_t *pkts, int n);
+void io_wait(int ms);
+
+io_tx_t *io_tx_open();
+int io_send(int sock, const void *buf, int len, node_id_t neigh, const sock_addr_t *adr);
+int io_flush();
+
+void print_io(FILE *out);
+
+#endif
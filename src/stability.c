@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stability.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+int stab_poison = 0;
+int stab_holddown = 0;
+int stab_half_life = 0;
+/* ============================= */
+
+// Settings of the topology file (poison, holddown and damping lines)
+void stab_config(const neighbors_table_t *nt) {
+    stab_poison = nt -> poison;
+    stab_holddown = nt -> holddown;
+    stab_half_life = nt -> half_life;
+}
+
+/* ==================================================================== */
+/* ============================= DAMPING ============================== */
+/* ==================================================================== */
+
+// Decay the penalty of 'd' to 'now': halved every stab_half_life s,
+// linear in between (no libm), reuse the route under STAB_REUSE.
+// Without damping the history is cleared.
+static void damp_decay(route_damp_t *d, node_id_t dest, time_t now) {
+    long dt = now - d -> time;
+    d -> time = now;
+    if (stab_half_life <= 0)
+        d -> penalty = d -> suppressed = 0;
+    if (d -> penalty == 0 || dt <= 0)
+        return;
+    long halves = dt / stab_half_life;
+    unsigned int p = halves >= 16 ? 0 : d -> penalty >> halves;
+    d -> penalty = p - p * (dt % stab_half_life) / (2 * stab_half_life);
+    if (d -> suppressed && d -> penalty < STAB_REUSE) {
+        d -> suppressed = 0;
+        logger("DAMPING", "route to R%d reused (penalty %u)", dest, d -> penalty);
+    }
+}
+
+// The route to node 'dest' was lost: add a flap to its penalty
+static void damp_flap(routing_table_t *rt, node_id_t dest, time_t now) {
+    route_damp_t *d = &rt -> damp[dest];
+    damp_decay(d, dest, now);
+    d -> penalty += STAB_PENALTY;
+    if (d -> penalty > STAB_MAX_PENALTY)
+        d -> penalty = STAB_MAX_PENALTY;
+    if (!d -> suppressed && d -> penalty >= STAB_SUPPRESS) {
+        d -> suppressed = 1;
+        logger("DAMPING", "route to R%d suppressed (penalty %u)", dest, d -> penalty);
+    }
+}
+
+/* ==================================================================== */
+/* ============================ DV MERGE ============================== */
+/* ==================================================================== */
+
+// The next hop of 'r' advertised the worse 'metric' (MAX_METRIC + 1: lost,
+// also when the route expired): hold the route down, count the loss as a
+// flap (called before 'r' is updated)
+void stab_worse(routing_table_t *rt, routing_table_entry_t *r, int metric, time_t now) {
+    if (r -> metric > MAX_METRIC)
+        return;                         // already lost
+    if (metric > MAX_METRIC)
+        cur_router -> lost++;           // triggered DVs
+    if (stab_holddown > 0) {
+        if (r -> hold <= now)
+            r -> hold_metric = r -> metric;
+        if (r -> hold <= now || metric > MAX_METRIC)
+            r -> hold = now + stab_holddown;
+    }
+    if (metric > MAX_METRIC && stab_half_life > 0 && r -> plen == ID_BITS)
+        damp_flap(rt, r -> dest, now);
+}
+
+// Can a DV with 'metric' for 'dest'/'plen' give route 'r' (NULL: none) a
+// new next hop, or make it reachable again? Return 0 while the route is
+// held down (unless the metric is better than before) or suppressed.
+int stab_accept(routing_table_t *rt, routing_table_entry_t *r, node_id_t dest, int plen,
+                int metric, time_t now) {
+    if (plen == ID_BITS && (r == NULL || r -> metric > MAX_METRIC) && rt -> damp[dest].suppressed) {
+        damp_decay(&rt -> damp[dest], dest, now);
+        if (rt -> damp[dest].suppressed)
+            return 0;
+    }
+    if (r != NULL && r -> hold > now) {
+        if (metric >= r -> hold_metric)
+            return 0;
+        r -> hold = 0;
+    }
+    return 1;
+}
+
+// Keep the unreachable route 'r' in the table? While it is held down, and
+// with poison reverse until it has been advertised (one period)
+int stab_keep(const routing_table_entry_t *r, time_t now) {
+    return r -> hold > now || (stab_poison && difftime(now, r -> time) <= BROADCAST_PERIOD);
+}
+
+/* ==================================================================== */
+/* ============================= COMMAND ============================== */
+/* ==================================================================== */
+
+void print_stability(FILE *out, routing_table_t *rt) {
+
+    time_t now = time(NULL);
+
+    fprintf(out, "Poison reverse %s, hold-down ", stab_poison ? "on" : "off");
+    if (stab_holddown > 0)
+        fprintf(out, "%d s, ", stab_holddown);
+    else
+        fprintf(out, "off, ");
+    if (stab_half_life > 0)
+        fprintf(out, "damping half-life %d s (penalty %d, suppress %d, reuse %d).\n",
+                stab_half_life, STAB_PENALTY, STAB_SUPPRESS, STAB_REUSE);
+    else
+        fprintf(out, "damping off.\n");
+    fprintf(out, "Dest | Next hop | Metric | Hold-down (s) | Penalty\n");
+    pthread_mutex_lock(&cur_router -> lock);
+    for (int d = 0; d < MAX_ROUTES; d++) {
+        int i = rt -> idx[d];
+        routing_table_entry_t *r = i < 0 ? NULL : &rt -> tab[i];
+        damp_decay(&rt -> damp[d], d, now);
+        if ((r == NULL || r -> hold <= now) && rt -> damp[d].penalty == 0)
+            continue;
+        if (r == NULL)
+            fprintf(out, "%4d |        - |      - | ", d);
+        else
+            fprintf(out, "%4d | %8d | %6d | ", d, r -> nexthop.id, r -> metric);
+        if (r != NULL && r -> hold > now)
+            fprintf(out, "%13.0f | ", difftime(r -> hold, now));
+        else
+            fprintf(out, "            - | ");
+        fprintf(out, "%u%s\n", rt -> damp[d].penalty, rt -> damp[d].suppressed ? " (suppressed)" : "");
+    }
+    pthread_mutex_unlock(&cur_router -> lock);
+}
+
+// Parse "stability [poison on|off | holddown <s> | damping <half-life s>|off]",
+// return 0 on syntax error
+int stability_command(const char *cmd, routing_table_t *rt, FILE *out) {
+
+    char temp[16], opt[16], arg[16], end;
+    int n = sscanf(cmd, "%15s%15s%15s %c", temp, opt, arg, &end), val;
+
+    if (n == 3 && !strcmp(opt, "poison") && (!strcmp(arg, "on") || !strcmp(arg, "off")))
+        stab_poison = !strcmp(arg, "on");
+    else if (n == 3 && !strcmp(opt, "holddown") && sscanf(arg, "%d%c", &val, &end) == 1 && val >= 0)
+        stab_holddown = val;
+    else if (n == 3 && !strcmp(opt, "damping") && !strcmp(arg, "off"))
+        stab_half_life = 0;
+    else if (n == 3 && !strcmp(opt, "damping") && sscanf(arg, "%d%c", &val, &end) == 1 && val > 0)
+        stab_half_life = val;
+    else if (n != 1)
+        return 0;
+    print_stability(out, rt);
+    return 1;
+}
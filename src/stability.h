@@ -0,0 +1,51 @@
+#ifndef __STABILITY_H__
+#define __STABILITY_H__
+
+#include <stdio.h>
+#include <time.h>
+#include "router.h"
+
+// Route stability, each part enabled apart (topology lines or 'stability'):
+// - poison reverse: the routes learned from a neighbor are sent back to it
+//   with an infinite metric instead of being left out of its DV, and a
+//   lost route (withdrawn by its next hop or expired) stays in the table,
+//   unreachable, until it has been advertised as such (route poisoning);
+// - hold-down: when its next hop makes a route worse or loses it, or the
+//   route expires, the route is held down for stab_holddown s: only a
+//   metric better than the one it had before is accepted (from any
+//   neighbor), so the stale routes still going around a loop are ignored;
+// - flap damping (RFC 2439, in seconds): each loss of the route to a node
+//   adds STAB_PENALTY to the penalty of the node, which is halved every
+//   stab_half_life s. Above STAB_SUPPRESS the route is not learned again
+//   until the penalty is back under STAB_REUSE.
+// With poison reverse, a DV that makes routes lost also triggers our DVs
+// to all the neighbors at once (at most every STAB_TRIGGER_GAP s) instead
+// of waiting for the next period, so that the poison spreads quickly.
+// Unreachable routes are not in the FIB: their packets are dropped here.
+#define STAB_INFINITY MAX_METRIC        // metric advertised for an unreachable route (+1 by the neighbor)
+#define STAB_HOLDDOWN BROADCAST_PERIOD  // s, 'holddown' without value
+#define STAB_HALF_LIFE (3 * BROADCAST_PERIOD)  // s, 'damping' without value
+#define STAB_TRIGGER_GAP 1             // s between triggered DVs
+#define STAB_PENALTY 1000
+#define STAB_SUPPRESS 2000
+#define STAB_REUSE 750
+#define STAB_MAX_PENALTY (16 * STAB_REUSE)     // suppressed for 4 half-lives at most
+
+/* ============================= */
+/*  Shared data between threads  */
+extern int stab_poison;             // poison reverse
+extern int stab_holddown;           // s (0: no hold-down)
+extern int stab_half_life;          // s (0: no flap damping)
+/* ============================= */
+
+/* ==================================================================== */
+void stab_config(const neighbors_table_t *nt);
+void stab_worse(routing_table_t *rt, routing_table_entry_t *r, int metric, time_t now);
+int stab_accept(routing_table_t *rt, routing_table_entry_t *r, node_id_t dest, int plen,
+                int metric, time_t now);
+int stab_keep(const routing_table_entry_t *r, time_t now);
+
+void print_stability(FILE *out, routing_table_t *rt);
+int stability_command(const char *cmd, routing_table_t *rt, FILE *out);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+
+#include "vrouter.h"
+#include "control.h"
+#include "capture.h"
+#include "latency.h"
+#include "sockio.h"
+#include "reliable.h"
+#include "adaptive.h"
+
+/* ============================= */
+/*  Shared data between threads  */
+static int epfd = -1;                       // sockets of the routers and timer
+static int tfd = -1;                        // timer wheel ticks (data.ptr NULL)
+static router_t *wheel[VR_WHEEL_SLOTS];     // routers of each slot (wheel_next)
+static int wheel_pos = 0;                   // next slot (worker holding tfd)
+/* ============================= */
+
+/* ==================================================================== */
+/* ============================== HELPERS ============================= */
+/* ==================================================================== */
+
+// Range of router ids "<first>-<last>" or "all", return 0 for a single id
+// and -1 for an invalid range
+int vr_parse_ids(const char *arg, int *first, int *last) {
+    char end;
+    if (!strcmp(arg, "all")) {
+        *first = 1;
+        *last = MAX_ROUTES - 1;
+        return 1;
+    }
+    if (strchr(arg, '-') == NULL)
+        return 0;
+    if (sscanf(arg, "%d-%d%c", first, last, &end) != 2
+            || *first < 1 || *last >= MAX_ROUTES || *first > *last)
+        return -1;
+    return 1;
+}
+
+// (Re)arm a file descriptor of the epoll set for one event
+static void vr_arm(int op, int fd, void *ptr) {
+    struct epoll_event ev = {EPOLLIN | EPOLLONESHOT, {.ptr = ptr}};
+    if (epoll_ctl(epfd, op, fd, &ev) < 0) {
+        perror("epoll_ctl error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* ==================================================================== */
+/* ============================== WORKERS ============================= */
+/* ==================================================================== */
+
+// Handle the datagrams waiting on socket 'sock' of 'r' (a few batches at
+// most, the socket is re-armed if some are left)
+static void vr_serve_sock(router_t *r, int sock, char (*bufs)[BUF_SIZE], io_pkt_t *pkts) {
+    for (int b = 0; b < VR_RX_BATCHES; b++) {
+        int n = io_recv_batch(sock, bufs, pkts, IO_BATCH);
+        if (n < 0)
+            logger("ERROR", "recvmmsg %s", strerror(errno));
+        if (n <= 0)
+            return;
+        pthread_mutex_lock(&r -> lock);
+        for (int i = 0; i < n; i++) {
+            lat_rx_ns = pkts[i].ts;
+            CAP_PACKET(CAP_RX, 0, pkts[i].buf, pkts[i].size);
+            handle_packet(pkts[i].buf, pkts[i].size, &r -> args);
+        }
+        pthread_mutex_unlock(&r -> lock);
+        if (n < IO_BATCH)
+            return;
+    }
+}
+
+// Handle the datagrams waiting on the sockets of the interfaces of 'r',
+// then re-arm them (the one that woke us up is not known)
+static void vr_serve(router_t *r, char (*bufs)[BUF_SIZE], io_pkt_t *pkts) {
+    cur_router = r;
+    for (int i = 0; i < r -> nb_socks; i++)
+        vr_serve_sock(r, r -> if_sock[i], bufs, pkts);
+    for (int i = 0; i < r -> nb_socks; i++)
+        vr_arm(EPOLL_CTL_MOD, r -> if_sock[i], r);
+}
+
+// Timer wheel: send the periodic DVs of the routers of the elapsed slots
+// (those that are due), expire the old routes of the others
+static void vr_tick() {
+    uint64_t ticks;
+    if (read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks))
+        return;
+    double now = rel_now();
+    while (ticks-- > 0) {
+        for (router_t *r = wheel[wheel_pos]; r != NULL; r = r -> wheel_next) {
+            int ok = 1;
+            cur_router = r;
+            pthread_mutex_lock(&r -> lock);
+            if (adapt_due(now))
+                ok = broadcast_dv(&r -> rt, &r -> nt, r -> periods++ == 0);
+            else
+                remove_obsolete_entries(&r -> rt);
+            pthread_mutex_unlock(&r -> lock);
+            if (!ok)
+                logger("ERROR", "sendto %s", strerror(errno));
+        }
+        wheel_pos = (wheel_pos + 1) % VR_WHEEL_SLOTS;
+    }
+}
+
+// Worker thread: serve the routers (and the timer) that have events,
+// one at a time
+static void *vr_worker(void *args) {
+
+    char (*bufs)[BUF_SIZE] = malloc(IO_BATCH * BUF_SIZE);  // packets cast in place
+    io_pkt_t pkts[IO_BATCH];
+    struct epoll_event ev;
+
+    if (bufs == NULL) {
+        perror("worker malloc error");
+        exit(EXIT_FAILURE);
+    }
+    io_tx_open();               // forwarded packets and DVs sent in batches
+    while (1) {
+        io_flush();
+        if (epoll_wait(epfd, &ev, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait error");
+            exit(EXIT_FAILURE);
+        }
+        if (ev.data.ptr == NULL) {
+            vr_tick();
+            vr_arm(EPOLL_CTL_MOD, tfd, NULL);
+        } else {
+            vr_serve(ev.data.ptr, bufs, pkts);
+        }
+    }
+    return NULL;
+}
+
+/* ==================================================================== */
+/* =============================== DAEMON ============================= */
+/* ==================================================================== */
+
+// Run the routers first .. last of the topology file (those with
+// neighbors) on 'workers' threads (0: one per CPU), return 0 if there
+// is none
+int vr_main(char *topo, int first, int last, int workers) {
+
+    pthread_t th_id[VR_MAX_WORKERS], ctl_id;
+    ctl_routers_t routers = {NULL, 0};
+    struct itimerspec tick = {{0, VR_WHEEL_TICK * 1000000L}, {0, VR_WHEEL_TICK * 1000000L}};
+
+    multi_router = 1;
+    routers.tab = malloc((last - first + 1) * sizeof(router_t *));
+    if (routers.tab == NULL) {
+        perror("malloc error");
+        exit(EXIT_FAILURE);
+    }
+    for (int id = first; id <= last; id++) {
+        router_t *r = malloc(sizeof(router_t));
+        if (r == NULL) {
+            perror("malloc error");
+            exit(EXIT_FAILURE);
+        }
+        router_init(r, id);
+        cur_router = r;
+        read_neighbors(topo, id, &r -> nt);
+        if (r -> nt.size == 0) {        // not in the topology
+            free(r);
+            continue;
+        }
+        init_routing_table(&r -> rt);
+        r -> args.topo = topo;
+        open_ifaces(r);         // read without waiting (io_recv_batch)
+        routers.tab[routers.size++] = r;
+    }
+    if (routers.size == 0)
+        return 0;
+
+    if ((epfd = epoll_create1(0)) < 0 || (tfd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0) {
+        perror("daemon socket error");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < routers.size; i++) {
+        router_t *r = routers.tab[i];
+        int slot = i * (VR_STAGGER / VR_WHEEL_TICK) / routers.size;
+        r -> wheel_next = wheel[slot];
+        wheel[slot] = r;
+        for (int s = 0; s < r -> nb_socks; s++)
+            vr_arm(EPOLL_CTL_ADD, r -> if_sock[s], r);
+    }
+    timerfd_settime(tfd, 0, &tick, NULL);
+    vr_arm(EPOLL_CTL_ADD, tfd, NULL);
+
+    if (workers <= 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > VR_MAX_WORKERS)
+        workers = VR_MAX_WORKERS;
+    if (workers < 1)
+        workers = 1;
+    printf("%d routers (R%d .. R%d), %d workers\n", routers.size, routers.tab[0] -> id,
+           routers.tab[routers.size - 1] -> id, workers);
+    fflush(stdout);
+
+    signal(SIGHUP, SIG_IGN);    // 'reload' through the control sockets
+    pthread_create(&ctl_id, NULL, &control_server, &routers);
+    for (int i = 0; i < workers; i++)
+        pthread_create(&th_id[i], NULL, &vr_worker, NULL);
+    pthread_join(th_id[0], NULL);       // runs until killed
+    return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef __VROUTER_H__
+#define __VROUTER_H__
+
+#include "router.h"
+
+// Daemon hosting several routers in one process (./router <first>-<last>
+// or all): each router keeps its own tables, counters, lock, UDP port,
+// control socket and control probes (router_t), but they share a pool of
+// worker threads.
+// The UDP sockets of all the routers are in one epoll set with
+// EPOLLONESHOT: a router is served by one worker at a time, which drains
+// a few batches of its socket and re-arms it. The periodic DVs are sent
+// from a timer wheel in the same set: a timerfd ticks every VR_WHEEL_TICK
+// ms and each router sits in one slot of the wheel, a turn of which is
+// BROADCAST_PERIOD (with an adaptive DV interval, a router skips the
+// turns before its next DVs, see adaptive.h). The first DVs of the
+// routers are spread over VR_STAGGER ms. The features that are global to a process (console,
+// SIGHUP reload, rate limiting, reliable DVs, netem, shm) are not
+// available: the topology lines and commands that set them are ignored.
+// A capture records the packets of all the routers (each record carries
+// its router) and the latency switches apply to all, but each router has
+// its own histograms.
+// A router with several interfaces ('node' lines) has one socket in the
+// set for each: the worker woken by one of them drains them all (two of
+// them may wake two workers at once, the router lock orders the packets).
+#define VR_MAX_WORKERS 64
+#define VR_WHEEL_TICK 100           // ms
+#define VR_WHEEL_SLOTS (BROADCAST_PERIOD * 1000 / VR_WHEEL_TICK)
+#define VR_STAGGER 1000             // ms
+#define VR_RX_BATCHES 4             // recvmmsg batches before the next router
+
+/* ==================================================================== */
+int vr_parse_ids(const char *arg, int *first, int *last);
+int vr_main(char *topo, int first, int last, int workers);
+
+#endif
@@ -0,0 +1,163 @@
+/*********************************
+**   Packet loss injection      **
+*********************************/
+
+/* LD_PRELOAD shim dropping a share of the UDP datagrams sent by a router,
+ * to test the routing protocol on lossy links without root privileges
+ * (netem needs CAP_NET_ADMIN).
+ *
+ * Usage: LD_PRELOAD=tools/lossshim.so LOSS=0.3 ./router 1 topos/t4.txt
+ *   LOSS=<p>            drop probability, 0 to 1 (default 0)
+ *   LOSS_TYPE=<t>       all, data or ctrl (CTRL and ACK packets, default all)
+ *   LOSS_SEED=<n>       random seed (default: pid)
+ * The dropped datagrams are reported as sent. Only the IPv4 and IPv6
+ * destinations of sendto and sendmmsg (--io plain and mmsg) are affected
+ * (not the control socket). The shim cannot see the datagrams sent through
+ * io_uring (--io uring: forwarded packets, DVs and ACKs) or the shared
+ * memory rings (shm): it warns when the router uses them, and drops
+ * nothing on these paths.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../src/packet.h"
+
+// glibc declares the address as a transparent union with _GNU_SOURCE
+typedef ssize_t (*sendto_fn)(int, const void *, size_t, int, __CONST_SOCKADDR_ARG, socklen_t);
+typedef int (*sendmmsg_fn)(int, struct mmsghdr *, unsigned int, int);
+typedef int (*memfd_create_fn)(const char *, unsigned int);
+
+#define SHIM_BATCH 64                   // datagrams per real sendmmsg
+
+static sendto_fn real_sendto;
+static sendmmsg_fn real_sendmmsg;
+static memfd_create_fn real_memfd_create;
+static double loss = 0;
+static int loss_type = -1;              // -1: all, DATA or CTRL (CTRL and ACK)
+static struct drand48_data rnd;
+static pthread_mutex_t rnd_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long dropped, seen;
+
+__attribute__((constructor))
+static void shim_init() {
+    char *s;
+    *(void **) &real_sendto = dlsym(RTLD_NEXT, "sendto");     // POSIX idiom, no pedantic warning
+    *(void **) &real_sendmmsg = dlsym(RTLD_NEXT, "sendmmsg");
+    *(void **) &real_memfd_create = dlsym(RTLD_NEXT, "memfd_create");
+    if ((s = getenv("LOSS")) != NULL)
+        loss = atof(s);
+    if ((s = getenv("LOSS_TYPE")) != NULL) {
+        if (!strcmp(s, "data"))
+            loss_type = DATA;
+        else if (!strcmp(s, "ctrl"))
+            loss_type = CTRL;
+        else if (strcmp(s, "all"))
+            fprintf(stderr, "lossshim: unknown LOSS_TYPE %s, dropping all types\n", s);
+    }
+    s = getenv("LOSS_SEED");
+    srand48_r(s != NULL ? atol(s) : getpid(), &rnd);
+
+    // --io uring: the sends bypass the libc (the backend may still fall
+    // back to mmsg on an old kernel)
+    FILE *f = fopen("/proc/self/cmdline", "r");
+    char arg[64], prev[64] = "";
+    int c, n = 0;
+    while (f != NULL && loss > 0 && (c = fgetc(f)) != EOF) {
+        if (c != '\0' && n < (int) sizeof(arg) - 1) {
+            arg[n++] = c;
+            continue;
+        }
+        arg[n] = '\0';
+        n = 0;
+        if (!strcmp(prev, "--io") && !strcmp(arg, "uring"))
+            fprintf(stderr, "lossshim: warning, the io_uring sends (forwarded packets, DVs "
+                    "and ACKs) are not intercepted\n");
+        strcpy(prev, arg);
+    }
+    if (f != NULL)
+        fclose(f);
+}
+
+__attribute__((destructor))
+static void shim_fini() {
+    if (loss > 0)
+        fprintf(stderr, "lossshim: %lu/%lu datagrams dropped\n", dropped, seen);
+}
+
+static int drop(const unsigned char *p, size_t len) {
+    if (loss <= 0 || len == 0)
+        return 0;
+    if (loss_type == DATA && p[0] != DATA)
+        return 0;
+    if (loss_type == CTRL && p[0] != CTRL && p[0] != ACK)
+        return 0;
+    double r;
+    pthread_mutex_lock(&rnd_lock);
+    drand48_r(&rnd, &r);
+    seen++;
+    if (r < loss)
+        dropped++;
+    pthread_mutex_unlock(&rnd_lock);
+    return r < loss;
+}
+
+static int is_ip(const struct sockaddr *sa) {
+    return sa != NULL && (sa -> sa_family == AF_INET || sa -> sa_family == AF_INET6);
+}
+
+ssize_t sendto(int sock, const void *buf, size_t len, int flags,
+               __CONST_SOCKADDR_ARG to, socklen_t tolen) {
+    if (is_ip(to.__sockaddr__) && drop(buf, len))
+        return len;
+    return real_sendto(sock, buf, len, flags, to, tolen);
+}
+
+// The kept datagrams go through the real sendmmsg, the dropped ones are
+// counted as sent (msg_len set) in their place of the vector
+int sendmmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    struct mmsghdr kept[SHIM_BATCH];
+    unsigned int idx[SHIM_BATCH];       // index in msgs of each kept datagram
+    unsigned int done = 0;
+    while (done < vlen) {
+        unsigned int i, n = 0;
+        for (i = done; i < vlen && n < SHIM_BATCH; i++) {
+            struct msghdr *h = &msgs[i].msg_hdr;
+            if (is_ip(h -> msg_name) && h -> msg_iovlen > 0
+                    && drop(h -> msg_iov[0].iov_base, h -> msg_iov[0].iov_len)) {
+                msgs[i].msg_len = 0;
+                for (size_t k = 0; k < h -> msg_iovlen; k++)
+                    msgs[i].msg_len += h -> msg_iov[k].iov_len;
+                continue;
+            }
+            kept[n] = msgs[i];
+            idx[n++] = i;
+        }
+        int sent = n > 0 ? real_sendmmsg(sock, kept, n, flags) : 0;
+        for (int k = 0; k < sent; k++)
+            msgs[idx[k]].msg_len = kept[k].msg_len;
+        if (sent < (int) n) {           // stopped at kept[sent] (error if it is the first)
+            unsigned int first = idx[sent < 0 ? 0 : sent];
+            return first > 0 ? (int) first : -1;
+        }
+        done = i;
+    }
+    return vlen;
+}
+
+// The shared memory rings (shm.c) carry the datagrams to the co-located
+// neighbors without any send call
+int memfd_create(const char *name, unsigned int flags) {
+    static int warned = 0;
+    if (loss > 0 && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+        fprintf(stderr, "lossshim: warning, the datagrams sent over shared memory rings "
+                "are not intercepted\n");
+    return real_memfd_create(name, flags);
+}
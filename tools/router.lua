@@ -0,0 +1,147 @@
+-- Wireshark dissector for the router captures (capture save <file>)
+--
+-- Link type DLT_USER0 (147): each frame is a 4-byte pseudo header
+-- (see cap_hdr_t in src/capture.h) followed by the raw datagram
+-- (packet_data_t and its payload, packet_ctrl_t or packet_ack_t, host byte
+-- order, x86_64 layout).
+--
+-- Usage: wireshark -X lua_script:tools/router.lua capture.pcap
+--    or: tshark -X lua_script:tools/router.lua -r capture.pcap -V
+
+local proto = Proto("router", "Overlay router")
+
+local dirs = { [0] = "RX", [1] = "TX" }
+local types = { [0] = "DATA", [1] = "CTRL", [2] = "ACK" }
+local subtypes = {
+    [1] = "ECHO_REQUEST", [2] = "ECHO_REPLY",
+    [10] = "TR_REQUEST", [11] = "TR_TIME_EXCEEDED", [12] = "TR_ARRIVED",
+    [20] = "BULK_DATA", [21] = "BULK_END", [22] = "BULK_REPORT",
+}
+
+local f = proto.fields
+f.version   = ProtoField.uint8("router.cap.version", "Capture version")
+f.dir       = ProtoField.uint8("router.cap.dir", "Direction", base.DEC, dirs)
+f.router    = ProtoField.uint8("router.cap.router", "Router")
+f.peer      = ProtoField.uint8("router.cap.peer", "Peer")
+f.type      = ProtoField.uint8("router.type", "Type", base.DEC, types)
+f.subtype   = ProtoField.uint8("router.subtype", "Subtype", base.DEC, subtypes)
+f.src       = ProtoField.uint8("router.src", "Source")
+f.dst       = ProtoField.uint8("router.dst", "Destination")
+f.ttl       = ProtoField.uint8("router.ttl", "TTL")
+f.seq       = ProtoField.uint8("router.seq", "Sequence")
+f.len       = ProtoField.uint16("router.len", "Payload length")
+f.time_sec  = ProtoField.uint64("router.time_sec", "Time (s)")
+f.time_nsec = ProtoField.uint64("router.time_nsec", "Time (ns)")
+f.dv_size   = ProtoField.uint8("router.dv_size", "DV size")
+f.period    = ProtoField.uint8("router.period", "Next DVs in (s)")
+f.dv_dest   = ProtoField.uint8("router.dv.dest", "Destination")
+f.dv_metric = ProtoField.uint8("router.dv.metric", "Metric")
+f.hop_id    = ProtoField.uint8("router.hop.id", "Router")
+f.hop_rx    = ProtoField.uint64("router.hop.rx_ns", "Received (ns)")
+f.hop_res   = ProtoField.uint32("router.hop.res_ns", "In router (ns)")
+f.rel_seq   = ProtoField.uint16("router.rel.seq", "DV sequence")
+f.payload   = ProtoField.bytes("router.payload", "Payload")
+f.bulk_flow = ProtoField.uint32("router.bulk.flow", "Flow", base.HEX)
+f.bulk_seq  = ProtoField.uint32("router.bulk.seq", "Packet")
+
+local DATA_SIZE = 24    -- sizeof(packet_data_t)
+local CTRL_HDR_SIZE = 4
+local HOPTS_MAGIC = 0xd7    -- hop timestamps trailer (see src/latency.h)
+local HOPTS_HDR_SIZE, HOPTS_ENTRY_SIZE = 8, 16
+local REL_MAGIC = 0xa5      -- reliable DV trailer (see src/reliable.h)
+local REL_SIZE, ACK_SIZE = 4, 4
+local BULK_HDR_SIZE = 8     -- bulk_hdr_t (see src/bulk.h)
+
+function proto.dissector(buf, pinfo, tree)
+    if buf:len() < 5 then return 0 end
+    pinfo.cols.protocol = "ROUTER"
+    local t = tree:add(proto, buf())
+
+    local router, peer = buf(2, 1):uint(), buf(3, 1):uint()
+    local dir = buf(1, 1):uint()
+    local cap = t:add(proto, buf(0, 4), "Capture")
+    local peer_name = peer == 0 and "?" or ("R" .. peer)    -- unknown for RX
+    cap:set_text(string.format("Capture: R%d %s %s", router,
+                               dir == 0 and "<-" or "->", peer_name))
+    cap:add(f.version, buf(0, 1))
+    cap:add(f.dir, buf(1, 1))
+    cap:add(f.router, buf(2, 1))
+    cap:add(f.peer, buf(3, 1))
+    if dir == 0 then
+        pinfo.cols.src, pinfo.cols.dst = peer_name, "R" .. router
+    else
+        pinfo.cols.src, pinfo.cols.dst = "R" .. router, peer_name
+    end
+
+    local p = buf(4)
+    local ptype = p(0, 1):uint()
+    t:add(f.type, p(0, 1))
+
+    if ptype == 0 and p:len() >= DATA_SIZE then
+        local sub = p(1, 1):uint()
+        t:add(f.subtype, p(1, 1))
+        t:add(f.src, p(2, 1))
+        t:add(f.dst, p(3, 1))
+        t:add(f.ttl, p(4, 1))
+        t:add(f.seq, p(5, 1))
+        t:add_le(f.len, p(6, 2))
+        t:add_le(f.time_sec, p(8, 8))
+        t:add_le(f.time_nsec, p(16, 8))
+        pinfo.cols.info = string.format("%s R%d > R%d ttl=%d seq=%d",
+            subtypes[sub] or ("DATA " .. sub), p(2, 1):uint(), p(3, 1):uint(),
+            p(4, 1):uint(), p(5, 1):uint())
+        local len = p(6, 2):le_uint()
+        if len > 0 and p:len() >= DATA_SIZE + len then
+            local pl = t:add(f.payload, p(DATA_SIZE, len))
+            if sub >= 20 and sub <= 22 and len >= BULK_HDR_SIZE then   -- bulk_hdr_t first
+                pl:add_le(f.bulk_flow, p(DATA_SIZE, 4))
+                pl:add_le(f.bulk_seq, p(DATA_SIZE + 4, 4))
+                pinfo.cols.info = string.format("%s flow=%08x #%d len=%d", pinfo.cols.info,
+                    p(DATA_SIZE, 4):le_uint(), p(DATA_SIZE + 4, 4):le_uint(), len)
+            end
+        end
+        local hopts = DATA_SIZE + 8 * math.floor((len + 7) / 8)    -- HOPTS_OFFSET
+        if p:len() >= hopts + HOPTS_HDR_SIZE and p(hopts, 1):uint() == HOPTS_MAGIC then
+            local n = p(hopts + 1, 1):uint()
+            local hops = t:add(proto, p(hopts), string.format("Hop timestamps (%d)", n))
+            for i = 0, n - 1 do
+                local off = hopts + HOPTS_HDR_SIZE + HOPTS_ENTRY_SIZE * i
+                if off + HOPTS_ENTRY_SIZE > p:len() then break end
+                local e = p(off, HOPTS_ENTRY_SIZE)
+                local hop = hops:add(proto, e, string.format("R%d", e(12, 1):uint()))
+                hop:add(f.hop_id, e(12, 1))
+                hop:add_le(f.hop_rx, e(0, 8))
+                hop:add_le(f.hop_res, e(8, 4))
+            end
+        end
+    elseif ptype == 1 and p:len() >= CTRL_HDR_SIZE then
+        local n = p(2, 1):uint()
+        t:add(f.src, p(1, 1))
+        t:add(f.dv_size, p(2, 1))
+        t:add(f.period, p(3, 1))
+        local entries = math.min(n, math.floor((p:len() - CTRL_HDR_SIZE) / 2))
+        for i = 0, entries - 1 do
+            local e = p(CTRL_HDR_SIZE + 2 * i, 2)
+            local dv = t:add(proto, e, string.format("R%d metric %d",
+                                                      e(0, 1):uint(), e(1, 1):uint()))
+            dv:add(f.dv_dest, e(0, 1))
+            dv:add(f.dv_metric, e(1, 1))
+        end
+        pinfo.cols.info = string.format("DV from R%d, %d entries", p(1, 1):uint(), n)
+        local off = CTRL_HDR_SIZE + 2 * n
+        if p:len() >= off + REL_SIZE and p(off, 1):uint() == REL_MAGIC then
+            t:add_le(f.rel_seq, p(off + 2, 2))
+            pinfo.cols.info = string.format("DV from R%d, %d entries, seq=%d",
+                                            p(1, 1):uint(), n, p(off + 2, 2):le_uint())
+        end
+    elseif ptype == 2 and p:len() >= ACK_SIZE then
+        t:add(f.src, p(1, 1))
+        t:add_le(f.rel_seq, p(2, 2))
+        pinfo.cols.info = string.format("ACK from R%d seq=%d", p(1, 1):uint(), p(2, 2):le_uint())
+    else
+        pinfo.cols.info = "malformed"
+    end
+    return buf:len()
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, proto)
@@ -0,0 +1,89 @@
+/*********************************
+**   Control socket client      **
+*********************************/
+
+/* Send one command to a running router through its control socket
+ * (see src/control.h) and print the response.
+ *
+ * Usage: routerctl <router_id> <command...>
+ *   routerctl 1 show ip route
+ *   routerctl 1 ping 4
+ *   routerctl 1 route add 6 2 3
+ * Without a command, the lines read on stdin are sent one by one.
+ *
+ * Exit status: 0 if every response ends with END, 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../src/control.h"
+
+static FILE *in;
+
+// Print the response of one request, return 0 if it is an error
+static int read_response() {
+    char line[CTL_CMD_MAX];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (!strcmp(line, CTL_END "\n"))
+            return 1;
+        if (!strncmp(line, CTL_ERR " ", strlen(CTL_ERR " "))) {
+            fprintf(stderr, "%s", line);
+            return 0;
+        }
+        fputs(line, stdout);
+    }
+    fprintf(stderr, "connection closed\n");
+    exit(EXIT_FAILURE);
+}
+
+static int request(int sock, const char *cmd) {
+    char buf[CTL_CMD_MAX];
+    int len = snprintf(buf, sizeof(buf), "%s\n", cmd);
+    if (len >= (int) sizeof(buf) || send(sock, buf, len, MSG_NOSIGNAL) != len) {
+        fprintf(stderr, "cannot send '%s'\n", cmd);
+        return 0;
+    }
+    return read_response();
+}
+
+int main(int argc, char **argv) {
+
+    struct sockaddr_un adr;
+    char cmd[CTL_CMD_MAX] = "";
+    int ok = 1;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <router_id> [command...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&adr, 0, sizeof(adr));
+    adr.sun_family = AF_UNIX;
+    snprintf(adr.sun_path, sizeof(adr.sun_path), CTL_PATH, atoi(argv[1]));
+    if (sock < 0 || connect(sock, (struct sockaddr *) &adr, sizeof(adr)) < 0) {
+        perror(adr.sun_path);
+        exit(EXIT_FAILURE);
+    }
+    in = fdopen(sock, "r");
+
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++) {
+            strncat(cmd, argv[i], sizeof(cmd) - strlen(cmd) - 2);
+            if (i + 1 < argc)
+                strcat(cmd, " ");
+        }
+        ok = request(sock, cmd);
+    } else {
+        while (fgets(cmd, sizeof(cmd), stdin) != NULL) {
+            cmd[strcspn(cmd, "\r\n")] = '\0';
+            ok &= request(sock, cmd);
+        }
+    }
+    fclose(in);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,405 @@
+/*********************************
+**   Topology generator for     **
+**   stress scenarios           **
+*********************************/
+
+/* Write a topology file in the router format (see topos/), with its
+ * size, degree and diameter in the header comments (also printed on stderr).
+ *
+ * Usage: topogen [-s <seed>] [-d <max_degree>] [-a <area_bits>] [-S <stub_degree>]
+ *                [-o <file>] <model> <params>
+ *   ring <n>               cycle of n routers
+ *   grid <rows> <cols>     2D mesh
+ *   er <n> <p>             Erdos-Renyi G(n, p), redrawn until connected
+ *   ba <n> <m>             Barabasi-Albert scale-free graph (m links per new router),
+ *                          -d caps the degree of the hubs
+ *   fattree <k>            k-ary fat-tree switches (k even): (k/2)^2 core,
+ *                          k pods of k/2 aggregation + k/2 edge switches
+ *
+ * -a writes an 'areabits' line: the routers are split in areas of
+ * consecutive ids (a warning is printed if an area is not connected).
+ * -S declares the routers with at most <stub_degree> neighbors as stubs.
+ *
+ * Router ids start at 1. The router itself only handles ids up to 255
+ * and MAX_NEIGHBORS neighbors per node: a warning is printed otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../src/router.h"
+
+#define ER_MAX_TRIES 100
+#define MAX_ID 255          // node_id_t
+
+typedef struct {
+    int size, cap;
+    int *tab;
+} vec_t;
+
+static int nb_nodes = 0;
+static int max_degree = 0;      // 0: no limit (ba only)
+static int areabits = 0;        // 0: no areas
+static int stub_degree = 0;     // 0: no stubs
+static vec_t *adj = NULL;
+static uint64_t rng_state = 88172645463325252ULL;
+
+/* ==================================================================== */
+/* ============================== UTILS =============================== */
+/* ==================================================================== */
+
+// xorshift64*: same sequence for a given seed on every platform
+static uint64_t rng() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double rng_unit() {
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void vec_push(vec_t *v, int x) {
+    if (v -> size == v -> cap) {
+        v -> cap = v -> cap ? 2 * v -> cap : 4;
+        v -> tab = realloc(v -> tab, v -> cap * sizeof(int));
+        if (v -> tab == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    v -> tab[v -> size++] = x;
+}
+
+static void init_graph(int n) {
+    for (int i = 0; i < nb_nodes; i++)
+        free(adj[i].tab);
+    free(adj);
+    nb_nodes = n;
+    adj = calloc(n, sizeof(vec_t));
+    if (adj == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int has_edge(int a, int b) {
+    for (int i = 0; i < adj[a].size; i++) {
+        if (adj[a].tab[i] == b)
+            return 1;
+    }
+    return 0;
+}
+
+// Undirected link between nodes a and b (0-based)
+static void add_edge(int a, int b) {
+    if (a == b || has_edge(a, b))
+        return;
+    vec_push(&adj[a], b);
+    vec_push(&adj[b], a);
+}
+
+/* ==================================================================== */
+/* ============================== MODELS ============================== */
+/* ==================================================================== */
+
+static void gen_ring(int n) {
+    init_graph(n);
+    for (int i = 0; i < n; i++)
+        add_edge(i, (i + 1) % n);
+}
+
+static void gen_grid(int rows, int cols) {
+    init_graph(rows * cols);
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            if (c + 1 < cols)
+                add_edge(r * cols + c, r * cols + c + 1);
+            if (r + 1 < rows)
+                add_edge(r * cols + c, (r + 1) * cols + c);
+        }
+    }
+}
+
+static void gen_er(int n, double p) {
+    init_graph(n);
+    for (int a = 0; a < n; a++) {
+        for (int b = a + 1; b < n; b++) {
+            if (rng_unit() < p)
+                add_edge(a, b);
+        }
+    }
+}
+
+// Preferential attachment: each new node links to m existing nodes,
+// chosen with a probability proportional to their degree
+static void gen_ba(int n, int m) {
+
+    vec_t ends = {0, 0, NULL};      // every edge end, for degree-proportional picks
+    init_graph(n);
+    for (int a = 0; a <= m && a < n; a++) {     // initial clique
+        for (int b = a + 1; b <= m && b < n; b++) {
+            add_edge(a, b);
+            vec_push(&ends, a);
+            vec_push(&ends, b);
+        }
+    }
+    for (int v = m + 1; v < n; v++) {
+        int links = 0;
+        while (links < m) {
+            int u = ends.tab[rng() % ends.size];
+            if (u == v || has_edge(u, v) || (max_degree && adj[u].size >= max_degree))
+                continue;
+            add_edge(u, v);
+            vec_push(&ends, u);
+            vec_push(&ends, v);
+            links++;
+        }
+    }
+    free(ends.tab);
+}
+
+// Switches of a k-ary fat-tree: core, then per pod aggregation and edge
+static void gen_fattree(int k) {
+
+    int half = k / 2;
+    int core = half * half;
+    init_graph(core + k * k);
+    for (int pod = 0; pod < k; pod++) {
+        int agg0 = core + pod * k;      // aggregation switches of the pod
+        int edge0 = agg0 + half;        // edge switches of the pod
+        for (int a = 0; a < half; a++) {
+            for (int c = 0; c < half; c++)
+                add_edge(agg0 + a, a * half + c);
+            for (int e = 0; e < half; e++)
+                add_edge(agg0 + a, edge0 + e);
+        }
+    }
+}
+
+/* ==================================================================== */
+/* ============================ ANALYSIS ============================== */
+/* ==================================================================== */
+
+// Eccentricity of 'src' (-1 if the graph is not connected)
+static int bfs(int src, int *dist, int *queue) {
+
+    int head = 0, tail = 0, reached = 1, ecc = 0;
+    for (int i = 0; i < nb_nodes; i++)
+        dist[i] = -1;
+    dist[src] = 0;
+    queue[tail++] = src;
+    while (head < tail) {
+        int u = queue[head++];
+        for (int i = 0; i < adj[u].size; i++) {
+            int v = adj[u].tab[i];
+            if (dist[v] < 0) {
+                dist[v] = dist[u] + 1;
+                if (dist[v] > ecc)
+                    ecc = dist[v];
+                queue[tail++] = v;
+                reached++;
+            }
+        }
+    }
+    return reached == nb_nodes ? ecc : -1;
+}
+
+static int is_connected() {
+    int *dist = malloc(nb_nodes * sizeof(int));
+    int *queue = malloc(nb_nodes * sizeof(int));
+    int ok = bfs(0, dist, queue) >= 0;
+    free(dist);
+    free(queue);
+    return ok;
+}
+
+#define AREA_OF(i) ((i + 1) >> (ID_BITS - areabits))
+
+// Components of the areas beyond the first one of each area
+// (0: the routers of each area are connected inside the area)
+static int split_areas() {
+
+    int *seen = calloc(nb_nodes, sizeof(int));
+    int *queue = malloc(nb_nodes * sizeof(int));
+    int split = 0;
+    for (int s = 0; s < nb_nodes; s++) {
+        if (seen[s])
+            continue;
+        // ids of an area are consecutive: the first one starts its first component
+        split += s > 0 && AREA_OF(s) == AREA_OF(s - 1);
+        int head = 0, tail = 0;
+        seen[s] = 1;
+        queue[tail++] = s;
+        while (head < tail) {
+            int u = queue[head++];
+            for (int i = 0; i < adj[u].size; i++) {
+                int v = adj[u].tab[i];
+                if (!seen[v] && AREA_OF(v) == AREA_OF(s)) {
+                    seen[v] = 1;
+                    queue[tail++] = v;
+                }
+            }
+        }
+    }
+    free(seen);
+    free(queue);
+    return split;
+}
+
+// Summary: nodes, edges, degree, diameter (-1: not connected)
+static int describe(char *buf, int size) {
+
+    int *dist = malloc(nb_nodes * sizeof(int));
+    int *queue = malloc(nb_nodes * sizeof(int));
+    int edges = 0, dmin = nb_nodes, dmax = 0, diameter = 0;
+
+    for (int i = 0; i < nb_nodes; i++) {
+        edges += adj[i].size;
+        if (adj[i].size < dmin)
+            dmin = adj[i].size;
+        if (adj[i].size > dmax)
+            dmax = adj[i].size;
+    }
+    for (int i = 0; i < nb_nodes && diameter >= 0; i++) {
+        int ecc = bfs(i, dist, queue);
+        diameter = ecc < 0 ? -1 : (ecc > diameter ? ecc : diameter);
+    }
+    snprintf(buf, size, "nodes %d, edges %d, degree min %d avg %.2f max %d, diameter %d",
+             nb_nodes, edges / 2, dmin, (double) edges / nb_nodes, dmax, diameter);
+    free(dist);
+    free(queue);
+    return diameter;
+}
+
+/* ==================================================================== */
+/* ============================== MAIN ================================ */
+/* ==================================================================== */
+
+static void usage(char *prog) {
+    printf("Usage: %s [-s <seed>] [-d <max_degree>] [-a <area_bits>] [-S <stub_degree>]\n"
+           "       [-o <file>] <model> <params>\n", prog);
+    printf("  ring <n> | grid <rows> <cols> | er <n> <p> | ba <n> <m> | fattree <k>\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+    char *out_file = NULL, cmdline[256] = "", summary[256];
+    unsigned long seed = 1;
+    int first = 1;
+
+    while (first + 1 < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-s"))
+            seed = strtoul(argv[first + 1], NULL, 10);
+        else if (!strcmp(argv[first], "-d"))
+            max_degree = atoi(argv[first + 1]);
+        else if (!strcmp(argv[first], "-o"))
+            out_file = argv[first + 1];
+        else if (!strcmp(argv[first], "-a") && atoi(argv[first + 1]) > 0
+                 && atoi(argv[first + 1]) < ID_BITS)
+            areabits = atoi(argv[first + 1]);
+        else if (!strcmp(argv[first], "-S"))
+            stub_degree = atoi(argv[first + 1]);
+        else
+            usage(argv[0]);
+        first += 2;
+    }
+    if (first >= argc)
+        usage(argv[0]);
+    rng_state ^= seed * 0x9E3779B97F4A7C15ULL;
+    if (rng_state == 0)
+        rng_state = 1;
+
+    char *model = argv[first];
+    int nparams = argc - first - 1;
+    char **params = argv + first + 1;
+    if (!strcmp(model, "ring") && nparams == 1 && atoi(params[0]) >= 3) {
+        gen_ring(atoi(params[0]));
+    } else if (!strcmp(model, "grid") && nparams == 2 && atoi(params[0]) > 0 && atoi(params[1]) > 0) {
+        gen_grid(atoi(params[0]), atoi(params[1]));
+    } else if (!strcmp(model, "er") && nparams == 2 && atoi(params[0]) > 1) {
+        int tries = 0;
+        do {
+            gen_er(atoi(params[0]), atof(params[1]));
+        } while (!is_connected() && ++tries < ER_MAX_TRIES);
+        if (tries == ER_MAX_TRIES)
+            fprintf(stderr, "Warning: no connected graph after %d draws (p too small?).\n", tries);
+    } else if (!strcmp(model, "ba") && nparams == 2
+               && atoi(params[1]) >= 1 && atoi(params[0]) > atoi(params[1])
+               && (!max_degree || max_degree > atoi(params[1]))) {
+        gen_ba(atoi(params[0]), atoi(params[1]));
+    } else if (!strcmp(model, "fattree") && nparams == 1
+               && atoi(params[0]) >= 2 && atoi(params[0]) % 2 == 0) {
+        gen_fattree(atoi(params[0]));
+    } else {
+        usage(argv[0]);
+    }
+
+    for (int i = first; i < argc; i++) {
+        strncat(cmdline, " ", sizeof(cmdline) - strlen(cmdline) - 1);
+        strncat(cmdline, argv[i], sizeof(cmdline) - strlen(cmdline) - 1);
+    }
+    int diameter = describe(summary, sizeof(summary));
+    fprintf(stderr, "%s: %s\n", model, summary);
+
+    int dmax = 0;
+    for (int i = 0; i < nb_nodes; i++)
+        dmax = adj[i].size > dmax ? adj[i].size : dmax;
+    if (nb_nodes > MAX_ID)
+        fprintf(stderr, "Warning: %d routers, the router only handles ids up to %d.\n", nb_nodes, MAX_ID);
+    if (nb_nodes > MAX_ROUTES)
+        fprintf(stderr, "Warning: %d routers, routing tables hold %d routes.\n", nb_nodes, MAX_ROUTES);
+    if (diameter > MAX_METRIC)
+        fprintf(stderr, "Warning: diameter %d, routes longer than %d hops are unreachable.\n", diameter, MAX_METRIC);
+    if (dmax > MAX_NEIGHBORS)
+        fprintf(stderr, "Warning: degree %d, the router handles %d neighbors.\n", dmax, MAX_NEIGHBORS);
+    int split = areabits ? split_areas() : 0;
+    if (split > 0)
+        fprintf(stderr, "Warning: %d area parts not connected to the rest of their area "
+                "(unreachable from it).\n", split);
+
+    FILE *f = out_file != NULL ? fopen(out_file, "wt") : stdout;
+    if (f == NULL) {
+        perror(out_file);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "# Generated topology (%d routers)\n", nb_nodes);
+    fprintf(f, "# topogen -s %lu", seed);
+    if (max_degree)
+        fprintf(f, " -d %d", max_degree);
+    if (areabits)
+        fprintf(f, " -a %d", areabits);
+    if (stub_degree)
+        fprintf(f, " -S %d", stub_degree);
+    fprintf(f, "%s\n", cmdline);
+    fprintf(f, "# %s\n", summary);
+    fprintf(f, "# Syntax: RID Nb1 Nb2 ...\n");
+    if (areabits)
+        fprintf(f, "areabits %d\n", areabits);
+    if (stub_degree) {
+        int n = 0;
+        for (int i = 0; i < nb_nodes; i++) {
+            if (adj[i].size > stub_degree)
+                continue;
+            if (n % 16 == 0)
+                fprintf(f, n > 0 ? "\nstub" : "stub");
+            fprintf(f, " %d", i + 1);
+            n++;
+        }
+        if (n > 0)
+            fprintf(f, "\n");
+    }
+    for (int i = 0; i < nb_nodes; i++) {
+        fprintf(f, "%d", i + 1);
+        for (int j = 0; j < adj[i].size; j++)
+            fprintf(f, " %d", adj[i].tab[j] + 1);
+        fprintf(f, "\n");
+    }
+    if (f != stdout)
+        fclose(f);
+    return EXIT_SUCCESS;
+}
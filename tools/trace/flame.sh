@@ -0,0 +1,41 @@
+#!/bin/sh
+# Flame graph of a running router with perf
+#
+# Usage: tools/trace/flame.sh <pid> [<seconds>] [<probe>]
+#   Samples the stacks of all the threads at 499 Hz for <seconds> (10 by
+#   default), or records the stack at each hit of the static tracepoint
+#   <probe> (packet_forward, dv_merge... see src/probes.h). Writes
+#   router-<pid>.svg if the FlameGraph scripts (stackcollapse-perf.pl and
+#   flamegraph.pl, https://github.com/brendangregg/FlameGraph) are in the
+#   PATH or in $FLAMEGRAPH, router-<pid>.perf (perf script) otherwise.
+#   Build with FLAGS+=-fno-omit-frame-pointer for complete stacks, or add
+#   --call-graph dwarf to PERF_OPTS.
+
+set -e
+pid=$1
+secs=${2:-10}
+probe=$3
+if [ -z "$pid" ]; then
+    echo "Usage: $0 <pid> [<seconds>] [<probe>]"
+    exit 1
+fi
+exe=$(readlink /proc/"$pid"/exe)
+out=router-$pid
+
+if [ -n "$probe" ]; then
+    # SDT notes -> uprobe event sdt_router:<probe>
+    perf buildid-cache --add "$exe"
+    perf probe -q -x "$exe" -a "%sdt_router:$probe" 2>/dev/null || true
+    perf record -q -g $PERF_OPTS -e "sdt_router:$probe" -p "$pid" -o "$out.data" -- sleep "$secs"
+else
+    perf record -q -g $PERF_OPTS -F 499 -p "$pid" -o "$out.data" -- sleep "$secs"
+fi
+perf script -i "$out.data" > "$out.perf"
+
+PATH=$PATH:${FLAMEGRAPH:-.}
+if command -v stackcollapse-perf.pl > /dev/null && command -v flamegraph.pl > /dev/null; then
+    stackcollapse-perf.pl "$out.perf" | flamegraph.pl --title "router $pid ${probe:-cpu}" > "$out.svg"
+    echo "$out.svg"
+else
+    echo "$out.perf (FlameGraph scripts not found)"
+fi